@@ -0,0 +1,223 @@
+package com.fpvout.digiview;
+
+import android.content.Intent;
+import android.os.Bundle;
+import android.os.Handler;
+import android.os.Looper;
+import android.os.SystemClock;
+import android.util.Log;
+
+import androidx.test.core.app.ActivityScenario;
+import androidx.test.core.app.ApplicationProvider;
+import androidx.test.ext.junit.runners.AndroidJUnit4;
+import androidx.test.platform.app.InstrumentationRegistry;
+
+import org.junit.Test;
+import org.junit.runner.RunWith;
+
+import java.io.File;
+import java.io.IOException;
+import java.util.Locale;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.TimeUnit;
+
+import usb.LatencyHistogram;
+import usb.PipelineStats;
+
+import static org.junit.Assert.assertTrue;
+import static org.junit.Assume.assumeTrue;
+
+/**
+ * Plays a capture through every preset in turn, switched in place like from the settings, and logs throughput, frame
+ * rates and latency percentiles for each, so regressions in the extractor or the data sources show up in numbers.
+ * Fails if a preset rendered no frames.
+ *
+ * Run with a capture pushed to the device, after answering the data collection agreement once:
+ * {@code adb shell am instrument -w -e class com.fpvout.digiview.PipelineBenchmarkTest -e capture <capture.h264>
+ * [-e paced false] com.fpvout.digiview.debug.test/androidx.test.runner.AndroidJUnitRunner}
+ *
+ * Without a capture the goggles' live stream is used, with the USB reads of each preset, so the sync, async and native
+ * reads can be compared on the same device. Skipped when no goggles are connected.
+ */
+@RunWith(AndroidJUnit4.class)
+public class PipelineBenchmarkTest {
+    private static final String TAG = "DIGIVIEW";
+    private static final long WARM_UP_MS = 2000;
+    private static final long RUN_MS = 10000;
+    private static final long CONNECT_TIMEOUT_MS = 10000;
+    private static final long FINISH_MARGIN_MS = 30000;
+
+    private final Handler handler = new Handler(Looper.getMainLooper());
+    private final PipelineStats stats = PipelineStats.getInstance();
+    private final PipelineStats.Stage[] stages = PipelineStats.Stage.values();
+    private final long[][] countsSince = new long[stages.length][LatencyHistogram.BUCKET_COUNT];
+    private final PerformancePreset.PresetType[] presetTypes = PerformancePreset.PresetType.values();
+    private final StringBuilder report = new StringBuilder();
+    private final StringBuilder failures = new StringBuilder();
+    private final CountDownLatch finished = new CountDownLatch(1);
+
+    private File capture;
+    private boolean paced;
+    private UsbMaskConnection connection;
+    private VideoPipeline videoReader;
+
+    private int presetIndex;
+    private ReplayInputStream stream;
+    private long runStartNs;
+    private long startReceivedBytes;
+    private long startExtractedFrames;
+    private long startRenderedFrames;
+    private long startDroppedFrames;
+    private long startSkippedFrames;
+
+    private final Runnable beginMeasure = this::beginMeasure;
+    private final Runnable endRun = this::endRun;
+
+    @Test
+    public void benchmarkPresets() throws InterruptedException {
+        Bundle arguments = InstrumentationRegistry.getArguments();
+        String capturePath = arguments.getString("capture");
+        capture = capturePath != null ? new File(capturePath) : null;
+        paced = !"false".equals(arguments.getString("paced"));
+
+        Intent intent = new Intent(ApplicationProvider.getApplicationContext(), MainActivity.class);
+        if (capture != null) {
+            // Replaying keeps the activity from waiting for the goggles, each run then replaces the stream.
+            intent.putExtra(MainActivity.EXTRA_REPLAY, capture.getPath());
+            intent.putExtra(MainActivity.EXTRA_PACED, paced);
+        }
+        try (ActivityScenario<MainActivity> scenario = ActivityScenario.launch(intent)) {
+            scenario.onActivity(activity -> {
+                connection = activity.mUsbMaskConnection;
+                videoReader = activity.mVideoPipeline;
+            });
+            if (capture == null) {
+                long deadlineMs = SystemClock.elapsedRealtime() + CONNECT_TIMEOUT_MS;
+                while (!connection.isReady() && SystemClock.elapsedRealtime() < deadlineMs) {
+                    Thread.sleep(100);
+                }
+                assumeTrue("No goggles connected", connection.isReady());
+            }
+
+            handler.post(this::start);
+            boolean done = finished.await(presetTypes.length * (WARM_UP_MS + RUN_MS) + FINISH_MARGIN_MS, TimeUnit.MILLISECONDS);
+            InstrumentationRegistry.getInstrumentation().runOnMainSync(this::stop);
+            assertTrue("Benchmark didn't finish", done);
+            assertTrue("No frames rendered with " + failures, failures.length() == 0);
+        }
+    }
+
+    private void start() {
+        presetIndex = 0;
+        report.setLength(0);
+        Log.i(TAG, "BENCHMARK - " + (capture == null ? "live" : capture + (paced ? ", paced" : ", as fast as possible")));
+        startRun();
+    }
+
+    private void stop() {
+        handler.removeCallbacks(beginMeasure);
+        handler.removeCallbacks(endRun);
+        releaseStream();
+    }
+
+    private void startRun() {
+        PerformancePreset preset = PerformancePreset.getPreset(presetTypes[presetIndex]);
+        if (capture == null) {
+            startLiveRun(preset);
+            return;
+        }
+        ReplayInputStream previousStream = stream;
+        try {
+            stream = new ReplayInputStream(capture, preset.usbTransferSize, paced, true, ReplayInputStream.DEFAULT_FRAME_RATE);
+        } catch (IOException e) {
+            Log.e(TAG, "BENCHMARK - unable to open " + capture + ": " + e.getMessage());
+            stream = previousStream;
+            addFailure();
+            finished.countDown();
+            return;
+        }
+        // The previous stream is released once the connection stopped reading it.
+        connection.setReplayStream(stream);
+        if (previousStream != null) {
+            previousStream.release();
+        }
+        if (videoReader.isRunning()) {
+            // Switched in place, as from the settings.
+            videoReader.setPreset(preset);
+        } else {
+            videoReader.setUsbMaskConnection(connection);
+            videoReader.start(preset);
+        }
+        handler.postDelayed(beginMeasure, WARM_UP_MS);
+    }
+
+    /**
+     * Runs the preset on the live stream, its USB reads switched on the open device.
+     */
+    private void startLiveRun(PerformancePreset preset) {
+        if (videoReader.isRunning()) {
+            videoReader.setPreset(preset);
+        } else {
+            connection.applyPreset(preset);
+            videoReader.setUsbMaskConnection(connection);
+            videoReader.start(preset);
+        }
+        handler.postDelayed(beginMeasure, WARM_UP_MS);
+    }
+
+    private void beginMeasure() {
+        runStartNs = System.nanoTime();
+        startReceivedBytes = stats.getReceivedBytes();
+        startExtractedFrames = stats.getExtractedFrames();
+        startRenderedFrames = stats.getRenderedFrames();
+        startDroppedFrames = stats.getDroppedFrames();
+        startSkippedFrames = stats.getSkippedFrames();
+        for (PipelineStats.Stage stage : stages) {
+            stats.getHistogram(stage).copyCounts(countsSince[stage.ordinal()]);
+        }
+        handler.postDelayed(endRun, RUN_MS);
+    }
+
+    private void endRun() {
+        float elapsedS = (System.nanoTime() - runStartNs) / 1e9f;
+        StringBuilder line = new StringBuilder();
+        line.append(String.format(Locale.US, "%s: %.1f Mbit/s, extracted %.1f fps, rendered %.1f fps, dropped %d, skipped %d",
+                presetTypes[presetIndex].name().toLowerCase(Locale.US),
+                (stats.getReceivedBytes() - startReceivedBytes) * 8 / 1e6f / elapsedS,
+                (stats.getExtractedFrames() - startExtractedFrames) / elapsedS,
+                (stats.getRenderedFrames() - startRenderedFrames) / elapsedS,
+                stats.getDroppedFrames() - startDroppedFrames,
+                stats.getSkippedFrames() - startSkippedFrames));
+        for (PipelineStats.Stage stage : stages) {
+            LatencyHistogram histogram = stats.getHistogram(stage);
+            long[] since = countsSince[stage.ordinal()];
+            float p50 = histogram.getPercentileMs(50, since);
+            if (p50 < 0) continue;
+            line.append(String.format(Locale.US, ", %s p50 %.1f p99 %.1f ms", stage.name().toLowerCase(Locale.US), p50, histogram.getPercentileMs(99, since)));
+        }
+        Log.i(TAG, "BENCHMARK - " + line);
+        report.append(line).append('\n');
+        if (stats.getRenderedFrames() == startRenderedFrames) addFailure();
+
+        if (++presetIndex < presetTypes.length) {
+            startRun();
+        } else {
+            videoReader.stop();
+            releaseStream();
+            Log.i(TAG, "BENCHMARK - done\n" + report);
+            finished.countDown();
+        }
+    }
+
+    private void addFailure() {
+        if (failures.length() > 0) failures.append(", ");
+        failures.append(presetTypes[presetIndex].name().toLowerCase(Locale.US));
+    }
+
+    private void releaseStream() {
+        if (stream != null) {
+            stream.release();
+            stream = null;
+        }
+    }
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright 2019, Digi International Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Native side of usb.NativeUSBInputStream: keeps bulk URBs queued on the
+ * receive end point through usbdevfs, each one receiving into its own slot
+ * of a direct ByteBuffer owned by the Java stream.
+ *
+ * Every function is called from the stream's reading thread only.
+ */
+
+#include <jni.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+
+#include <linux/usbdevice_fs.h>
+
+namespace {
+
+// Time given to discarded URBs to be returned by the kernel on cancel.
+constexpr int CANCEL_TIMEOUT_MS = 100;
+
+struct Reader {
+	int fd;
+	unsigned char endpoint;
+	int requestCount;
+	int requestSize;
+	unsigned char *ring;
+	usbdevfs_urb *urbs;
+	bool *inFlight;
+	int inFlightCount;
+};
+
+Reader *getReader(jlong handle) {
+	return reinterpret_cast<Reader *>(handle);
+}
+
+int64_t nowMs() {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+int submit(Reader *reader, int slot) {
+	if (slot < 0 || slot >= reader->requestCount)
+		return -EINVAL;
+	if (reader->inFlight[slot])
+		return 0;
+
+	usbdevfs_urb *urb = &reader->urbs[slot];
+	memset(urb, 0, sizeof(*urb));
+	urb->type = USBDEVFS_URB_TYPE_BULK;
+	urb->endpoint = reader->endpoint;
+	urb->buffer = reader->ring + static_cast<size_t>(slot) * reader->requestSize;
+	urb->buffer_length = reader->requestSize;
+	urb->usercontext = reinterpret_cast<void *>(static_cast<intptr_t>(slot));
+	if (ioctl(reader->fd, USBDEVFS_SUBMITURB, urb) < 0)
+		return -errno;
+
+	reader->inFlight[slot] = true;
+	reader->inFlightCount++;
+	return 0;
+}
+
+/*
+ * Returns the slot of a reaped URB, or -1 if it isn't one this reader has in
+ * flight: one submitted on the same fd by someone else, or left over from a
+ * reader whose cancel timed out. Those are skipped.
+ */
+int findSlot(Reader *reader, usbdevfs_urb *urb) {
+	// Compared as addresses, the URB may not point into the array at all.
+	uintptr_t offset = reinterpret_cast<uintptr_t>(urb) - reinterpret_cast<uintptr_t>(reader->urbs);
+	if (offset >= static_cast<uintptr_t>(reader->requestCount) * sizeof(usbdevfs_urb) || offset % sizeof(usbdevfs_urb) != 0)
+		return -1;
+	int slot = static_cast<int>(offset / sizeof(usbdevfs_urb));
+	if (reinterpret_cast<intptr_t>(urb->usercontext) != slot || !reader->inFlight[slot])
+		return -1;
+	return slot;
+}
+
+/*
+ * Waits for the next completed URB. The usbdevfs file descriptor polls
+ * writable while completed URBs are waiting to be reaped.
+ *
+ * Returns the slot in the high 32 bits and the received length in the low
+ * ones, or -errno, -ETIMEDOUT if nothing completed within the timeout.
+ * The timeout bounds the whole wait, across wake-ups that find nothing to
+ * reap and interrupted polls.
+ */
+jlong reap(Reader *reader, int timeoutMs) {
+	int64_t deadlineMs = nowMs() + timeoutMs;
+	usbdevfs_urb *urb = nullptr;
+	int slot = -1;
+	while (slot < 0) {
+		if (ioctl(reader->fd, USBDEVFS_REAPURBNDELAY, &urb) == 0) {
+			slot = findSlot(reader, urb);
+			continue;
+		}
+		if (errno != EAGAIN)
+			return -errno;
+		int64_t remainingMs = deadlineMs - nowMs();
+		if (remainingMs <= 0)
+			return -ETIMEDOUT;
+		pollfd pollFd = {reader->fd, POLLOUT, 0};
+		int ready = poll(&pollFd, 1, static_cast<int>(remainingMs));
+		if (ready < 0 && errno != EINTR)
+			return -errno;
+	}
+
+	reader->inFlight[slot] = false;
+	reader->inFlightCount--;
+	// A failed or discarded transfer is returned empty, its data can't be
+	// trusted to follow the previous one.
+	int length = urb->status < 0 ? 0 : urb->actual_length;
+	return (static_cast<jlong>(slot) << 32) | static_cast<uint32_t>(length);
+}
+
+void cancel(Reader *reader) {
+	for (int i = 0; i < reader->requestCount; i++) {
+		if (reader->inFlight[i])
+			ioctl(reader->fd, USBDEVFS_DISCARDURB, &reader->urbs[i]);
+	}
+	while (reader->inFlightCount > 0) {
+		if (reap(reader, CANCEL_TIMEOUT_MS) < 0)
+			break;
+	}
+}
+
+}
+
+extern "C" {
+
+JNIEXPORT jlong JNICALL
+Java_usb_NativeUSBInputStream_nativeOpen(JNIEnv *env, jclass, jint fd, jint endpoint, jobject ring, jint requestCount, jint requestSize) {
+	auto *address = static_cast<unsigned char *>(env->GetDirectBufferAddress(ring));
+	if (address == nullptr || env->GetDirectBufferCapacity(ring) < static_cast<jlong>(requestCount) * requestSize)
+		return 0;
+
+	auto *reader = static_cast<Reader *>(calloc(1, sizeof(Reader)));
+	if (reader == nullptr)
+		return 0;
+	reader->fd = fd;
+	reader->endpoint = static_cast<unsigned char>(endpoint);
+	reader->requestCount = requestCount;
+	reader->requestSize = requestSize;
+	reader->ring = address;
+	reader->urbs = static_cast<usbdevfs_urb *>(calloc(requestCount, sizeof(usbdevfs_urb)));
+	reader->inFlight = static_cast<bool *>(calloc(requestCount, sizeof(bool)));
+	if (reader->urbs == nullptr || reader->inFlight == nullptr) {
+		free(reader->urbs);
+		free(reader->inFlight);
+		free(reader);
+		return 0;
+	}
+	return reinterpret_cast<jlong>(reader);
+}
+
+JNIEXPORT jint JNICALL
+Java_usb_NativeUSBInputStream_nativeSubmit(JNIEnv *, jclass, jlong handle, jint slot) {
+	return submit(getReader(handle), slot);
+}
+
+JNIEXPORT jlong JNICALL
+Java_usb_NativeUSBInputStream_nativeReap(JNIEnv *, jclass, jlong handle, jint timeoutMs) {
+	return reap(getReader(handle), timeoutMs);
+}
+
+JNIEXPORT void JNICALL
+Java_usb_NativeUSBInputStream_nativeCancel(JNIEnv *, jclass, jlong handle) {
+	cancel(getReader(handle));
+}
+
+JNIEXPORT void JNICALL
+Java_usb_NativeUSBInputStream_nativeRelease(JNIEnv *, jclass, jlong handle) {
+	Reader *reader = getReader(handle);
+	cancel(reader);
+	free(reader->urbs);
+	free(reader->inFlight);
+	free(reader);
+}
+
+}
@@ -0,0 +1,132 @@
+package com.fpvout.digiview;
+
+import usb.ByteArrayPool;
+
+/**
+ * Reassembles complete H264 access units (Annex B, start codes included) from arbitrary chunks of a byte stream.
+ *
+ * An access unit is only known to be complete when the next one starts, or when {@link #flush()} is called at the end
+ * of the stream. An idle stream doesn't complete it: reads return nothing in the middle of access units too.
+ */
+public final class AccessUnitAssembler {
+    private static final byte[] START_CODE = {0, 0, 1};
+
+    public interface Listener {
+        /**
+         * Called for each complete access unit. {@code data} is only valid during the call.
+         */
+        void onAccessUnit(byte[] data, int length, boolean keyFrame, long arrivalTimeNs);
+    }
+
+    private final NalUnitScanner nalUnitScanner = new NalUnitScanner();
+    private final Listener listener;
+    private byte[] accessUnit;
+    private int accessUnitLength;
+    private boolean accessUnitKeyFrame;
+    private boolean started;
+    private long arrivalTimeNs;
+
+    public AccessUnitAssembler(int initialAccessUnitSize, Listener listener) {
+        this.listener = listener;
+        accessUnit = ByteArrayPool.getInstance().acquire(initialAccessUnitSize);
+    }
+
+    public void consume(byte[] data, int offset, int length) {
+        consume(data, offset, length, System.nanoTime());
+    }
+
+    /**
+     * Consumes a chunk that arrived earlier, e.g. read late from a {@link usb.BroadcastRingBuffer}.
+     */
+    public void consume(byte[] data, int offset, int length, long chunkArrivalTimeNs) {
+        arrivalTimeNs = chunkArrivalTimeNs;
+        int limit = offset + length;
+        int consumed = offset;
+        if (nalUnitScanner.isSlicePending() && length > 0) {
+            // A slice header ended the previous chunk, it was appended as a continuation.
+            byte[] pendingSlice = nalUnitScanner.takePendingSlice(data[offset]);
+            if (nalUnitScanner.isAccessUnitStart(pendingSlice, 0, pendingSlice.length)) {
+                // Its start code and header end the previous access unit.
+                accessUnitLength = Math.max(0, accessUnitLength - 4);
+                emit();
+                append(START_CODE, 0, START_CODE.length);
+                append(pendingSlice, 0, 1);
+                started = true;
+            }
+            if (NalUnitScanner.getNalUnitType(pendingSlice[0]) == NalUnitScanner.NAL_UNIT_TYPE_IDR) {
+                accessUnitKeyFrame = true;
+            }
+        }
+        int header = nalUnitScanner.findNalUnit(data, offset, limit);
+        while (header != -1) {
+            if (nalUnitScanner.deferSlice(data, header, limit)) {
+                header = nalUnitScanner.findNalUnit(data, header + 1, limit);
+                continue;
+            }
+            boolean accessUnitStart = nalUnitScanner.isAccessUnitStart(data, header, limit);
+            if (accessUnitStart) {
+                int startCode = header - 3;
+                if (startCode >= consumed) {
+                    append(data, consumed, startCode - consumed);
+                    emit();
+                    consumed = startCode;
+                } else {
+                    // The start code began in the previous chunk: take its zeros back from the previous access unit.
+                    append(data, consumed, header - consumed);
+                    accessUnitLength = Math.max(0, accessUnitLength - 3);
+                    emit();
+                    append(START_CODE, 0, START_CODE.length);
+                    consumed = header;
+                }
+                started = true;
+            }
+            if (NalUnitScanner.getNalUnitType(data[header]) == NalUnitScanner.NAL_UNIT_TYPE_IDR) {
+                accessUnitKeyFrame = true;
+            }
+            header = nalUnitScanner.findNalUnit(data, header + 1, limit);
+        }
+        append(data, consumed, limit - consumed);
+    }
+
+    /**
+     * Emits the pending access unit, considering it complete.
+     */
+    public void flush() {
+        emit();
+    }
+
+    public void reset() {
+        nalUnitScanner.reset();
+        accessUnitLength = 0;
+        accessUnitKeyFrame = false;
+        started = false;
+    }
+
+    public void release() {
+        ByteArrayPool.getInstance().release(accessUnit);
+        accessUnit = null;
+    }
+
+    private void emit() {
+        // Anything before the first access unit start is a partial access unit and can't be decoded.
+        if (started && accessUnitLength > 0) {
+            listener.onAccessUnit(accessUnit, accessUnitLength, accessUnitKeyFrame, arrivalTimeNs);
+        }
+        accessUnitLength = 0;
+        accessUnitKeyFrame = false;
+    }
+
+    private void append(byte[] data, int offset, int length) {
+        if (length <= 0) {
+            return;
+        }
+        if (accessUnitLength + length > accessUnit.length) {
+            byte[] larger = ByteArrayPool.getInstance().acquire(accessUnitLength + length);
+            System.arraycopy(accessUnit, 0, larger, 0, accessUnitLength);
+            ByteArrayPool.getInstance().release(accessUnit);
+            accessUnit = larger;
+        }
+        System.arraycopy(data, offset, accessUnit, accessUnitLength, length);
+        accessUnitLength += length;
+    }
+}
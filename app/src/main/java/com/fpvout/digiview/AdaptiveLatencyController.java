@@ -0,0 +1,148 @@
+package com.fpvout.digiview;
+
+import android.os.Handler;
+import android.os.Looper;
+import android.os.PowerManager;
+import android.util.Log;
+
+import com.google.android.exoplayer2.PlaybackParameters;
+import com.google.android.exoplayer2.Player;
+import com.google.android.exoplayer2.SimpleExoPlayer;
+
+import usb.LatencyHistogram;
+import usb.PipelineStats;
+
+/**
+ * Tunes the ExoPlayer pipeline while it plays instead of relying on a static preset.
+ *
+ * Every {@link #TICK_MS} it looks at the buffered duration, rebuffer events, dropped frames and render latency, and
+ * moves three knobs within bounds:
+ * - the target buffer depth, held by slightly speeding playback up when more is buffered,
+ * - the extractor sample pacing (see {@link H264Extractor#setSampleTime(long)}),
+ * - the number of dropped frames per tick tolerated before the pipeline is considered stuttering.
+ * It backs off quickly when the stream stutters or the device gets hot, and creeps back towards the lowest latency once
+ * it has been stable.
+ */
+public class AdaptiveLatencyController {
+    private static final String TAG = "DIGIVIEW";
+    private static final long TICK_MS = 500;
+    private static final int STABLE_TICKS_BEFORE_LOWERING = 20;
+
+    private static final int MIN_TARGET_BUFFER_MS = 0;
+    private static final int MAX_TARGET_BUFFER_MS = 250;
+    private static final int TARGET_BUFFER_STEP_MS = 17;
+    private static final long MIN_SAMPLE_TIME_US = 5000;
+    private static final long MAX_SAMPLE_TIME_US = 16666;
+    private static final long SAMPLE_TIME_STEP_US = 1000;
+    private static final int MIN_DROP_TOLERANCE = 0;
+    private static final int MAX_DROP_TOLERANCE = 4;
+    private static final float CATCH_UP_SPEED = 1.05f;
+    private static final float RENDER_LATENCY_MARGIN_MS = 34;
+
+    private final Handler handler = new Handler(Looper.getMainLooper());
+    private final SimpleExoPlayer player;
+    private final PipelineStats stats = PipelineStats.getInstance();
+    private final long[] renderCountsSince = new long[LatencyHistogram.BUCKET_COUNT];
+
+    private int targetBufferMs;
+    private long sampleTimeUs;
+    private int dropTolerance = MAX_DROP_TOLERANCE;
+    private int stableTicks;
+    private boolean rebuffered;
+    private boolean wasReady;
+    private long lastDroppedFrames;
+    private float speed = 1f;
+    private boolean running;
+
+    private final Runnable tick = new Runnable() {
+        @Override
+        public void run() {
+            update();
+            if (running) handler.postDelayed(this, TICK_MS);
+        }
+    };
+
+    private final Player.EventListener playerListener = new Player.EventListener() {
+        @Override
+        public void onPlaybackStateChanged(int state) {
+            if (state == Player.STATE_READY) {
+                wasReady = true;
+            } else if (state == Player.STATE_BUFFERING && wasReady) {
+                rebuffered = true;
+            }
+        }
+    };
+
+    AdaptiveLatencyController(SimpleExoPlayer player, PerformancePreset initialPreset) {
+        this.player = player;
+        targetBufferMs = Math.max(MIN_TARGET_BUFFER_MS, Math.min(MAX_TARGET_BUFFER_MS, initialPreset.exoPlayerBufferForPlaybackMs));
+        sampleTimeUs = Math.max(MIN_SAMPLE_TIME_US, Math.min(MAX_SAMPLE_TIME_US, initialPreset.h264ReaderSampleTime));
+    }
+
+    public void start() {
+        if (running) return;
+        running = true;
+        lastDroppedFrames = stats.getDroppedFrames();
+        stats.getHistogram(PipelineStats.Stage.RENDER).copyCounts(renderCountsSince);
+        H264Extractor.setSampleTime(sampleTimeUs);
+        player.addListener(playerListener);
+        handler.postDelayed(tick, TICK_MS);
+    }
+
+    public void stop() {
+        running = false;
+        handler.removeCallbacks(tick);
+        player.removeListener(playerListener);
+    }
+
+    private void update() {
+        long droppedFrames = stats.getDroppedFrames() - lastDroppedFrames;
+        lastDroppedFrames = stats.getDroppedFrames();
+        LatencyHistogram renderHistogram = stats.getHistogram(PipelineStats.Stage.RENDER);
+        float renderP99Ms = renderHistogram.getPercentileMs(99, renderCountsSince);
+        renderHistogram.copyCounts(renderCountsSince);
+
+        // Give the pipeline headroom before the OS throttles it: no further lowering once the device warms up, back off
+        // as if stuttering when it gets hot.
+        int thermalStatus = stats.getThermalStatus();
+        boolean warm = thermalStatus >= PowerManager.THERMAL_STATUS_MODERATE;
+        boolean stuttering = rebuffered || droppedFrames > dropTolerance || thermalStatus >= PowerManager.THERMAL_STATUS_SEVERE;
+        rebuffered = false;
+
+        if (stuttering) {
+            stableTicks = 0;
+            targetBufferMs = Math.min(MAX_TARGET_BUFFER_MS, targetBufferMs + 2 * TARGET_BUFFER_STEP_MS);
+            sampleTimeUs = Math.min(MAX_SAMPLE_TIME_US, sampleTimeUs + 2 * SAMPLE_TIME_STEP_US);
+            dropTolerance = Math.min(MAX_DROP_TOLERANCE, dropTolerance + 1);
+            Log.d(TAG, "adaptive - stutter (dropped " + droppedFrames + ", thermal " + PerformanceMode.getThermalStatusName(thermalStatus) + "), backing off: " + this);
+        } else if (!warm && ++stableTicks >= STABLE_TICKS_BEFORE_LOWERING) {
+            stableTicks = 0;
+            targetBufferMs = Math.max(MIN_TARGET_BUFFER_MS, targetBufferMs - TARGET_BUFFER_STEP_MS);
+            sampleTimeUs = Math.max(MIN_SAMPLE_TIME_US, sampleTimeUs - SAMPLE_TIME_STEP_US);
+            dropTolerance = Math.max(MIN_DROP_TOLERANCE, dropTolerance - 1);
+            Log.d(TAG, "adaptive - stable, lowering latency: " + this);
+        }
+        H264Extractor.setSampleTime(sampleTimeUs);
+
+        // Hold the target depth: play slightly faster while more than the target is buffered or frames reach the
+        // screen later than the target allows.
+        long bufferedMs = player.getTotalBufferedDuration();
+        boolean behind = bufferedMs > targetBufferMs + TARGET_BUFFER_STEP_MS
+                || (renderP99Ms > 0 && renderP99Ms > targetBufferMs + RENDER_LATENCY_MARGIN_MS);
+        float newSpeed = behind && !stuttering && !warm ? CATCH_UP_SPEED : 1f;
+        if (newSpeed != speed) {
+            speed = newSpeed;
+            player.setPlaybackParameters(new PlaybackParameters(speed));
+        }
+    }
+
+    @Override
+    public String toString() {
+        return "AdaptiveLatencyController{" +
+                "targetBufferMs=" + targetBufferMs +
+                ", sampleTimeUs=" + sampleTimeUs +
+                ", dropTolerance=" + dropTolerance +
+                ", speed=" + speed +
+                '}';
+    }
+}
@@ -0,0 +1,161 @@
+package com.fpvout.digiview;
+
+import android.util.Log;
+
+import java.util.concurrent.TimeUnit;
+
+import io.sentry.Breadcrumb;
+import io.sentry.Sentry;
+import io.sentry.SentryLevel;
+import usb.BroadcastRingBuffer;
+import usb.ByteArrayPool;
+import usb.PipelineStats;
+
+/**
+ * Checks the health of the H264 stream without decoding it, so a glitch can be told apart between data lost on the
+ * way (USB, a full buffer) and a bad stream from the goggles.
+ *
+ * Reads the capture ring through its own cursor and counts slice types, the signs of loss a {@link LossDetector} finds
+ * and the bitrate over each second. Counters go to {@link PipelineStats} for the stats overlay; anomalies are left as
+ * Sentry breadcrumbs, at most once a second, so they come with the next reported error.
+ */
+public class BitstreamAnalyzer implements LossDetector.Listener {
+    private static final String TAG = "DIGIVIEW";
+    private static final int INITIAL_ACCESS_UNIT_SIZE = 131072;
+    private static final int READ_SIZE = 131072;
+    private static final long BITRATE_WINDOW_NS = TimeUnit.SECONDS.toNanos(1);
+    private static final long BREADCRUMB_INTERVAL_NS = TimeUnit.SECONDS.toNanos(1);
+    // Past this lag the analyzer skips to live data, it only needs to keep up.
+    static final int MAX_LAG_BYTES = 1024 * 1024;
+
+    private volatile boolean analyzing;
+    private Thread analyzerThread;
+
+    // Analyzer thread only.
+    private final PipelineStats stats = PipelineStats.getInstance();
+    private final LossDetector lossDetector = new LossDetector(this);
+    private long windowStartNs;
+    private long windowBytes;
+    private long lastBreadcrumbNs;
+    private boolean anomalyPending;
+    private String lastAnomaly;
+
+    public void start(BroadcastRingBuffer.Cursor cursor) {
+        if (analyzing) return;
+        analyzing = true;
+        lossDetector.reset();
+        windowStartNs = 0;
+        windowBytes = 0;
+        anomalyPending = false;
+        analyzerThread = PipelineThreads.newThread("BitstreamAnalyzer", PipelineThreads.BACKGROUND_PRIORITY, () -> analyze(cursor));
+        analyzerThread.start();
+    }
+
+    public void stop() {
+        if (!analyzing) return;
+        analyzing = false;
+        if (analyzerThread != null) {
+            try {
+                analyzerThread.join();
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+            }
+            analyzerThread = null;
+        }
+    }
+
+    private void analyze(BroadcastRingBuffer.Cursor cursor) {
+        AccessUnitAssembler assembler = new AccessUnitAssembler(INITIAL_ACCESS_UNIT_SIZE, this::onAccessUnit);
+        byte[] buffer = ByteArrayPool.getInstance().acquire(READ_SIZE);
+        try {
+            while (analyzing) {
+                int readBytes = cursor.read(buffer, 0, READ_SIZE);
+                if (cursor.takeDiscontinuity()) {
+                    // Our own skip, not a stream problem: start over.
+                    assembler.reset();
+                    lossDetector.reset();
+                }
+                long now = System.nanoTime();
+                if (readBytes > 0) {
+                    assembler.consume(buffer, 0, readBytes, cursor.getLastArrivalTimeNs());
+                    updateBitrate(readBytes, cursor.getLastArrivalTimeNs());
+                }
+                if (anomalyPending && now - lastBreadcrumbNs >= BREADCRUMB_INTERVAL_NS) {
+                    leaveBreadcrumb(now);
+                }
+            }
+        } finally {
+            assembler.release();
+            ByteArrayPool.getInstance().release(buffer);
+        }
+    }
+
+    private void updateBitrate(int bytes, long arrivalTimeNs) {
+        if (windowStartNs == 0) windowStartNs = arrivalTimeNs;
+        windowBytes += bytes;
+        long elapsedNs = arrivalTimeNs - windowStartNs;
+        if (elapsedNs >= BITRATE_WINDOW_NS) {
+            stats.setBitstreamBitrate(windowBytes * 8 * 1_000_000_000L / elapsedNs);
+            windowStartNs = arrivalTimeNs;
+            windowBytes = 0;
+        }
+    }
+
+    private void onAccessUnit(byte[] data, int length, boolean keyFrame, long arrivalTimeNs) {
+        lossDetector.analyze(data, length);
+    }
+
+    @Override
+    public void onSlice(int sliceType) {
+        stats.onSlice(sliceType);
+    }
+
+    @Override
+    public void onCorruptNalUnit() {
+        stats.onCorruptNalUnit();
+        reportAnomaly("corrupt NAL unit");
+    }
+
+    @Override
+    public void onTruncatedNalUnit(String nalUnit) {
+        stats.onTruncatedNalUnit();
+        reportAnomaly("truncated " + nalUnit);
+    }
+
+    @Override
+    public void onLostSlice(int firstMb) {
+        stats.onLostSlice();
+        reportAnomaly("lost slice before macroblock " + firstMb);
+    }
+
+    @Override
+    public void onFrameNumGap(int missingFrames) {
+        stats.onFrameNumGap(missingFrames);
+        reportAnomaly("frame_num gap, " + missingFrames + " reference frames missing");
+    }
+
+    private void reportAnomaly(String anomaly) {
+        lastAnomaly = anomaly;
+        anomalyPending = true;
+    }
+
+    private void leaveBreadcrumb(long now) {
+        anomalyPending = false;
+        lastBreadcrumbNs = now;
+        Log.d(TAG, "BITSTREAM - " + lastAnomaly);
+
+        Breadcrumb breadcrumb = new Breadcrumb();
+        breadcrumb.setCategory("bitstream");
+        breadcrumb.setLevel(SentryLevel.WARNING);
+        breadcrumb.setMessage(lastAnomaly);
+        breadcrumb.setData("frameNumGaps", stats.getFrameNumGaps());
+        breadcrumb.setData("missingFrames", stats.getMissingFrames());
+        breadcrumb.setData("lostSlices", stats.getLostSlices());
+        breadcrumb.setData("truncatedNalUnits", stats.getTruncatedNalUnits());
+        breadcrumb.setData("corruptNalUnits", stats.getCorruptNalUnits());
+        breadcrumb.setData("bufferOverruns", stats.getBufferOverruns());
+        breadcrumb.setData("bitrate", stats.getBitstreamBitrate());
+        breadcrumb.setData("usbTransfers", stats.getTransferCount());
+        Sentry.addBreadcrumb(breadcrumb);
+    }
+}
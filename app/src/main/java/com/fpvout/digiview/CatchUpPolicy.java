@@ -0,0 +1,224 @@
+package com.fpvout.digiview;
+
+import android.util.Log;
+
+import java.util.concurrent.TimeUnit;
+
+import usb.CircularByteBuffer;
+import usb.PipelineStats;
+
+/**
+ * Latest-frame catch-up for a {@link CircularByteBuffer} holding an H264 byte stream, applied by its consumer.
+ *
+ * When more than the threshold is waiting in the buffer, the backlog is scanned in place and whole frames are
+ * discarded at NAL boundaries: up to the newest IDR frame (with its parameter sets) or, if there is none, the
+ * leading non-reference frames that nothing else depends on. The frame being read is always finished first.
+ * After an overrun the stream is already broken, so everything is discarded until the next IDR frame, or until
+ * {@link #MAX_KEY_FRAME_WAIT_NS} has passed for streams without periodic IDR frames.
+ */
+public class CatchUpPolicy {
+    private static final String TAG = "DIGIVIEW";
+    private static final long SCAN_INTERVAL_NS = TimeUnit.MILLISECONDS.toNanos(16);
+    private static final long MAX_KEY_FRAME_WAIT_NS = TimeUnit.SECONDS.toNanos(1);
+    // Kept when discarding without a frame start in sight, as a start code may be completed by the next write.
+    private static final int START_CODE_TAIL = 3;
+    private static final int MAX_PENDING_PARAMETER_SETS = 4096;
+
+    private final int thresholdBytes;
+    private final NalUnitScanner scanner = new NalUnitScanner();
+
+    // Consumed bytes, read or skipped, since creation.
+    private long position;
+    private long skipStart = -1;
+    private long skipEnd;
+    private int skipFrames;
+    private boolean waitingForKeyFrame;
+    private long waitStartNs;
+    private long lastScanNs;
+    private int lastOverrunCount;
+    private long skippedFrames;
+
+    // Scan results, as offsets from the read position.
+    private int frameCount;
+    private int firstFrameStart;
+    private int lastFrameStart;
+    private int keyFrameStart;
+    private int framesBeforeKeyFrame;
+    private int nonReferenceEnd;
+    private int nonReferenceFrames;
+    private boolean nonReferencePrefix;
+    private boolean currentFrameNonReference;
+    private int nonSliceRunStart;
+    private int pendingSliceStart;
+
+    public CatchUpPolicy(int thresholdBytes) {
+        this.thresholdBytes = thresholdBytes;
+    }
+
+    /**
+     * Discards stale data at the head of the buffer if needed, to be called before each read.
+     *
+     * @return The number of bytes skipped.
+     */
+    public int catchUp(CircularByteBuffer buffer) {
+        int overruns = buffer.getOverrunCount();
+        if (overruns != lastOverrunCount) {
+            lastOverrunCount = overruns;
+            if (!waitingForKeyFrame) {
+                Log.d(TAG, "catch-up - buffer overrun, waiting for a key frame");
+                waitingForKeyFrame = true;
+                waitStartNs = System.nanoTime();
+                skipStart = -1;
+            }
+        }
+
+        if (skipStart >= 0) {
+            if (position < skipStart) return 0;
+            int skipped = skip(buffer, (int) (skipEnd - position), skipFrames);
+            skipStart = -1;
+            return skipped;
+        }
+
+        int available = buffer.availableToRead();
+        long now = System.nanoTime();
+        if (!waitingForKeyFrame && (available <= thresholdBytes || now - lastScanNs < SCAN_INTERVAL_NS)) return 0;
+        lastScanNs = now;
+        scan(buffer, available);
+
+        if (waitingForKeyFrame) {
+            if (keyFrameStart >= 0) {
+                waitingForKeyFrame = false;
+                return skip(buffer, keyFrameStart, framesBeforeKeyFrame);
+            }
+            if (now - waitStartNs > MAX_KEY_FRAME_WAIT_NS && lastFrameStart >= 0) {
+                Log.d(TAG, "catch-up - no key frame, resuming at the newest frame");
+                waitingForKeyFrame = false;
+                return skip(buffer, lastFrameStart, frameCount - 1);
+            }
+            // Keep parameter sets that may precede a key frame not fully received yet.
+            int keep = nonSliceRunStart >= 0 && available - nonSliceRunStart <= MAX_PENDING_PARAMETER_SETS
+                    ? available - nonSliceRunStart : START_CODE_TAIL;
+            return skip(buffer, available - keep, frameCount);
+        }
+
+        // Finish the frame being read, then jump.
+        if (keyFrameStart > firstFrameStart) {
+            schedule(firstFrameStart, keyFrameStart, framesBeforeKeyFrame);
+        } else if (nonReferenceEnd > firstFrameStart) {
+            schedule(firstFrameStart, nonReferenceEnd, nonReferenceFrames);
+        }
+        return 0;
+    }
+
+    /**
+     * @return The number of bytes the consumer may read now, at most {@code readLength}. 0 while waiting for a key
+     * frame.
+     */
+    public int limitReadLength(int readLength) {
+        if (waitingForKeyFrame) return 0;
+        if (skipStart >= 0) return (int) Math.min(readLength, skipStart - position);
+        return readLength;
+    }
+
+    /**
+     * Reports bytes read by the consumer.
+     */
+    public void onRead(int bytes) {
+        position += bytes;
+    }
+
+    public long getSkippedFrames() {
+        return skippedFrames;
+    }
+
+    private void schedule(int start, int end, int frames) {
+        skipStart = position + start;
+        skipEnd = position + end;
+        skipFrames = frames;
+    }
+
+    private int skip(CircularByteBuffer buffer, int bytes, int frames) {
+        if (bytes <= 0) return 0;
+        int skipped = buffer.skip(bytes);
+        position += skipped;
+        if (frames > 0) {
+            skippedFrames += frames;
+            PipelineStats.getInstance().onFramesSkipped(frames);
+        }
+        return skipped;
+    }
+
+    private void scan(CircularByteBuffer buffer, int available) {
+        frameCount = 0;
+        firstFrameStart = -1;
+        lastFrameStart = -1;
+        keyFrameStart = -1;
+        framesBeforeKeyFrame = 0;
+        nonReferenceEnd = -1;
+        nonReferenceFrames = 0;
+        nonReferencePrefix = true;
+        currentFrameNonReference = true;
+        nonSliceRunStart = -1;
+        scanner.reset();
+
+        byte[] data = buffer.array();
+        int offset = buffer.getReadableOffset();
+        int contiguous = Math.min(available, data.length - offset);
+        scanRegion(data, offset, offset + contiguous, 0);
+        if (contiguous < available) {
+            scanRegion(data, 0, available - contiguous, contiguous);
+        }
+    }
+
+    private void scanRegion(byte[] data, int from, int limit, int base) {
+        if (scanner.isSlicePending() && from < limit) {
+            // A slice header ended the first region, the wraparound tells whether it starts a frame.
+            byte[] pendingSlice = scanner.takePendingSlice(data[from]);
+            onSlice(pendingSlice[0], NalUnitScanner.isFirstSlice(pendingSlice, 0, pendingSlice.length), pendingSliceStart);
+        }
+        int header = scanner.findNalUnit(data, from, limit);
+        while (header != -1) {
+            // Offset of the start code, which may have begun in the previous region.
+            int nalUnitStart = Math.max(0, base + header - from - 3);
+            int nalUnitType = NalUnitScanner.getNalUnitType(data[header]);
+            if (scanner.deferSlice(data, header, limit)) {
+                pendingSliceStart = nalUnitStart;
+            } else if (NalUnitScanner.isSlice(nalUnitType)) {
+                onSlice(data[header], NalUnitScanner.isFirstSlice(data, header, limit), nalUnitStart);
+            } else if (nonSliceRunStart < 0) {
+                nonSliceRunStart = nalUnitStart;
+            }
+            header = scanner.findNalUnit(data, header + 1, limit);
+        }
+    }
+
+    private void onSlice(byte nalHeader, boolean firstSlice, int nalUnitStart) {
+        if (firstSlice) {
+            onFrameStart(nonSliceRunStart >= 0 ? nonSliceRunStart : nalUnitStart, NalUnitScanner.getNalUnitType(nalHeader));
+        }
+        if ((nalHeader & 0x60) != 0) {
+            currentFrameNonReference = false;
+        }
+        nonSliceRunStart = -1;
+    }
+
+    private void onFrameStart(int frameStart, int nalUnitType) {
+        if (frameCount > 0) {
+            if (nonReferencePrefix && currentFrameNonReference) {
+                nonReferenceEnd = frameStart;
+                nonReferenceFrames = frameCount;
+            } else {
+                nonReferencePrefix = false;
+            }
+        } else {
+            firstFrameStart = frameStart;
+        }
+        if (nalUnitType == NalUnitScanner.NAL_UNIT_TYPE_IDR) {
+            keyFrameStart = frameStart;
+            framesBeforeKeyFrame = frameCount;
+        }
+        lastFrameStart = frameStart;
+        currentFrameNonReference = true;
+        frameCount++;
+    }
+}
@@ -9,6 +9,12 @@ import androidx.appcompat.app.AppCompatActivity;
 import androidx.preference.PreferenceManager;
 
 public class DataCollectionAgreementPopupActivity extends AppCompatActivity {
+    // The agreement text asked for crash reports only before version 2, which added performance summaries: replies to
+    // older versions are asked again, and only accepting version 2 or later enables the summaries.
+    static final String ConsentVersion = "dataCollectionVersion";
+    static final String TelemetryAccepted = "telemetryAccepted";
+    static final int CURRENT_CONSENT_VERSION = 2;
+
     private SharedPreferences preferences;
     private AlertDialog.Builder builder;
 
@@ -31,6 +37,8 @@ public class DataCollectionAgreementPopupActivity extends AppCompatActivity {
     private void cancelDataCollection() {
         preferences.edit()
                 .putBoolean("dataCollectionAccepted", false)
+                .putBoolean(TelemetryAccepted, false)
+                .putInt(ConsentVersion, CURRENT_CONSENT_VERSION)
                 .putBoolean("dataCollectionReplied", true).apply();
 
         Intent intent = new Intent();
@@ -42,6 +50,8 @@ public class DataCollectionAgreementPopupActivity extends AppCompatActivity {
     private void confirmDataCollection() {
         preferences.edit()
                 .putBoolean("dataCollectionAccepted", true)
+                .putBoolean(TelemetryAccepted, true)
+                .putInt(ConsentVersion, CURRENT_CONSENT_VERSION)
                 .putBoolean("dataCollectionReplied", true).apply();
         Intent intent = new Intent();
         setResult(RESULT_OK, intent);
@@ -0,0 +1,315 @@
+package com.fpvout.digiview;
+
+import android.content.Context;
+import android.content.SharedPreferences;
+import android.media.Image;
+import android.media.MediaCodec;
+import android.media.MediaCodecInfo;
+import android.media.MediaCodecList;
+import android.media.MediaFormat;
+import android.os.Build;
+import android.os.Process;
+import android.util.Log;
+
+import androidx.preference.PreferenceManager;
+
+import com.google.android.exoplayer2.util.MimeTypes;
+
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Locale;
+
+/**
+ * Picks the preset used when the video preset is set to auto, by probing the H264 decoders of the phone once per
+ * device model and build.
+ *
+ * The probe enumerates the H264 decoders, checks whether the best one is hardware accelerated, supports the low
+ * latency feature and the goggles' 720p60, then calibrates it: a short clip produced by the phone's encoder is decoded
+ * once paced at 60fps for the latency, once as fast as possible for the throughput. The result is cached in the
+ * preferences, the probe runs again after a system update.
+ */
+public final class DecoderProbe {
+    private static final String TAG = "DIGIVIEW";
+    static final String AUTO_PRESET = "auto";
+    private static final String AutoPreset = "AutoPreset_";
+    private static final String AutoPresetBuild = "AutoPresetBuild_";
+
+    private static final int WIDTH = 1280;
+    private static final int HEIGHT = 720;
+    private static final int FRAME_RATE = 60;
+    private static final int BIT_RATE = 25_000_000;
+    private static final int FRAME_COUNT = 60;
+    private static final long FRAME_INTERVAL_NS = 1_000_000_000L / FRAME_RATE;
+    private static final long CODEC_TIMEOUT_US = 10000;
+    private static final long DRAIN_TIMEOUT_NS = 500_000_000L;
+
+    // Calibration thresholds: a frame interval of latency and 1.5x real time or better for the direct decoder, two frame
+    // intervals and some headroom over real time for the low latency preset.
+    private static final float DIRECT_DECODE_MAX_LATENCY_MS = 16.7f;
+    private static final float DIRECT_DECODE_MIN_FPS = 90;
+    private static final float LOW_LATENCY_MAX_LATENCY_MS = 33.3f;
+    private static final float LOW_LATENCY_MIN_FPS = 75;
+    private static final float DEFAULT_MIN_FPS = 60;
+
+    private static final class Frame {
+        final byte[] data;
+        final int flags;
+
+        Frame(byte[] data, int flags) {
+            this.data = data;
+            this.flags = flags;
+        }
+    }
+
+    private static final class Result {
+        String decoderName;
+        boolean hardware;
+        boolean lowLatency;
+        boolean supports720p60;
+        float latencyMs = -1;
+        float fps = -1;
+    }
+
+    private DecoderProbe() {
+    }
+
+    /**
+     * Returns the preset key picked for this device, or {@code "default"} until the probe completed.
+     */
+    static String getAutoPreset(SharedPreferences preferences) {
+        return preferences.getString(AutoPreset + Build.MODEL, "default");
+    }
+
+    /**
+     * Probes the decoders on a background thread, unless done before on this device model and build.
+     */
+    public static void probeIfNeeded(Context context) {
+        SharedPreferences preferences = PreferenceManager.getDefaultSharedPreferences(context.getApplicationContext());
+        if (Build.FINGERPRINT.equals(preferences.getString(AutoPresetBuild + Build.MODEL, null))) return;
+        PipelineThreads.newThread("DecoderProbe", Process.THREAD_PRIORITY_DEFAULT, () -> {
+            Result result = probe();
+            String preset = choosePreset(result);
+            Log.i(TAG, String.format(Locale.US, "PROBE - %s%s%s%s, latency %.1f ms, %.0f fps: %s",
+                    result.decoderName, result.hardware ? ", hardware" : "", result.lowLatency ? ", low latency" : "",
+                    result.supports720p60 ? ", 720p60" : "", result.latencyMs, result.fps, preset));
+            preferences.edit()
+                    .putString(AutoPreset + Build.MODEL, preset)
+                    .putString(AutoPresetBuild + Build.MODEL, Build.FINGERPRINT)
+                    .apply();
+        }).start();
+    }
+
+    private static String choosePreset(Result result) {
+        if (result.decoderName == null) return "default";
+        if (result.fps < 0) {
+            // Calibration isn't possible without an encoder, go by the capabilities.
+            return result.hardware && result.lowLatency && result.supports720p60 ? "low_latency" : "default";
+        }
+        if (result.hardware && result.lowLatency && result.latencyMs <= DIRECT_DECODE_MAX_LATENCY_MS && result.fps >= DIRECT_DECODE_MIN_FPS) {
+            return "direct_decode";
+        }
+        if (result.latencyMs <= LOW_LATENCY_MAX_LATENCY_MS && result.fps >= LOW_LATENCY_MIN_FPS) {
+            return "low_latency";
+        }
+        return result.fps >= DEFAULT_MIN_FPS ? "default" : "conservative";
+    }
+
+    private static Result probe() {
+        Result result = new Result();
+        MediaCodecInfo decoder = findDecoder();
+        if (decoder == null) return result;
+        result.decoderName = decoder.getName();
+        result.hardware = isHardware(decoder);
+        MediaCodecInfo.CodecCapabilities capabilities = decoder.getCapabilitiesForType(MimeTypes.VIDEO_H264);
+        MediaCodecInfo.VideoCapabilities videoCapabilities = capabilities.getVideoCapabilities();
+        result.supports720p60 = videoCapabilities != null && videoCapabilities.areSizeAndRateSupported(WIDTH, HEIGHT, FRAME_RATE);
+        result.lowLatency = Build.VERSION.SDK_INT >= Build.VERSION_CODES.R
+                && capabilities.isFeatureSupported(MediaCodecInfo.CodecCapabilities.FEATURE_LowLatency);
+
+        try {
+            List<Frame> clip = encodeClip();
+            if (clip.isEmpty()) return result;
+            float[] paced = decode(decoder.getName(), clip, true, result.lowLatency);
+            if (paced == null) return result;
+            float[] unpaced = decode(decoder.getName(), clip, false, result.lowLatency);
+            if (unpaced == null) return result;
+            result.latencyMs = paced[0];
+            result.fps = unpaced[1];
+        } catch (IOException | RuntimeException e) {
+            Log.e(TAG, "PROBE - calibration failed: " + e.getMessage());
+        }
+        return result;
+    }
+
+    /**
+     * Returns the decoder the engines get for H264, a hardware one if there is any.
+     */
+    private static MediaCodecInfo findDecoder() {
+        MediaCodecInfo software = null;
+        for (MediaCodecInfo info : new MediaCodecList(MediaCodecList.REGULAR_CODECS).getCodecInfos()) {
+            if (info.isEncoder() || !supportsH264(info)) continue;
+            if (isHardware(info)) return info;
+            if (software == null) software = info;
+        }
+        return software;
+    }
+
+    private static boolean supportsH264(MediaCodecInfo info) {
+        for (String type : info.getSupportedTypes()) {
+            if (type.equalsIgnoreCase(MimeTypes.VIDEO_H264)) return true;
+        }
+        return false;
+    }
+
+    private static boolean isHardware(MediaCodecInfo info) {
+        if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.Q) return info.isHardwareAccelerated();
+        String name = info.getName().toLowerCase(Locale.US);
+        return !name.startsWith("omx.google.") && !name.startsWith("c2.android.") && !name.contains(".sw.");
+    }
+
+    /**
+     * Encodes a second of moving gradient at the goggles' resolution, frame rate and bit rate. The codec config comes
+     * first.
+     */
+    private static List<Frame> encodeClip() throws IOException {
+        List<Frame> frames = new ArrayList<>();
+        MediaFormat format = MediaFormat.createVideoFormat(MimeTypes.VIDEO_H264, WIDTH, HEIGHT);
+        format.setInteger(MediaFormat.KEY_COLOR_FORMAT, MediaCodecInfo.CodecCapabilities.COLOR_FormatYUV420Flexible);
+        format.setInteger(MediaFormat.KEY_BIT_RATE, BIT_RATE);
+        format.setInteger(MediaFormat.KEY_FRAME_RATE, FRAME_RATE);
+        format.setInteger(MediaFormat.KEY_I_FRAME_INTERVAL, 1);
+        MediaCodec encoder = MediaCodec.createEncoderByType(MimeTypes.VIDEO_H264);
+        MediaCodec.BufferInfo info = new MediaCodec.BufferInfo();
+        try {
+            encoder.configure(format, null, null, MediaCodec.CONFIGURE_FLAG_ENCODE);
+            encoder.start();
+            int queued = 0;
+            long lastOutputNs = System.nanoTime();
+            while (frames.size() <= FRAME_COUNT && System.nanoTime() - lastOutputNs < DRAIN_TIMEOUT_NS) {
+                if (queued <= FRAME_COUNT) {
+                    int index = encoder.dequeueInputBuffer(CODEC_TIMEOUT_US);
+                    if (index >= 0) {
+                        if (queued == FRAME_COUNT) {
+                            encoder.queueInputBuffer(index, 0, 0, 0, MediaCodec.BUFFER_FLAG_END_OF_STREAM);
+                        } else {
+                            Image image = encoder.getInputImage(index);
+                            if (image == null) return frames;
+                            drawFrame(image, queued);
+                            encoder.queueInputBuffer(index, 0, WIDTH * HEIGHT * 3 / 2, queued * FRAME_INTERVAL_NS / 1000, 0);
+                        }
+                        queued++;
+                    }
+                }
+                int index = encoder.dequeueOutputBuffer(info, CODEC_TIMEOUT_US);
+                if (index < 0) continue;
+                lastOutputNs = System.nanoTime();
+                if ((info.flags & MediaCodec.BUFFER_FLAG_END_OF_STREAM) != 0) break;
+                ByteBuffer buffer = encoder.getOutputBuffer(index);
+                if (buffer != null && info.size > 0) {
+                    byte[] data = new byte[info.size];
+                    buffer.position(info.offset);
+                    buffer.get(data);
+                    frames.add(new Frame(data, info.flags));
+                }
+                encoder.releaseOutputBuffer(index, false);
+            }
+        } finally {
+            encoder.release();
+        }
+        return frames;
+    }
+
+    private static void drawFrame(Image image, int frameIndex) {
+        Image.Plane[] planes = image.getPlanes();
+        ByteBuffer luma = planes[0].getBuffer();
+        int rowStride = planes[0].getRowStride();
+        int pixelStride = planes[0].getPixelStride();
+        byte[] row = new byte[WIDTH];
+        for (int y = 0; y < HEIGHT; y++) {
+            for (int x = 0; x < WIDTH; x++) {
+                row[x] = (byte) ((x + y + frameIndex * 8) >> 2);
+            }
+            if (pixelStride == 1) {
+                luma.position(y * rowStride);
+                luma.put(row);
+            } else {
+                for (int x = 0; x < WIDTH; x++) {
+                    luma.put(y * rowStride + x * pixelStride, row[x]);
+                }
+            }
+        }
+        for (int p = 1; p < planes.length; p++) {
+            ByteBuffer chroma = planes[p].getBuffer();
+            while (chroma.hasRemaining()) chroma.put((byte) 128);
+        }
+    }
+
+    /**
+     * Decodes the clip without a surface, paced at the frame rate or as fast as possible. Returns the average time from
+     * queueing a picture to getting it decoded and the decoded frames per second, or null if some didn't come out.
+     */
+    private static float[] decode(String decoderName, List<Frame> clip, boolean paced, boolean lowLatency) throws IOException {
+        MediaFormat format = MediaFormat.createVideoFormat(MimeTypes.VIDEO_H264, WIDTH, HEIGHT);
+        if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.M) {
+            format.setInteger(MediaFormat.KEY_PRIORITY, 0); // realtime
+        }
+        if (lowLatency && Build.VERSION.SDK_INT >= Build.VERSION_CODES.R) {
+            format.setInteger(MediaFormat.KEY_LOW_LATENCY, 1);
+        }
+        int pictures = 0;
+        for (Frame frame : clip) {
+            if ((frame.flags & MediaCodec.BUFFER_FLAG_CODEC_CONFIG) == 0) pictures++;
+        }
+        MediaCodec decoder = MediaCodec.createByCodecName(decoderName);
+        MediaCodec.BufferInfo info = new MediaCodec.BufferInfo();
+        long[] queueTimesNs = new long[pictures];
+        long totalLatencyNs = 0;
+        int decoded = 0;
+        long startNs;
+        long lastOutputNs;
+        try {
+            decoder.configure(format, null, null, 0);
+            decoder.start();
+            int queued = 0;
+            int queuedPictures = 0;
+            startNs = System.nanoTime();
+            lastOutputNs = startNs;
+            while (decoded < pictures && System.nanoTime() - lastOutputNs < DRAIN_TIMEOUT_NS) {
+                boolean due = !paced || System.nanoTime() - startNs >= queuedPictures * FRAME_INTERVAL_NS;
+                if (queued < clip.size() && due) {
+                    int index = decoder.dequeueInputBuffer(paced ? 0 : CODEC_TIMEOUT_US);
+                    if (index >= 0) {
+                        Frame frame = clip.get(queued++);
+                        ByteBuffer buffer = decoder.getInputBuffer(index);
+                        buffer.clear();
+                        buffer.put(frame.data);
+                        if ((frame.flags & MediaCodec.BUFFER_FLAG_CODEC_CONFIG) != 0) {
+                            decoder.queueInputBuffer(index, 0, frame.data.length, 0, MediaCodec.BUFFER_FLAG_CODEC_CONFIG);
+                        } else {
+                            // Pictures are timestamped with their index.
+                            queueTimesNs[queuedPictures] = System.nanoTime();
+                            decoder.queueInputBuffer(index, 0, frame.data.length, queuedPictures++, 0);
+                        }
+                    }
+                }
+                int index = decoder.dequeueOutputBuffer(info, paced ? 1000 : 0);
+                if (index >= 0) {
+                    lastOutputNs = System.nanoTime();
+                    int picture = (int) info.presentationTimeUs;
+                    if (picture >= 0 && picture < pictures) {
+                        totalLatencyNs += lastOutputNs - queueTimesNs[picture];
+                    }
+                    decoded++;
+                    decoder.releaseOutputBuffer(index, false);
+                }
+            }
+            decoder.stop();
+        } finally {
+            decoder.release();
+        }
+        if (decoded < pictures || decoded == 0) return null;
+        return new float[]{totalLatencyNs / 1e6f / decoded, decoded * 1e9f / (lastOutputNs - startNs)};
+    }
+}
@@ -0,0 +1,181 @@
+package com.fpvout.digiview;
+
+import android.media.MediaCodec;
+import android.media.MediaMuxer;
+import android.util.Log;
+
+import java.io.File;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.text.SimpleDateFormat;
+import java.util.Date;
+import java.util.Locale;
+import java.util.concurrent.TimeUnit;
+
+import usb.BroadcastRingBuffer;
+import usb.ByteArrayPool;
+
+/**
+ * Records the raw H264 stream to an MP4 file, without re-encoding, while it is displayed.
+ *
+ * A background thread reads the stream through its own cursor on the capture ring, reassembles access units and muxes
+ * them with their arrival times as timestamps. The cursor keeps as much data as possible: when storage can't keep up
+ * for longer than the ring holds, only the lost data is skipped, never blocking the live pipeline, and recording resumes
+ * at the next key frame.
+ */
+public class DvrRecorder {
+    private static final String TAG = "DIGIVIEW";
+    private static final int INITIAL_ACCESS_UNIT_SIZE = 131072;
+    private static final int READ_SIZE = 131072;
+
+    private final File directory;
+    private volatile boolean recording;
+    private volatile BroadcastRingBuffer.Cursor cursor;
+    private Thread writerThread;
+
+    // Writer thread only.
+    private File file;
+    private MediaMuxer muxer;
+    private int track = -1;
+    private ByteBuffer sampleBuffer;
+    private final MediaCodec.BufferInfo sampleInfo = new MediaCodec.BufferInfo();
+    private long firstArrivalTimeNs;
+    private long lastPresentationTimeUs = -1;
+    private boolean waitingForKeyFrame = true;
+    private long writtenFrames;
+
+    public DvrRecorder(File directory) {
+        this.directory = directory;
+    }
+
+    /**
+     * Starts recording from the given cursor, which should only skip lost data.
+     */
+    public void start(BroadcastRingBuffer.Cursor stream) {
+        if (recording) return;
+        recording = true;
+        cursor = stream;
+        waitingForKeyFrame = true;
+        firstArrivalTimeNs = 0;
+        lastPresentationTimeUs = -1;
+        writtenFrames = 0;
+        writerThread = PipelineThreads.newThread("DvrWriter", PipelineThreads.BACKGROUND_PRIORITY, this::write);
+        writerThread.start();
+    }
+
+    public void stop() {
+        if (!recording) return;
+        recording = false;
+        if (writerThread != null) {
+            try {
+                writerThread.join();
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+            }
+            writerThread = null;
+        }
+    }
+
+    public boolean isRecording() {
+        return recording;
+    }
+
+    /**
+     * @return Bytes dropped because storage couldn't keep up.
+     */
+    public long getDroppedBytes() {
+        BroadcastRingBuffer.Cursor stream = cursor;
+        return stream != null ? stream.getSkippedBytes() : 0;
+    }
+
+    private void write() {
+        AccessUnitAssembler assembler = new AccessUnitAssembler(INITIAL_ACCESS_UNIT_SIZE, this::writeAccessUnit);
+        byte[] buffer = ByteArrayPool.getInstance().acquire(READ_SIZE);
+        BroadcastRingBuffer.Cursor stream = cursor;
+        try {
+            while (recording) {
+                int readBytes = stream.read(buffer, 0, READ_SIZE);
+                if (stream.takeDiscontinuity()) {
+                    assembler.reset();
+                    waitingForKeyFrame = true;
+                }
+                if (readBytes <= 0) continue;
+                assembler.consume(buffer, 0, readBytes, stream.getLastArrivalTimeNs());
+            }
+            assembler.flush();
+        } finally {
+            assembler.release();
+            ByteArrayPool.getInstance().release(buffer);
+            releaseMuxer();
+        }
+    }
+
+    private void writeAccessUnit(byte[] data, int length, boolean keyFrame, long arrivalTimeNs) {
+        if (waitingForKeyFrame) {
+            if (!keyFrame) return;
+            if (muxer == null && !startMuxer(data, length)) return;
+            waitingForKeyFrame = false;
+            if (firstArrivalTimeNs == 0) firstArrivalTimeNs = arrivalTimeNs;
+        }
+
+        if (sampleBuffer == null || sampleBuffer.capacity() < length) {
+            sampleBuffer = ByteBuffer.allocateDirect(Math.max(length, INITIAL_ACCESS_UNIT_SIZE));
+        }
+        sampleBuffer.clear();
+        sampleBuffer.put(data, 0, length);
+        sampleBuffer.flip();
+
+        // Access units arriving in the same chunk share their arrival time, timestamps must still increase.
+        long presentationTimeUs = Math.max(TimeUnit.NANOSECONDS.toMicros(arrivalTimeNs - firstArrivalTimeNs), lastPresentationTimeUs + 1);
+        lastPresentationTimeUs = presentationTimeUs;
+        sampleInfo.set(0, length, presentationTimeUs, keyFrame ? MediaCodec.BUFFER_FLAG_KEY_FRAME : 0);
+        try {
+            muxer.writeSampleData(track, sampleBuffer, sampleInfo);
+            writtenFrames++;
+        } catch (IllegalStateException | IllegalArgumentException e) {
+            Log.e(TAG, "DVR - write failed, stopping: " + e.getMessage());
+            recording = false;
+        }
+    }
+
+    private boolean startMuxer(byte[] data, int length) {
+        H264ParameterSets parameterSets = H264ParameterSets.extract(data, length);
+        if (parameterSets == null) return false;
+        if (!directory.exists() && !directory.mkdirs()) {
+            Log.e(TAG, "DVR - unable to create " + directory);
+            recording = false;
+            return false;
+        }
+        file = new File(directory, "DVR_" + new SimpleDateFormat("yyyyMMdd_HHmmss", Locale.US).format(new Date()) + ".mp4");
+        try {
+            muxer = new MediaMuxer(file.getPath(), MediaMuxer.OutputFormat.MUXER_OUTPUT_MPEG_4);
+            track = muxer.addTrack(parameterSets.createVideoFormat());
+            muxer.start();
+            Log.d(TAG, "DVR - recording to " + file);
+            return true;
+        } catch (IOException | IllegalStateException | IllegalArgumentException e) {
+            Log.e(TAG, "DVR - unable to start recording: " + e.getMessage());
+            releaseMuxer();
+            recording = false;
+            return false;
+        }
+    }
+
+    private void releaseMuxer() {
+        if (muxer == null) return;
+        try {
+            if (writtenFrames > 0) {
+                muxer.stop();
+            }
+        } catch (IllegalStateException e) {
+            Log.e(TAG, "DVR - unable to finalize " + file + ": " + e.getMessage());
+        } finally {
+            muxer.release();
+            muxer = null;
+        }
+        if (writtenFrames == 0 && file != null) {
+            file.delete();
+        }
+        Log.d(TAG, "DVR - stopped, " + writtenFrames + " frames written, " + getDroppedBytes() + " bytes dropped");
+    }
+}
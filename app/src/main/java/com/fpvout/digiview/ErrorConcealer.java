@@ -0,0 +1,94 @@
+package com.fpvout.digiview;
+
+import android.util.Log;
+
+import java.util.concurrent.TimeUnit;
+
+import usb.PipelineStats;
+
+/**
+ * Keeps the last good picture on screen after data was lost, rather than the smear of pictures decoded against broken
+ * references for the rest of the GOP.
+ *
+ * From the first access unit the {@link LossDetector} finds damaged, or missing its reference pictures, nothing is
+ * decoded until one the decoder can restart from: an IDR or intra picture, or a recovery point. Nothing new reaches
+ * the surface meanwhile, so it keeps showing the last decoded picture. A recovery point may ask for a few more
+ * pictures before the decoded ones are correct again, concealment is still reported during those.
+ *
+ * A stream without recovery points would stay frozen, decoding resumes anyway after a second: a smeared live picture
+ * is better than a frozen one for long.
+ */
+public final class ErrorConcealer {
+    private static final String TAG = "DIGIVIEW";
+    private static final long MAX_CONCEALMENT_NS = TimeUnit.SECONDS.toNanos(1);
+
+    public interface Listener {
+        /**
+         * Called on the thread passing the access units when a loss starts being concealed, and once the decoded
+         * pictures are correct again.
+         */
+        void onConcealmentChanged(boolean concealing);
+    }
+
+    private final LossDetector lossDetector = new LossDetector(null);
+    private final Listener listener;
+    private boolean concealing;
+    private boolean reported;
+    private long concealmentStartNs;
+    private int concealedFrames;
+    private int recoveryFramesLeft;
+
+    public ErrorConcealer(Listener listener) {
+        this.listener = listener;
+    }
+
+    /**
+     * Checks the next access unit, in stream order.
+     *
+     * @return Whether to decode it.
+     */
+    public boolean onAccessUnit(byte[] data, int length, long arrivalTimeNs) {
+        boolean loss = lossDetector.analyze(data, length);
+        boolean decode;
+        if (concealing) {
+            decode = lossDetector.isRecoveryPoint() || arrivalTimeNs - concealmentStartNs >= MAX_CONCEALMENT_NS;
+            if (decode) {
+                concealing = false;
+                recoveryFramesLeft = lossDetector.isRecoveryPoint() ? lossDetector.getRecoveryFrameCount() : 0;
+                Log.d(TAG, "CONCEALMENT - " + (lossDetector.isRecoveryPoint() ? "resynced" : "gave up") + " after " + concealedFrames + " frames");
+            }
+        } else if (loss && !lossDetector.isRecoveryPoint()) {
+            concealing = true;
+            concealmentStartNs = arrivalTimeNs;
+            concealedFrames = 0;
+            recoveryFramesLeft = 0;
+            PipelineStats.getInstance().onConcealment();
+            decode = false;
+        } else {
+            if (recoveryFramesLeft > 0) recoveryFramesLeft--;
+            decode = true;
+        }
+        if (!decode) {
+            concealedFrames++;
+            PipelineStats.getInstance().onFrameConcealed();
+        }
+        report(concealing || recoveryFramesLeft > 0);
+        return decode;
+    }
+
+    /**
+     * Forgets the stream so far, e.g. when the decoder restarts.
+     */
+    public void reset() {
+        lossDetector.reset();
+        concealing = false;
+        recoveryFramesLeft = 0;
+        report(false);
+    }
+
+    private void report(boolean concealment) {
+        if (concealment == reported) return;
+        reported = concealment;
+        listener.onConcealmentChanged(concealment);
+    }
+}
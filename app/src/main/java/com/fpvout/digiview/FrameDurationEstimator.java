@@ -0,0 +1,54 @@
+package com.fpvout.digiview;
+
+/**
+ * Estimates the frame duration of a live stream from the arrival rate of its access units.
+ *
+ * Access units are counted over windows of {@link #WINDOW_NS}, so several frames received in the same USB transfer
+ * don't skew the estimate; successive windows are smoothed with an exponential moving average.
+ */
+public final class FrameDurationEstimator {
+    public static final long DEFAULT_FRAME_DURATION_US = 16666; // 60fps, until measured
+    private static final long WINDOW_NS = 500_000_000L;
+    private static final long MIN_FRAME_DURATION_US = 4166; // 240fps
+    private static final long MAX_FRAME_DURATION_US = 41666; // 24fps
+
+    private final long initialFrameDurationUs;
+    private long frameDurationUs;
+    private long windowStartNs = -1;
+    private int windowFrames;
+
+    public FrameDurationEstimator() {
+        this(DEFAULT_FRAME_DURATION_US);
+    }
+
+    public FrameDurationEstimator(long initialFrameDurationUs) {
+        this.initialFrameDurationUs = initialFrameDurationUs;
+        this.frameDurationUs = initialFrameDurationUs;
+    }
+
+    public void onAccessUnit(long arrivalTimeNs) {
+        if (windowStartNs < 0) {
+            windowStartNs = arrivalTimeNs;
+            windowFrames = 0;
+            return;
+        }
+        windowFrames++;
+        long elapsedNs = arrivalTimeNs - windowStartNs;
+        if (elapsedNs >= WINDOW_NS) {
+            long measuredUs = Math.max(MIN_FRAME_DURATION_US, Math.min(MAX_FRAME_DURATION_US, elapsedNs / 1000 / windowFrames));
+            frameDurationUs = (frameDurationUs * 3 + measuredUs) / 4;
+            windowStartNs = arrivalTimeNs;
+            windowFrames = 0;
+        }
+    }
+
+    public long getFrameDurationUs() {
+        return frameDurationUs;
+    }
+
+    public void reset() {
+        frameDurationUs = initialFrameDurationUs;
+        windowStartNs = -1;
+        windowFrames = 0;
+    }
+}
@@ -16,22 +16,48 @@ import com.google.android.exoplayer2.extractor.ts.SeiReader;
 import java.io.IOException;
 import java.util.ArrayList;
 
+import usb.ByteArrayPool;
+import usb.PipelineStats;
+
 import static com.google.android.exoplayer2.extractor.ts.TsPayloadReader.FLAG_DATA_ALIGNMENT_INDICATOR;
 /**
  * Extracts data from H264 bitstreams.
+ *
+ * The reader is primed with the parameter sets last seen from the device, and intra frames count as key frames, so
+ * decoding can start mid-GOP without waiting for the goggles' next parameter sets and IDR frame.
+ *
+ * With error concealment, access units are reassembled before reaching the reader and those an {@link ErrorConcealer}
+ * holds back after a loss are dropped. Each sample then waits for the next access unit to be complete, a frame later
+ * than in access unit mode.
  */
 public final class H264Extractor implements Extractor {
     /** Factory for {@link H264Extractor} instances. */
     public static final ExtractorsFactory FACTORY = () -> new Extractor[] {new H264Extractor()};
 
     private static int MAX_SYNC_FRAME_SIZE = 131072;
+    // Ends the primed PPS NAL unit.
+    private static final byte[] ACCESS_UNIT_DELIMITER = {0, 0, 1, 9, (byte) 0xF0};
 
     private long firstSampleTimestampUs;
-    private static long sampleTime = 10000; // todo: try to lower this. it directly infer on speed and latency. this should be equal to 16666 to reach 60fps but works better with lower value
+    // Timestamp step per read when not in access unit mode, a consumption pace rather than a frame duration: lower
+    // values make the player drain its buffer faster. Access unit mode timestamps follow the measured frame rate.
+    private static volatile long sampleTime = 10000;
     private final H264Reader reader;
     private final ParsableByteArray sampleData;
 
     private boolean startedPacket;
+    private boolean parameterSetsSeen;
+
+    // Access unit mode: one sample per access unit, timestamped at the observed frame rate.
+    private final boolean accessUnitMode;
+    private final NalUnitScanner nalUnitScanner = new NalUnitScanner();
+    private final FrameDurationEstimator frameDurationEstimator;
+    private final ParsableByteArray pendingSliceData = new ParsableByteArray();
+
+    // Error concealment: whole access units are checked before reaching the reader, one sample each.
+    private final ErrorConcealer errorConcealer;
+    private final AccessUnitAssembler accessUnitAssembler;
+    private final ParsableByteArray accessUnitData = new ParsableByteArray();
 
     public H264Extractor() {
         this(0);
@@ -41,16 +67,48 @@ public final class H264Extractor implements Extractor {
         this(0, mMaxSyncFrameSize, mSampleTime);
     }
 
+    public H264Extractor(int mMaxSyncFrameSize, int mSampleTime, boolean mAccessUnitMode) {
+        this(0, mMaxSyncFrameSize, mSampleTime, mAccessUnitMode);
+    }
+
     public H264Extractor(long firstSampleTimestampUs) {
         this(firstSampleTimestampUs, MAX_SYNC_FRAME_SIZE, (int) sampleTime);
     }
 
     public H264Extractor(long firstSampleTimestampUs, int mMaxSyncFrameSize, int mSampleTime) {
+        this(firstSampleTimestampUs, mMaxSyncFrameSize, mSampleTime, false);
+    }
+
+    public H264Extractor(long firstSampleTimestampUs, int mMaxSyncFrameSize, int mSampleTime, boolean mAccessUnitMode) {
+        this(firstSampleTimestampUs, mMaxSyncFrameSize, mSampleTime, mAccessUnitMode, null);
+    }
+
+    /**
+     * @param concealmentListener Told when a loss is concealed, see {@link ErrorConcealer}, or null to pass everything
+     *                            to the reader. Concealment implies access unit mode.
+     */
+    public H264Extractor(long firstSampleTimestampUs, int mMaxSyncFrameSize, int mSampleTime, boolean mAccessUnitMode, ErrorConcealer.Listener concealmentListener) {
+        accessUnitMode = mAccessUnitMode;
+        frameDurationEstimator = new FrameDurationEstimator();
         MAX_SYNC_FRAME_SIZE = mMaxSyncFrameSize;
         sampleTime = mSampleTime;
         this.firstSampleTimestampUs = firstSampleTimestampUs;
-        reader = new H264Reader(new SeiReader(new ArrayList<Format>()),false,true);
-        sampleData = new ParsableByteArray(MAX_SYNC_FRAME_SIZE);
+        reader = new H264Reader(new SeiReader(new ArrayList<Format>()),true,true);
+        sampleData = new ParsableByteArray(ByteArrayPool.getInstance().acquire(MAX_SYNC_FRAME_SIZE));
+        if (concealmentListener != null) {
+            errorConcealer = new ErrorConcealer(concealmentListener);
+            accessUnitAssembler = new AccessUnitAssembler(MAX_SYNC_FRAME_SIZE, this::consumeAccessUnit);
+        } else {
+            errorConcealer = null;
+            accessUnitAssembler = null;
+        }
+    }
+
+    /**
+     * Changes the timestamp step between two reads while extracting, used by {@link AdaptiveLatencyController}.
+     */
+    public static void setSampleTime(long mSampleTime) {
+        sampleTime = mSampleTime;
     }
 
     // Extractor implementation.
@@ -69,12 +127,22 @@ public final class H264Extractor implements Extractor {
     @Override
     public void seek(long position, long timeUs) {
         startedPacket = false;
+        nalUnitScanner.reset();
+        frameDurationEstimator.reset();
+        if (errorConcealer != null) {
+            accessUnitAssembler.reset();
+            errorConcealer.reset();
+        }
         reader.seek();
     }
 
     @Override
     public void release() {
-        // Do nothing.
+        ByteArrayPool.getInstance().release(sampleData.getData());
+        sampleData.reset(new byte[0]);
+        if (accessUnitAssembler != null) {
+            accessUnitAssembler.release();
+        }
     }
 
     @Override
@@ -84,18 +152,141 @@ public final class H264Extractor implements Extractor {
             return RESULT_END_OF_INPUT;
         }
 
+        PerformanceHints.startWork();
+        if (!parameterSetsSeen) {
+            H264ParameterSets found = H264ParameterSets.extract(sampleData.getData(), bytesRead);
+            if (found != null) {
+                parameterSetsSeen = true;
+                ParameterSetCache.put(found);
+            }
+        }
+        if (errorConcealer != null) {
+            if (!startedPacket) {
+                startFirstPacket();
+            }
+            accessUnitAssembler.consume(sampleData.getData(), 0, bytesRead);
+            PerformanceHints.stopWork();
+            return RESULT_CONTINUE;
+        }
+        if (accessUnitMode) {
+            consumeAccessUnits(bytesRead);
+            PerformanceHints.stopWork();
+            return RESULT_CONTINUE;
+        }
+
         // Feed whatever data we have to the reader, regardless of whether the read finished or not.
         sampleData.setPosition(0);
         sampleData.setLimit(bytesRead);
         if (!startedPacket) {
             // Pass data to the reader as though it's contained within a single infinitely long packet.
-            reader.packetStarted(firstSampleTimestampUs, FLAG_DATA_ALIGNMENT_INDICATOR);
-            startedPacket = true;
+            startFirstPacket();
         }
         firstSampleTimestampUs+=sampleTime;
+        PipelineStats.getInstance().markFrameArrival(firstSampleTimestampUs, System.nanoTime());
         reader.packetStarted(firstSampleTimestampUs, FLAG_DATA_ALIGNMENT_INDICATOR);
         reader.consume(sampleData);
+        // Each read is a sample here.
+        PerformanceHints.endFrame();
+        PerformanceHints.stopWork();
         return RESULT_CONTINUE;
     }
 
-}
\ No newline at end of file
+    /**
+     * Feeds the reader splitting the data at access unit boundaries, so that each access unit starts a new packet
+     * carrying its own timestamp.
+     */
+    private void consumeAccessUnits(int bytesRead) {
+        byte[] data = sampleData.getData();
+        if (!startedPacket) {
+            startFirstPacket();
+        }
+
+        long arrivalTimeNs = System.nanoTime();
+        if (nalUnitScanner.isSlicePending() && bytesRead > 0) {
+            // A slice header ended the previous read, held back until its picture was known.
+            byte[] pendingSlice = nalUnitScanner.takePendingSlice(data[0]);
+            if (nalUnitScanner.isAccessUnitStart(pendingSlice, 0, pendingSlice.length)) {
+                startAccessUnit(arrivalTimeNs);
+            }
+            pendingSliceData.reset(pendingSlice, 1);
+            reader.consume(pendingSliceData);
+        }
+        int consumed = 0;
+        int header = nalUnitScanner.findNalUnit(data, 0, bytesRead);
+        while (header != -1) {
+            if (nalUnitScanner.deferSlice(data, header, bytesRead)) {
+                // The reader attributes a NAL unit to the packet in which its header byte is consumed.
+                consume(consumed, header);
+                consumed = bytesRead;
+                header = nalUnitScanner.findNalUnit(data, header + 1, bytesRead);
+                continue;
+            }
+            if (nalUnitScanner.isAccessUnitStart(data, header, bytesRead)) {
+                int accessUnitStart = Math.max(consumed, header - 3);
+                consume(consumed, accessUnitStart);
+                consumed = accessUnitStart;
+                startAccessUnit(arrivalTimeNs);
+            }
+            header = nalUnitScanner.findNalUnit(data, header + 1, bytesRead);
+        }
+        consume(consumed, bytesRead);
+    }
+
+    /**
+     * Starts a packet for the next access unit, the previous one being complete.
+     */
+    private void startAccessUnit(long arrivalTimeNs) {
+        // The reader outputs the previous access unit as a sample.
+        PipelineStats.getInstance().onSampleExtracted(firstSampleTimestampUs);
+        PerformanceHints.endFrame();
+
+        frameDurationEstimator.onAccessUnit(arrivalTimeNs);
+        firstSampleTimestampUs += frameDurationEstimator.getFrameDurationUs();
+        PipelineStats.getInstance().markFrameArrival(firstSampleTimestampUs, arrivalTimeNs);
+        reader.packetStarted(firstSampleTimestampUs, FLAG_DATA_ALIGNMENT_INDICATOR);
+    }
+
+    /**
+     * Feeds the reader a complete access unit unless it is concealed. Timestamps only advance for the access units fed,
+     * the player waits meanwhile rather than seeing the next ones late.
+     */
+    private void consumeAccessUnit(byte[] data, int length, boolean keyFrame, long arrivalTimeNs) {
+        if (!errorConcealer.onAccessUnit(data, length, arrivalTimeNs)) {
+            return;
+        }
+        // The reader outputs the previous access unit as a sample when this one starts.
+        PipelineStats.getInstance().onSampleExtracted(firstSampleTimestampUs);
+        PerformanceHints.endFrame();
+
+        frameDurationEstimator.onAccessUnit(arrivalTimeNs);
+        firstSampleTimestampUs += frameDurationEstimator.getFrameDurationUs();
+        PipelineStats.getInstance().markFrameArrival(firstSampleTimestampUs, arrivalTimeNs);
+        reader.packetStarted(firstSampleTimestampUs, FLAG_DATA_ALIGNMENT_INDICATOR);
+        accessUnitData.reset(data, length);
+        reader.consume(accessUnitData);
+    }
+
+    private void startFirstPacket() {
+        reader.packetStarted(firstSampleTimestampUs, FLAG_DATA_ALIGNMENT_INDICATOR);
+        startedPacket = true;
+        H264ParameterSets cached = parameterSetsSeen ? null : ParameterSetCache.get();
+        if (cached != null) {
+            // The reader outputs the video format, and the decoder gets configured, before the stream repeats them.
+            byte[] priming = new byte[cached.sps.length + cached.pps.length + ACCESS_UNIT_DELIMITER.length];
+            System.arraycopy(cached.sps, 0, priming, 0, cached.sps.length);
+            System.arraycopy(cached.pps, 0, priming, cached.sps.length, cached.pps.length);
+            System.arraycopy(ACCESS_UNIT_DELIMITER, 0, priming, cached.sps.length + cached.pps.length, ACCESS_UNIT_DELIMITER.length);
+            reader.consume(new ParsableByteArray(priming));
+        }
+    }
+
+    private void consume(int from, int to) {
+        if (to <= from) {
+            return;
+        }
+        sampleData.setLimit(to);
+        sampleData.setPosition(from);
+        reader.consume(sampleData);
+    }
+
+}
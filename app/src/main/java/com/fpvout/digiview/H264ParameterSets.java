@@ -0,0 +1,88 @@
+package com.fpvout.digiview;
+
+import android.media.MediaFormat;
+
+import com.google.android.exoplayer2.util.MimeTypes;
+import com.google.android.exoplayer2.util.NalUnitUtil;
+
+import java.nio.ByteBuffer;
+import java.util.Arrays;
+
+/**
+ * SPS and PPS of an H264 stream, start codes included, as found in a key frame access unit.
+ */
+public final class H264ParameterSets {
+    public final byte[] sps;
+    public final byte[] pps;
+    public final int width;
+    public final int height;
+
+    private H264ParameterSets(byte[] sps, byte[] pps, int width, int height) {
+        this.sps = sps;
+        this.pps = pps;
+        this.width = width;
+        this.height = height;
+    }
+
+    /**
+     * Returns the parameter sets of the given Annex B data, e.g. an access unit, or null if it doesn't carry both.
+     * Only NAL units followed by another one are considered, as the last one may be cut.
+     */
+    public static H264ParameterSets extract(byte[] data, int length) {
+        byte[] sps = null;
+        byte[] pps = null;
+        NalUnitUtil.SpsData spsData = null;
+        NalUnitScanner scanner = new NalUnitScanner();
+        int header = scanner.findNalUnit(data, 0, length);
+        while (header != -1) {
+            int next = scanner.findNalUnit(data, header + 1, length);
+            if (next == -1) break;
+            int end = next - 3;
+            int type = NalUnitScanner.getNalUnitType(data[header]);
+            if (type == NalUnitScanner.NAL_UNIT_TYPE_SPS) {
+                sps = withStartCode(data, header, end);
+                spsData = NalUnitUtil.parseSpsNalUnit(sps, 3, sps.length);
+            } else if (type == NalUnitScanner.NAL_UNIT_TYPE_PPS) {
+                pps = withStartCode(data, header, end);
+            }
+            header = next;
+        }
+        if (sps == null || pps == null) return null;
+        return new H264ParameterSets(sps, pps, spsData.width, spsData.height);
+    }
+
+    /**
+     * Returns the parameter sets made of the given SPS and PPS NAL units, start codes included, or null if the SPS
+     * can't be parsed.
+     */
+    public static H264ParameterSets fromNalUnits(byte[] sps, byte[] pps) {
+        if (sps.length < 4 || pps.length < 4) return null;
+        try {
+            NalUnitUtil.SpsData spsData = NalUnitUtil.parseSpsNalUnit(sps, 3, sps.length);
+            return new H264ParameterSets(sps, pps, spsData.width, spsData.height);
+        } catch (RuntimeException e) {
+            return null;
+        }
+    }
+
+    public boolean sameAs(H264ParameterSets other) {
+        return other != null && Arrays.equals(sps, other.sps) && Arrays.equals(pps, other.pps);
+    }
+
+    /**
+     * Returns a video format carrying the parameter sets as codec specific data.
+     */
+    public MediaFormat createVideoFormat() {
+        MediaFormat format = MediaFormat.createVideoFormat(MimeTypes.VIDEO_H264, width, height);
+        format.setByteBuffer("csd-0", ByteBuffer.wrap(sps));
+        format.setByteBuffer("csd-1", ByteBuffer.wrap(pps));
+        return format;
+    }
+
+    private static byte[] withStartCode(byte[] data, int header, int end) {
+        byte[] nalUnit = new byte[end - header + 3];
+        nalUnit[2] = 1;
+        System.arraycopy(data, header, nalUnit, 3, end - header);
+        return nalUnit;
+    }
+}
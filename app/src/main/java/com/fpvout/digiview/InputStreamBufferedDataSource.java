@@ -1,7 +1,9 @@
 package com.fpvout.digiview;
 
+import android.content.ComponentCallbacks2;
 import android.content.Context;
 import android.net.Uri;
+import android.util.Log;
 
 import com.google.android.exoplayer2.C;
 import com.google.android.exoplayer2.upstream.DataSource;
@@ -11,29 +13,71 @@ import com.google.android.exoplayer2.upstream.TransferListener;
 import java.io.EOFException;
 import java.io.IOException;
 import java.io.InputStream;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.locks.LockSupport;
 
+import usb.ByteArrayPool;
 import usb.CircularByteBuffer;
+import usb.PipelineStats;
 
 public class InputStreamBufferedDataSource implements DataSource {
-    private static final int READ_BUFFER_SIZE = 50 * 1024 * 1024;
+    private static final String TAG = "DIGIVIEW";
+    // The ring holds the given latency of stream at the bitrate measured by the BitstreamAnalyzer, twice that for the
+    // peaks around key frames, or at about the goggles' top bitrate until measured.
+    private static final int DEFAULT_BUFFER_LATENCY_MS = 200;
+    private static final long DEFAULT_BITRATE = 50_000_000;
+    private static final int BITRATE_HEADROOM = 2;
+    private static final int MIN_BUFFER_TRANSFERS = 4;
+    private static final int MAX_BUFFER_SIZE = 16 * 1024 * 1024;
     private static final String ERROR_THREAD_NOT_INITIALIZED = "Read thread not initialized, call first 'startReadThread()'";
-    private static final long READ_TIMEOUT = 200;
+    private static final int DEFAULT_TRANSFER_SIZE = 16384;
+    private static final int ENQUEUE_MARK_COUNT = 256;
+    private static final long READ_TIMEOUT_NS = TimeUnit.MILLISECONDS.toNanos(200);
+    // Set when the system ran low on memory while in the foreground, rings are halved until the UI is next hidden.
+    private static volatile boolean memoryLow;
 
     private Context context;
     private DataSpec dataSpec;
     private InputStream inputStream;
     private long bytesRemaining;
     private boolean opened;
+    private final int transferSize;
+    private final int bufferSize;
+    private final CatchUpPolicy catchUpPolicy;
 
     private CircularByteBuffer readBuffer;
     private Thread receiveThread;
-    private boolean working;
+    private volatile boolean working;
+    private volatile Thread waitingThread;
+
+    private long waitTimeNs;
+    private long copyTimeNs;
+
+    // Enqueue times of the latest writes, to measure how long bytes stay in the ring.
+    private final long[] enqueueMarkPositions = new long[ENQUEUE_MARK_COUNT];
+    private final long[] enqueueMarkTimesNs = new long[ENQUEUE_MARK_COUNT];
+    private volatile long enqueueMarkCount;
+    private long enqueuedBytes;
+    private long dequeuedBytes;
+    private long dequeueMarkIndex;
 
 
     public InputStreamBufferedDataSource(Context context, DataSpec dataSpec, InputStream inputStream) {
+        this(context, dataSpec, inputStream, DEFAULT_TRANSFER_SIZE, 0, DEFAULT_BUFFER_LATENCY_MS);
+    }
+
+    /**
+     * @param catchUpThresholdBytes Backlog past which stale frames are discarded, see {@link CatchUpPolicy}. 0 to
+     *                              never discard.
+     * @param bufferLatencyMs       Stream the ring holds, see {@link #getBufferSize(int, int, int)}.
+     */
+    public InputStreamBufferedDataSource(Context context, DataSpec dataSpec, InputStream inputStream, int transferSize, int catchUpThresholdBytes, int bufferLatencyMs) {
         this.context = context;
         this.dataSpec = dataSpec;
         this.inputStream = inputStream;
+        this.transferSize = transferSize;
+        this.bufferSize = getBufferSize(transferSize, catchUpThresholdBytes, bufferLatencyMs);
+        this.catchUpPolicy = catchUpThresholdBytes > 0 ? new CatchUpPolicy(catchUpThresholdBytes) : null;
         startReadThread();
     }
 
@@ -44,6 +88,8 @@ public class InputStreamBufferedDataSource implements DataSource {
 
     @Override
     public long open(DataSpec dataSpec) throws IOException {
+        // Called on the ExoPlayer loader thread, which parses what the receive thread buffers.
+        PipelineThreads.setCurrentThreadPriority(PipelineThreads.PARSE_PRIORITY);
         try {
             long skipped = inputStream.skip(dataSpec.position);
             if (skipped < dataSpec.position)
@@ -67,36 +113,164 @@ public class InputStreamBufferedDataSource implements DataSource {
         if (readBuffer == null)
             throw new IOException(ERROR_THREAD_NOT_INITIALIZED);
 
-        long deadLine = System.currentTimeMillis() + READ_TIMEOUT;
-        int readBytes = 0;
-        while (System.currentTimeMillis() < deadLine && readBytes <= 0)
-            readBytes = readBuffer.read(buffer, offset, readLength);
-        if (readBytes <= 0)
-            return readBytes;
+        long startTime = System.nanoTime();
+        if (readBuffer.availableToRead() == 0)
+            awaitData(startTime + READ_TIMEOUT_NS, 0);
+
+        if (catchUpPolicy != null) {
+            dequeuedBytes += catchUpPolicy.catchUp(readBuffer);
+            readLength = catchUpPolicy.limitReadLength(readLength);
+            if (readLength == 0) {
+                // Discarding until a key frame arrives, wait for more data instead of spinning.
+                awaitData(startTime + READ_TIMEOUT_NS, readBuffer.availableToRead());
+                waitTimeNs += System.nanoTime() - startTime;
+                return 0;
+            }
+        }
+        long copyStartTime = System.nanoTime();
+        waitTimeNs += copyStartTime - startTime;
+
+        int readBytes = readBuffer.read(buffer, offset, readLength);
+        long endTime = System.nanoTime();
+        copyTimeNs += endTime - copyStartTime;
+        if (readBytes > 0) {
+            recordDequeue(endTime);
+            dequeuedBytes += readBytes;
+            if (catchUpPolicy != null)
+                catchUpPolicy.onRead(readBytes);
+        }
         return readBytes;
     }
 
+    private void recordEnqueue(int bytes) {
+        enqueuedBytes += bytes;
+        long count = enqueueMarkCount;
+        int index = (int) (count % ENQUEUE_MARK_COUNT);
+        enqueueMarkPositions[index] = enqueuedBytes;
+        enqueueMarkTimesNs[index] = System.nanoTime();
+        enqueueMarkCount = count + 1;
+        PipelineStats.getInstance().setBufferOccupancy(readBuffer.availableToRead(), readBuffer.getCapacity());
+    }
+
+    private void recordDequeue(long nowNs) {
+        long count = enqueueMarkCount;
+        if (count - dequeueMarkIndex > ENQUEUE_MARK_COUNT)
+            dequeueMarkIndex = count - ENQUEUE_MARK_COUNT;
+        // Find the write that enqueued the first byte just read.
+        while (dequeueMarkIndex < count && enqueueMarkPositions[(int) (dequeueMarkIndex % ENQUEUE_MARK_COUNT)] <= dequeuedBytes)
+            dequeueMarkIndex++;
+        if (dequeueMarkIndex < count)
+            PipelineStats.getInstance().onRingBufferDequeue(nowNs - enqueueMarkTimesNs[(int) (dequeueMarkIndex % ENQUEUE_MARK_COUNT)]);
+    }
+
+    /**
+     * Parks the loader thread until more than {@code availableBytes} are buffered or the deadline is reached.
+     */
+    private void awaitData(long deadLineNs, int availableBytes) {
+        waitingThread = Thread.currentThread();
+        try {
+            long remainingNs;
+            while (readBuffer.availableToRead() <= availableBytes && working && (remainingNs = deadLineNs - System.nanoTime()) > 0) {
+                LockSupport.parkNanos(this, remainingNs);
+            }
+        } finally {
+            waitingThread = null;
+        }
+    }
+
+    private void signalData() {
+        Thread thread = waitingThread;
+        if (thread != null)
+            LockSupport.unpark(thread);
+    }
+
+    /**
+     * @return Total time spent by the loader thread waiting for data, in nanoseconds.
+     */
+    public long getWaitTimeNs() {
+        return waitTimeNs;
+    }
+
+    /**
+     * @return Total time spent by the loader thread copying data out of the buffer, in nanoseconds.
+     */
+    public long getCopyTimeNs() {
+        return copyTimeNs;
+    }
+
+    /**
+     * @return Number of frames discarded by the catch-up policy.
+     */
+    public long getSkippedFrames() {
+        return catchUpPolicy != null ? catchUpPolicy.getSkippedFrames() : 0;
+    }
+
+    /**
+     * Returns the size of the ring holding {@code latencyMs} of stream, rounded up to a power of two when acquired. It
+     * always fits a few transfers and twice the catch-up threshold, and is halved while memory is low.
+     */
+    static int getBufferSize(int transferSize, int catchUpThresholdBytes, int latencyMs) {
+        long bitrate = PipelineStats.getInstance().getBitstreamBitrate();
+        if (bitrate <= 0) bitrate = DEFAULT_BITRATE;
+        long size = bitrate * BITRATE_HEADROOM * latencyMs / 8000;
+        if (memoryLow) size /= 2;
+        size = Math.max(size, Math.max((long) MIN_BUFFER_TRANSFERS * transferSize, 2L * catchUpThresholdBytes));
+        return (int) Math.min(size, MAX_BUFFER_SIZE);
+    }
+
+    /**
+     * Follows {@link ComponentCallbacks2#onTrimMemory(int)}: pooled rings are dropped once the UI is hidden or memory
+     * runs low, and the next rings halved if it ran low while running. There is no callback once memory recovers: the
+     * rings get their full size again after the UI was hidden, the system reports low memory again if it still is.
+     */
+    public static void onTrimMemory(int level) {
+        if (level == ComponentCallbacks2.TRIM_MEMORY_RUNNING_LOW || level == ComponentCallbacks2.TRIM_MEMORY_RUNNING_CRITICAL) {
+            memoryLow = true;
+        } else if (level == ComponentCallbacks2.TRIM_MEMORY_UI_HIDDEN) {
+            memoryLow = false;
+        }
+        if (level >= ComponentCallbacks2.TRIM_MEMORY_RUNNING_LOW) {
+            ByteArrayPool.getInstance().clear();
+        }
+    }
+
     public void startReadThread(){
         if (!working) {
             working = true;
-            readBuffer = new CircularByteBuffer(READ_BUFFER_SIZE);
-            receiveThread = new Thread() {
-                @Override
-                public void run() {
-                    while (working) {
-                        byte[] buffer = new byte[1024];
-                        int receivedBytes = 0;
-                        try {
-                            receivedBytes = inputStream.read(buffer, 0, buffer.length);
-                        } catch (IOException e) {
-                            e.printStackTrace();
+            // Recycled from the previous data source when the size didn't change, a restart doesn't allocate.
+            readBuffer = new CircularByteBuffer(ByteArrayPool.getInstance().acquire(bufferSize));
+            receiveThread = PipelineThreads.newThread("UsbReceive", PipelineThreads.USB_IO_PRIORITY, () -> {
+                byte[] buffer = ByteArrayPool.getInstance().acquire(transferSize);
+                while (working) {
+                    int receivedBytes = 0;
+                    // Receive straight into the ring when a whole transfer fits, so bytes are copied only once.
+                    boolean inPlace = readBuffer.getWritableLength() >= transferSize;
+                    try {
+                        if (inPlace) {
+                            receivedBytes = inputStream.read(readBuffer.array(), readBuffer.getWritableOffset(), transferSize);
+                        } else {
+                            receivedBytes = inputStream.read(buffer, 0, transferSize);
                         }
-                        if (receivedBytes > 0) {
-                            readBuffer.write(buffer, 0, receivedBytes);
+                    } catch (IOException e) {
+                        e.printStackTrace();
+                    }
+                    if (receivedBytes > 0) {
+                        int writtenBytes;
+                        if (inPlace) {
+                            readBuffer.commitWrite(receivedBytes);
+                            writtenBytes = receivedBytes;
+                        } else {
+                            writtenBytes = readBuffer.write(buffer, 0, receivedBytes);
+                            if (writtenBytes < receivedBytes) PipelineStats.getInstance().onBufferOverrun();
                         }
+                        recordEnqueue(writtenBytes);
+                        signalData();
                     }
                 }
-            };
+                ByteArrayPool.getInstance().release(buffer);
+                // Recycled once the receive thread is done with it, the loader thread doesn't read after close.
+                ByteArrayPool.getInstance().release(readBuffer.array());
+            });
             receiveThread.start();
         }
     }
@@ -108,7 +282,9 @@ public class InputStreamBufferedDataSource implements DataSource {
 
     @Override
     public void close() throws IOException {
+        Log.d(TAG, "buffered source - waited " + TimeUnit.NANOSECONDS.toMillis(waitTimeNs) + "ms, copied " + TimeUnit.NANOSECONDS.toMillis(copyTimeNs) + "ms, skipped " + getSkippedFrames() + " frames, pool allocations: " + ByteArrayPool.getInstance().getAllocationCount());
         working = false;
+        signalData();
         if (receiveThread != null){
             receiveThread.interrupt();
         }
@@ -32,6 +32,8 @@ public class InputStreamDataSource implements DataSource {
 
     @Override
     public long open(DataSpec dataSpec) throws IOException {
+        // Called on the ExoPlayer loader thread, which performs the USB reads itself with this source.
+        PipelineThreads.setCurrentThreadPriority(PipelineThreads.USB_IO_PRIORITY);
         try {
             long skipped = inputStream.skip(dataSpec.position);
             if (skipped < dataSpec.position)
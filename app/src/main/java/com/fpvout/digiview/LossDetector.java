@@ -0,0 +1,226 @@
+package com.fpvout.digiview;
+
+import com.google.android.exoplayer2.util.NalUnitUtil;
+import com.google.android.exoplayer2.util.ParsableNalUnitBitArray;
+
+/**
+ * Finds the signs of data lost before the decoder in complete H264 access units, from NAL unit and slice headers only:
+ * frame_num gaps (lost reference pictures), pictures missing slices, NAL units cut too short for their header or with
+ * the forbidden bit set.
+ *
+ * Also tells the access units the decoder can restart from after a loss: IDR pictures, pictures made of intra slices
+ * only, and pictures carrying a recovery point SEI message.
+ *
+ * Access units must all be passed in stream order, including those not decoded, for frame_num to be followed.
+ */
+public final class LossDetector {
+    private static final int SEI_PAYLOAD_TYPE_RECOVERY_POINT = 6;
+    private static final int SLICE_TYPE_I = 2;
+    private static final int SLICE_TYPE_SI = 4;
+
+    public interface Listener {
+        void onSlice(int sliceType);
+
+        void onCorruptNalUnit();
+
+        void onTruncatedNalUnit(String nalUnit);
+
+        void onLostSlice(int firstMb);
+
+        void onFrameNumGap(int missingFrames);
+    }
+
+    private final Listener listener;
+    private final NalUnitScanner nalUnitScanner = new NalUnitScanner();
+    private final ParsableNalUnitBitArray bits = new ParsableNalUnitBitArray(new byte[0], 0, 0);
+    private NalUnitUtil.SpsData spsData;
+    private boolean pictureStarted;
+    private int previousFirstMb;
+    private boolean havePreviousFrameNum;
+    private int previousReferenceFrameNum;
+
+    // Last access unit: missing or broken data in it, or missing reference pictures before it.
+    private boolean damaged;
+    private boolean referencesLost;
+    private boolean idr;
+    private boolean intraOnly;
+    private boolean sawSlice;
+    private int recoveryFrameCount;
+
+    /**
+     * @param listener Told about each slice and each sign of loss, or null.
+     */
+    public LossDetector(Listener listener) {
+        this.listener = listener;
+    }
+
+    /**
+     * Checks an access unit.
+     *
+     * @return Whether data was lost since the previous access unit or in this one.
+     */
+    public boolean analyze(byte[] data, int length) {
+        damaged = false;
+        referencesLost = false;
+        idr = false;
+        intraOnly = true;
+        sawSlice = false;
+        recoveryFrameCount = -1;
+        pictureStarted = false;
+        nalUnitScanner.reset();
+        int header = nalUnitScanner.findNalUnit(data, 0, length);
+        while (header != -1) {
+            int next = nalUnitScanner.findNalUnit(data, header + 1, length);
+            int end = next == -1 ? length : next - 3;
+            analyzeNalUnit(data, header, end);
+            header = next;
+        }
+        return damaged || referencesLost;
+    }
+
+    /**
+     * Returns whether the decoder can restart from the last access unit, without the pictures before it, which may
+     * well have been lost.
+     */
+    public boolean isRecoveryPoint() {
+        return !damaged && (idr || recoveryFrameCount >= 0 || (sawSlice && intraOnly));
+    }
+
+    /**
+     * Returns the number of pictures after the last access unit before the decoded pictures are correct again, 0 unless
+     * it carries a recovery point SEI message asking for more.
+     */
+    public int getRecoveryFrameCount() {
+        return Math.max(0, recoveryFrameCount);
+    }
+
+    /**
+     * Forgets the previous access units, e.g. after skipping data on purpose.
+     */
+    public void reset() {
+        pictureStarted = false;
+        havePreviousFrameNum = false;
+    }
+
+    private void analyzeNalUnit(byte[] data, int header, int end) {
+        if ((data[header] & 0x80) != 0) {
+            damaged = true;
+            if (listener != null) listener.onCorruptNalUnit();
+            return;
+        }
+        int nalUnitType = NalUnitScanner.getNalUnitType(data[header]);
+        if (nalUnitType == NalUnitScanner.NAL_UNIT_TYPE_SPS) {
+            try {
+                spsData = NalUnitUtil.parseSpsNalUnit(data, header, end);
+            } catch (RuntimeException e) {
+                truncated("SPS");
+            }
+        } else if (nalUnitType == NalUnitScanner.NAL_UNIT_TYPE_SEI) {
+            analyzeSei(data, header, end);
+        } else if (NalUnitScanner.isSlice(nalUnitType)) {
+            analyzeSlice(data, header, end, nalUnitType == NalUnitScanner.NAL_UNIT_TYPE_IDR, (data[header] >> 5) & 3);
+        }
+    }
+
+    /**
+     * Looks for a recovery point among the SEI messages.
+     */
+    private void analyzeSei(byte[] data, int header, int end) {
+        bits.reset(data, header + 1, end);
+        // Each message is at least a type and a size byte, the RBSP trailing bits end the NAL unit.
+        while (bits.canReadBits(16)) {
+            int payloadType = readSeiValue();
+            int payloadSize = readSeiValue();
+            if (payloadType < 0 || payloadSize < 0) return;
+            if (payloadType == SEI_PAYLOAD_TYPE_RECOVERY_POINT) {
+                if (bits.canReadExpGolombCodedNum()) {
+                    recoveryFrameCount = bits.readUnsignedExpGolombCodedInt();
+                }
+                return;
+            }
+            if (!bits.canReadBits(payloadSize * 8)) return;
+            bits.skipBits(payloadSize * 8);
+        }
+    }
+
+    /**
+     * Reads an SEI payload type or size, coded as a run of 0xFF bytes plus a last byte, or returns -1 if cut short.
+     */
+    private int readSeiValue() {
+        int value = 0;
+        while (bits.canReadBits(8)) {
+            int b = bits.readBits(8);
+            value += b;
+            if (b != 0xFF) return value;
+        }
+        return -1;
+    }
+
+    private void analyzeSlice(byte[] data, int header, int end, boolean idrSlice, int nalRefIdc) {
+        sawSlice = true;
+        idr |= idrSlice;
+        bits.reset(data, header + 1, end);
+        if (!bits.canReadExpGolombCodedNum()) {
+            truncated("slice");
+            return;
+        }
+        int firstMb = bits.readUnsignedExpGolombCodedInt();
+        if (!bits.canReadExpGolombCodedNum()) {
+            truncated("slice");
+            return;
+        }
+        int sliceType = bits.readUnsignedExpGolombCodedInt();
+        if (listener != null) listener.onSlice(sliceType);
+        int baseSliceType = sliceType % 5;
+        intraOnly &= baseSliceType == SLICE_TYPE_I || baseSliceType == SLICE_TYPE_SI;
+
+        if (firstMb == 0) {
+            pictureStarted = true;
+        } else if (!pictureStarted || firstMb <= previousFirstMb) {
+            // The first slice of the picture, or the slices in between, never arrived.
+            pictureStarted = true;
+            damaged = true;
+            if (listener != null) listener.onLostSlice(firstMb);
+        }
+        previousFirstMb = firstMb;
+        if (firstMb != 0 || spsData == null) return;
+
+        if (!bits.canReadExpGolombCodedNum()) {
+            truncated("slice");
+            return;
+        }
+        bits.readUnsignedExpGolombCodedInt(); // pic_parameter_set_id
+        if (spsData.separateColorPlaneFlag) {
+            bits.skipBits(2);
+        }
+        if (!bits.canReadBits(spsData.frameNumLength)) {
+            truncated("slice");
+            return;
+        }
+        checkFrameNum(bits.readBits(spsData.frameNumLength), idrSlice, nalRefIdc != 0);
+    }
+
+    /**
+     * A picture's frame_num is the previous reference picture's, or the next one after a reference picture: anything
+     * else means reference pictures were lost.
+     */
+    private void checkFrameNum(int frameNum, boolean idrSlice, boolean reference) {
+        int maxFrameNum = 1 << spsData.frameNumLength;
+        if (!idrSlice && havePreviousFrameNum) {
+            int expected = (previousReferenceFrameNum + 1) % maxFrameNum;
+            if (frameNum != previousReferenceFrameNum && frameNum != expected) {
+                referencesLost = true;
+                if (listener != null) listener.onFrameNumGap((frameNum - expected + maxFrameNum) % maxFrameNum);
+            }
+        }
+        if (idrSlice || reference) {
+            previousReferenceFrameNum = frameNum;
+            havePreviousFrameNum = true;
+        }
+    }
+
+    private void truncated(String nalUnit) {
+        damaged = true;
+        if (listener != null) listener.onTruncatedNalUnit(nalUnit);
+    }
+}
@@ -11,12 +11,12 @@ import android.content.SharedPreferences;
 import android.hardware.usb.UsbDevice;
 import android.hardware.usb.UsbManager;
 import android.os.Bundle;
+import android.os.Environment;
 import android.os.Handler;
 import android.util.Log;
 import android.view.GestureDetector;
 import android.view.MotionEvent;
 import android.view.ScaleGestureDetector;
-import android.view.SurfaceView;
 import android.view.View;
 import android.view.ViewGroup;
 import android.view.WindowManager;
@@ -25,12 +25,14 @@ import androidx.appcompat.app.ActionBar;
 import androidx.appcompat.app.AppCompatActivity;
 import androidx.preference.PreferenceManager;
 
+import java.io.File;
+import java.io.IOException;
 import java.util.HashMap;
 
 import io.sentry.SentryLevel;
 import io.sentry.android.core.SentryAndroid;
 
-import static com.fpvout.digiview.VideoReaderExoplayer.VideoZoomedIn;
+import static com.fpvout.digiview.VideoPipeline.VideoZoomedIn;
 
 public class MainActivity extends AppCompatActivity implements UsbDeviceListener {
     private static final String ACTION_USB_PERMISSION = "com.fpvout.digiview.USB_PERMISSION";
@@ -42,18 +44,33 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
     private View settingsButton;
     private View watermarkView;
     private OverlayView overlayView;
+    private StatsView statsView;
+    private View lossIndicatorView;
     PendingIntent permissionIntent;
     UsbDeviceBroadcastReceiver usbDeviceBroadcastReceiver;
     UsbManager usbManager;
     UsbDevice usbDevice;
     UsbMaskConnection mUsbMaskConnection;
-    VideoReaderExoplayer mVideoReader;
+    VideoPipeline mVideoPipeline;
     boolean usbConnected = false;
-    SurfaceView fpvView;
+    VideoTextureView fpvView;
     private GestureDetector gestureDetector;
     private ScaleGestureDetector scaleGestureDetector;
     private SharedPreferences sharedPreferences;
     private static final String ShowWatermark = "ShowWatermark";
+    private static final String ShowStats = "ShowStats";
+    private static final String RecordDvr = "RecordDvr";
+    private static final String Restream = "Restream";
+    private static final String RestreamTargets = "RestreamTargets";
+    private static final String StereoMode = "StereoMode";
+    private static final String StereoDistortion = "StereoDistortion";
+    static final String EXTRA_REPLAY = "replay";
+    static final String EXTRA_PACED = "paced";
+    private String replayCapture;
+    private PerformanceMode performanceMode;
+    private TelemetryReporter telemetryReporter;
+    // Our settings screen is showing: the device stays open meanwhile and a changed preset is applied in place.
+    private boolean settingsOpen;
 
     @Override
     protected void onCreate(Bundle savedInstanceState) {
@@ -92,12 +109,15 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
         shortAnimationDuration = getResources().getInteger(android.R.integer.config_shortAnimTime);
         watermarkView = findViewById(R.id.watermarkView);
         overlayView = findViewById(R.id.overlayView);
+        statsView = findViewById(R.id.statsView);
+        lossIndicatorView = findViewById(R.id.lossIndicatorView);
         fpvView = findViewById(R.id.fpvView);
 
         settingsButton = findViewById(R.id.settingsButton);
         settingsButton.setOnClickListener(new View.OnClickListener() {
             @Override
             public void onClick(View v) {
+                settingsOpen = true;
                 Intent intent = new Intent(v.getContext(), SettingsActivity.class);
                 v.getContext().startActivity(intent);
             }
@@ -110,20 +130,43 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
 
         setupGestureDetectors();
 
+        PerformanceHints.init(this);
+        ParameterSetCache.init(this);
+        DecoderProbe.probeIfNeeded(this);
+        performanceMode = new PerformanceMode(this);
+
         mUsbMaskConnection = new UsbMaskConnection();
-        Handler videoReaderEventListener = new Handler(this.getMainLooper(), msg -> onVideoReaderEvent((VideoReaderExoplayer.VideoReaderEventMessageCode) msg.obj));
+        Handler videoReaderEventListener = new Handler(this.getMainLooper(), msg -> onVideoReaderEvent((VideoPipeline.VideoReaderEventMessageCode) msg.obj));
+
+        mVideoPipeline = new VideoPipeline(fpvView, this, videoReaderEventListener);
+        telemetryReporter = new TelemetryReporter(this, mVideoPipeline);
+        replayCapture = getIntent().getStringExtra(EXTRA_REPLAY);
 
-        mVideoReader = new VideoReaderExoplayer(fpvView, this, videoReaderEventListener);
+        StartupTimer.mark(StartupTimer.Phase.ACTIVITY_CREATED);
 
         if (!usbConnected) {
-            if (searchDevice()) {
+            if (replayCapture != null) {
+                startReplay();
+            } else if (searchDevice()) {
                 connect();
             } else {
                 showOverlay(R.string.waiting_for_usb_device, OverlayStatus.Disconnected);
+                prewarmPipeline();
             }
         }
     }
 
+    /**
+     * Starts the video pipeline with no device attached yet, so the player and decoder are ready by the time the
+     * goggles are connected and permission is granted.
+     */
+    private void prewarmPipeline() {
+        if (mVideoPipeline.isRunning()) return;
+        mVideoPipeline.setUsbMaskConnection(mUsbMaskConnection);
+        mVideoPipeline.start();
+        StartupTimer.mark(StartupTimer.Phase.PIPELINE_WARM);
+    }
+
     private void setupGestureDetectors() {
         gestureDetector = new GestureDetector(this, new GestureDetector.SimpleOnGestureListener() {
             @Override
@@ -134,19 +177,21 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
 
             @Override
             public boolean onDoubleTap(MotionEvent e) {
-                mVideoReader.toggleZoom();
+                mVideoPipeline.toggleZoom();
                 return super.onDoubleTap(e);
             }
         });
 
         scaleGestureDetector = new ScaleGestureDetector(this, new ScaleGestureDetector.SimpleOnScaleGestureListener() {
+            @Override
+            public boolean onScale(ScaleGestureDetector detector) {
+                mVideoPipeline.scaleBy(detector.getScaleFactor(), detector.getFocusX(), detector.getFocusY());
+                return true;
+            }
+
             @Override
             public void onScaleEnd(ScaleGestureDetector detector) {
-                if (detector.getScaleFactor() < 1) {
-                    mVideoReader.zoomOut();
-                } else {
-                    mVideoReader.zoomIn();
-                }
+                mVideoPipeline.endScale();
             }
         });
     }
@@ -172,11 +217,23 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
         }
     }
 
+    private void updateStats() {
+        if (sharedPreferences.getBoolean(ShowStats, false)) {
+            statsView.show();
+        } else {
+            statsView.hide();
+        }
+    }
+
+    private void updateStereoMode() {
+        fpvView.setStereoMode(sharedPreferences.getBoolean(StereoMode, false), sharedPreferences.getBoolean(StereoDistortion, true));
+    }
+
     private void updateVideoZoom() {
         if (sharedPreferences.getBoolean(VideoZoomedIn, true)) {
-            mVideoReader.zoomIn();
+            mVideoPipeline.zoomIn();
         } else {
-            mVideoReader.zoomOut();
+            mVideoPipeline.zoomOut();
         }
     }
 
@@ -237,6 +294,7 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
     @Override
     public void usbDeviceApproved(UsbDevice device) {
         Log.i(TAG, "USB - usbDevice approved");
+        StartupTimer.mark(StartupTimer.Phase.PERMISSION_GRANTED);
         usbDevice = device;
         showOverlay(R.string.usb_device_approved, OverlayStatus.Connected);
         connect();
@@ -246,7 +304,9 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
     public void usbDeviceDetached() {
         Log.i(TAG, "USB - usbDevice detached");
         showOverlay(R.string.usb_device_detached_waiting, OverlayStatus.Disconnected);
-        this.onStop();
+        // Keep the video pipeline and its decoder: video resumes as soon as the goggles are plugged back in.
+        mUsbMaskConnection.detach();
+        usbConnected = false;
     }
 
     private boolean searchDevice() {
@@ -258,6 +318,7 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
 
         for (UsbDevice device : deviceList.values()) {
             if (device.getVendorId() == VENDOR_ID && device.getProductId() == PRODUCT_ID) {
+                StartupTimer.mark(StartupTimer.Phase.DEVICE_FOUND);
                 if (usbManager.hasPermission(device)) {
                     Log.i(TAG, "USB - usbDevice attached");
                     showOverlay(R.string.usb_device_found, OverlayStatus.Connected);
@@ -273,20 +334,64 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
     }
 
     private void connect() {
+        if (usbConnected) return;
         usbConnected = true;
-        mUsbMaskConnection.setUsbDevice(usbManager.openDevice(usbDevice), usbDevice);
-        mVideoReader.setUsbMaskConnection(mUsbMaskConnection);
+        PerformancePreset performancePreset = PerformancePreset.getPreset(sharedPreferences);
+        if (sharedPreferences.getBoolean(RecordDvr, false)) {
+            mUsbMaskConnection.setDvrRecorder(new DvrRecorder(getExternalFilesDir(Environment.DIRECTORY_MOVIES)));
+        } else {
+            mUsbMaskConnection.setDvrRecorder(null);
+        }
+        if (sharedPreferences.getBoolean(Restream, false)) {
+            mUsbMaskConnection.setRtpStreamer(new RtpStreamer(RtpStreamer.parseTargets(sharedPreferences.getString(RestreamTargets, getString(R.string.restream_targets_default)))));
+        } else {
+            mUsbMaskConnection.setRtpStreamer(null);
+        }
+        ParameterSetCache.setDevice(ParameterSetCache.getDeviceKey(usbDevice));
+        mUsbMaskConnection.setUsbDevice(usbManager.openDevice(usbDevice), usbDevice, performancePreset);
+        StartupTimer.mark(StartupTimer.Phase.CONNECTED);
+        if (mVideoPipeline.isRunning()) {
+            // Pre-warmed, or replugged while the pipeline kept running, the connection asks the goggles to stream.
+            showOverlay(R.string.waiting_for_video, OverlayStatus.Connected);
+            return;
+        }
+        mVideoPipeline.setUsbMaskConnection(mUsbMaskConnection);
         overlayView.hide();
-        mVideoReader.start();
+        mVideoPipeline.start();
         updateWatermark();
         autoHideSettingsButton();
         showOverlay(R.string.waiting_for_video, OverlayStatus.Connected);
     }
 
+    /**
+     * Plays the capture given in the launch intent instead of the goggles.
+     */
+    private void startReplay() {
+        usbConnected = true;
+        ParameterSetCache.setDevice(EXTRA_REPLAY);
+        File capture = new File(replayCapture);
+        boolean paced = getIntent().getBooleanExtra(EXTRA_PACED, true);
+        showOverlay(R.string.waiting_for_video, OverlayStatus.Connected);
+        PerformancePreset performancePreset = PerformancePreset.getPreset(sharedPreferences);
+        try {
+            mUsbMaskConnection.setReplayStream(new ReplayInputStream(capture, performancePreset.usbTransferSize, paced, true, ReplayInputStream.DEFAULT_FRAME_RATE));
+        } catch (IOException e) {
+            Log.e(TAG, "REPLAY - unable to open " + capture + ": " + e.getMessage());
+            usbConnected = false;
+            return;
+        }
+        mVideoPipeline.setUsbMaskConnection(mUsbMaskConnection);
+        mVideoPipeline.start(performancePreset);
+    }
+
     @Override
     public void onResume() {
         super.onResume();
         Log.d(TAG, "APP - On Resume");
+        performanceMode.start();
+        telemetryReporter.start();
+        // Before the pipeline starts, as switching hands the engines a new surface.
+        updateStereoMode();
 
         View decorView = getWindow().getDecorView();
         decorView.setSystemUiVisibility(View.SYSTEM_UI_FLAG_IMMERSIVE_STICKY
@@ -300,28 +405,56 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
             actionBar.hide();
         }
 
+        if (settingsOpen) {
+            settingsOpen = false;
+            if (usbConnected && mUsbMaskConnection.isReady()) {
+                resumeAfterSettings();
+            }
+        }
+
         if (!usbConnected) {
-            if (searchDevice()) {
+            if (replayCapture != null) {
+                startReplay();
+            } else if (searchDevice()) {
                 Log.d(TAG, "APP - On Resume usbDevice device found");
                 connect();
             } else {
                 showOverlay(R.string.waiting_for_usb_device, OverlayStatus.Connected);
+                prewarmPipeline();
             }
         }
 
         settingsButton.setAlpha(1);
         autoHideSettingsButton();
         updateWatermark();
+        updateStats();
         updateVideoZoom();
     }
 
-    private boolean onVideoReaderEvent(VideoReaderExoplayer.VideoReaderEventMessageCode m) {
-        if (VideoReaderExoplayer.VideoReaderEventMessageCode.WAITING_FOR_VIDEO.equals(m)) {
+    /**
+     * Starts the video pipeline again on the connection kept open while the settings were showing, with the preset
+     * chosen there.
+     */
+    private void resumeAfterSettings() {
+        PerformancePreset performancePreset = PerformancePreset.getPreset(sharedPreferences);
+        mUsbMaskConnection.applyPreset(performancePreset);
+        mVideoPipeline.setUsbMaskConnection(mUsbMaskConnection);
+        mVideoPipeline.start(performancePreset);
+        showOverlay(R.string.waiting_for_video, OverlayStatus.Connected);
+    }
+
+    private boolean onVideoReaderEvent(VideoPipeline.VideoReaderEventMessageCode m) {
+        if (VideoPipeline.VideoReaderEventMessageCode.WAITING_FOR_VIDEO.equals(m)) {
             Log.d(TAG, "event: WAITING_FOR_VIDEO");
+            lossIndicatorView.setVisibility(View.GONE);
             showOverlay(R.string.waiting_for_video, OverlayStatus.Connected);
-        } else if (VideoReaderExoplayer.VideoReaderEventMessageCode.VIDEO_PLAYING.equals(m)) {
+        } else if (VideoPipeline.VideoReaderEventMessageCode.VIDEO_PLAYING.equals(m)) {
             Log.d(TAG, "event: VIDEO_PLAYING");
             hideOverlay();
+        } else if (VideoPipeline.VideoReaderEventMessageCode.VIDEO_CONCEALING.equals(m)) {
+            lossIndicatorView.setVisibility(View.VISIBLE);
+        } else if (VideoPipeline.VideoReaderEventMessageCode.VIDEO_RECOVERED.equals(m)) {
+            lossIndicatorView.setVisibility(View.GONE);
         }
         return false; // false to continue listening
     }
@@ -343,20 +476,36 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
     protected void onStop() {
         super.onStop();
         Log.d(TAG, "APP - On Stop");
+        telemetryReporter.stop();
 
+        // The surface goes away with the activity, the engine is started again on return.
+        mVideoPipeline.stop();
+        if (settingsOpen) return;
         mUsbMaskConnection.stop();
-        mVideoReader.stop();
         usbConnected = false;
     }
 
+    @Override
+    public void onTrimMemory(int level) {
+        super.onTrimMemory(level);
+        InputStreamBufferedDataSource.onTrimMemory(level);
+        if (level >= TRIM_MEMORY_UI_HIDDEN && settingsOpen) {
+            // The app was left from the settings screen: release the device, as onStop would have.
+            Log.d(TAG, "APP - UI hidden from the settings, releasing the device");
+            settingsOpen = false;
+            mUsbMaskConnection.stop();
+            usbConnected = false;
+        }
+        mUsbMaskConnection.onTrimMemory(level);
+    }
+
     @Override
     protected void onPause() {
         super.onPause();
         Log.d(TAG, "APP - On Pause");
-
-        mUsbMaskConnection.stop();
-        mVideoReader.stop();
-        usbConnected = false;
+        // The pipeline is torn down in onStop only: a replug brings the activity back through onNewIntent, which
+        // pauses it, and the decoder must survive that.
+        performanceMode.stop();
     }
 
     @Override
@@ -365,7 +514,7 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
         Log.d(TAG, "APP - On Destroy");
 
         mUsbMaskConnection.stop();
-        mVideoReader.stop();
+        mVideoPipeline.stop();
         usbConnected = false;
     }
 
@@ -378,12 +527,7 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
 
         if (requestCode == 1) { // Data Collection agreement Activity
             if (resultCode == RESULT_OK && dataCollectionAccepted) {
-                SentryAndroid.init(this, options -> options.setBeforeSend((event, hint) -> {
-                    if (SentryLevel.DEBUG.equals(event.getLevel()))
-                        return null;
-                    else
-                        return event;
-                }));
+                initSentry();
             }
 
         }
@@ -392,19 +536,31 @@ public class MainActivity extends AppCompatActivity implements UsbDeviceListener
     private void checkDataCollectionAgreement() {
         SharedPreferences preferences = PreferenceManager.getDefaultSharedPreferences(getApplicationContext());
         boolean dataCollectionAccepted = preferences.getBoolean("dataCollectionAccepted", false);
-        boolean dataCollectionReplied = preferences.getBoolean("dataCollectionReplied", false);
+        boolean dataCollectionReplied = preferences.getBoolean("dataCollectionReplied", false)
+                && preferences.getInt(DataCollectionAgreementPopupActivity.ConsentVersion, 1) >= DataCollectionAgreementPopupActivity.CURRENT_CONSENT_VERSION;
         if (!dataCollectionReplied) {
             Intent intent = new Intent(this, DataCollectionAgreementPopupActivity.class);
             startActivityForResult(intent, 1);
         } else if (dataCollectionAccepted) {
-            SentryAndroid.init(this, options -> options.setBeforeSend((event, hint) -> {
+            initSentry();
+        }
+
+    }
+
+    /**
+     * Initializes Sentry off the main thread, it reads its options and cached events from disk.
+     */
+    private void initSentry() {
+        Context context = getApplicationContext();
+        PipelineThreads.newThread("SentryInit", PipelineThreads.BACKGROUND_PRIORITY, () -> {
+            SentryAndroid.init(context, options -> options.setBeforeSend((event, hint) -> {
                 if (SentryLevel.DEBUG.equals(event.getLevel()))
                     return null;
                 else
                     return event;
             }));
-        }
-
+            StartupTimer.mark(StartupTimer.Phase.SENTRY_READY);
+        }).start();
     }
 
 }
\ No newline at end of file
@@ -0,0 +1,185 @@
+package com.fpvout.digiview;
+
+/**
+ * Streaming H264 start code scanner.
+ *
+ * Finds NAL unit headers (the byte right after a {@code 00 00 01} start code) in consecutive chunks of a byte
+ * stream, including start codes split across two chunks. Chunks must be scanned in order, each one from its first byte.
+ *
+ * A slice header ending a chunk doesn't tell yet whether it starts a picture: callers hand it to {@link #deferSlice}
+ * and complete it with the first byte of the next chunk through {@link #takePendingSlice}.
+ */
+public final class NalUnitScanner {
+    public static final int NAL_UNIT_TYPE_NON_IDR = 1;
+    public static final int NAL_UNIT_TYPE_IDR = 5;
+    public static final int NAL_UNIT_TYPE_SEI = 6;
+    public static final int NAL_UNIT_TYPE_SPS = 7;
+    public static final int NAL_UNIT_TYPE_PPS = 8;
+    public static final int NAL_UNIT_TYPE_AUD = 9;
+
+    private boolean chunkStart = true;
+    private boolean sawSliceInAccessUnit;
+    // Number of zero bytes (up to 2) ending the previous chunk, or 3 if it ended with a whole start code.
+    private int carry;
+    // A slice header ending the previous chunk, then the first byte of the next one.
+    private final byte[] pendingSlice = new byte[2];
+    private boolean slicePending;
+
+    /**
+     * Returns the offset of the first {@code 00 00 01} start code in {@code data[from, limit)}, or -1.
+     *
+     * Inspects roughly one byte out of three: when {@code data[i] > 1} no start code can end in {@code i..i+2}.
+     */
+    public static int findStartCode(byte[] data, int from, int limit) {
+        int i = from + 2;
+        while (i < limit) {
+            int b = data[i] & 0xFF;
+            if (b > 1) {
+                i += 3;
+            } else if (b == 0) {
+                i++;
+            } else {
+                if (data[i - 1] == 0 && data[i - 2] == 0) {
+                    return i - 2;
+                }
+                i += 3;
+            }
+        }
+        return -1;
+    }
+
+    public static int getNalUnitType(byte header) {
+        return header & 0x1F;
+    }
+
+    public static boolean isSlice(int nalUnitType) {
+        return nalUnitType == NAL_UNIT_TYPE_NON_IDR || nalUnitType == NAL_UNIT_TYPE_IDR;
+    }
+
+    /**
+     * Returns whether the first slice of a picture, first_mb_in_slice == 0, starts right after the slice header at
+     * {@code data[header]}. Coded as a single '1' bit.
+     */
+    public static boolean isFirstSlice(byte[] data, int header, int limit) {
+        return header + 1 < limit && (data[header + 1] & 0x80) != 0;
+    }
+
+    /**
+     * Returns the offset of the next NAL unit header in {@code data[from, limit)}, or -1 once the chunk is exhausted.
+     * The first call for a chunk must pass its first byte as {@code from}; following calls pass the previous result + 1.
+     */
+    public int findNalUnit(byte[] data, int from, int limit) {
+        int carriedIn = chunkStart ? carry : 0;
+        if (chunkStart) {
+            chunkStart = false;
+            int header = findCarriedNalUnit(data, from, limit);
+            carry = 0;
+            if (header != -1) {
+                return header;
+            }
+        }
+
+        int start = findStartCode(data, from, limit);
+        if (start != -1 && start + 3 < limit) {
+            return start + 3;
+        }
+
+        // End of chunk, remember a trailing partial start code for the next one.
+        chunkStart = true;
+        if (start != -1) {
+            carry = 3;
+        } else {
+            // A chunk shorter than a start code continues the partial one carried into it.
+            carry = limit - from < 3 ? carriedIn : 0;
+            for (int i = Math.max(from, limit - 3); i < limit; i++) {
+                carry = nextCarry(carry, data[i]);
+            }
+        }
+        return -1;
+    }
+
+    private static int nextCarry(int carry, byte b) {
+        if (b == 0) return carry == 1 || carry == 2 ? 2 : 1;
+        return b == 1 && carry == 2 ? 3 : 0;
+    }
+
+    private int findCarriedNalUnit(byte[] data, int from, int limit) {
+        switch (carry) {
+            case 3:
+                return from < limit ? from : -1;
+            case 2:
+                if (from + 1 < limit && data[from] == 1) return from + 1;
+                // fall through: 00 00 | 00 01 is still a start code
+            case 1:
+                if (from + 2 < limit && data[from] == 0 && data[from + 1] == 1) return from + 2;
+                return -1;
+            default:
+                return -1;
+        }
+    }
+
+    /**
+     * Returns whether the NAL unit whose header is at {@code data[header]} starts a new access unit: an AUD, parameter
+     * sets or SEI following a slice, or the first slice of a picture following a slice. Must be called for every NAL
+     * unit found, in stream order.
+     */
+    public boolean isAccessUnitStart(byte[] data, int header, int limit) {
+        int nalUnitType = getNalUnitType(data[header]);
+        if (isSlice(nalUnitType)) {
+            boolean accessUnitStart = sawSliceInAccessUnit && isFirstSlice(data, header, limit);
+            sawSliceInAccessUnit = true;
+            return accessUnitStart;
+        }
+
+        boolean accessUnitStart;
+        switch (nalUnitType) {
+            case NAL_UNIT_TYPE_AUD:
+                accessUnitStart = true;
+                break;
+            case NAL_UNIT_TYPE_SEI:
+            case NAL_UNIT_TYPE_SPS:
+            case NAL_UNIT_TYPE_PPS:
+                accessUnitStart = sawSliceInAccessUnit;
+                break;
+            default:
+                return false;
+        }
+        if (accessUnitStart) {
+            sawSliceInAccessUnit = false;
+        }
+        return accessUnitStart;
+    }
+
+    /**
+     * Keeps the NAL unit header at {@code data[header]} pending if it is a slice header ending the chunk, and returns
+     * whether it did. The caller then handles it in the next chunk, see {@link #takePendingSlice}.
+     */
+    public boolean deferSlice(byte[] data, int header, int limit) {
+        if (header + 1 != limit || !isSlice(getNalUnitType(data[header]))) return false;
+        pendingSlice[0] = data[header];
+        slicePending = true;
+        return true;
+    }
+
+    public boolean isSlicePending() {
+        return slicePending;
+    }
+
+    /**
+     * Completes the pending slice header with {@code nextByte}, the first byte of the next chunk, and returns both as a
+     * NAL unit header at offset 0, to be passed to {@link #isAccessUnitStart} in place of the original. Only valid
+     * until the next slice is deferred.
+     */
+    public byte[] takePendingSlice(byte nextByte) {
+        slicePending = false;
+        pendingSlice[1] = nextByte;
+        return pendingSlice;
+    }
+
+    public void reset() {
+        chunkStart = true;
+        carry = 0;
+        slicePending = false;
+        sawSliceInAccessUnit = false;
+    }
+}
@@ -0,0 +1,88 @@
+package com.fpvout.digiview;
+
+import android.content.Context;
+import android.content.SharedPreferences;
+import android.hardware.usb.UsbDevice;
+import android.util.Base64;
+
+import androidx.preference.PreferenceManager;
+
+import java.util.HashMap;
+import java.util.Map;
+
+/**
+ * Keeps the parameter sets last seen from each device, in memory and across sessions, so decoders can be configured
+ * before the goggles send parameter sets and a key frame, e.g. when connecting mid-stream.
+ *
+ * The current device is remembered too, so a pipeline started before the goggles are attached gets the parameter
+ * sets of the last goggles used.
+ */
+public final class ParameterSetCache {
+    private static final String LastDevice = "ParameterSetDevice";
+    private static final String LastSps = "LastSps_";
+    private static final String LastPps = "LastPps_";
+
+    private static SharedPreferences preferences;
+    private static String deviceKey = "";
+    private static final Map<String, H264ParameterSets> cache = new HashMap<>();
+
+    private ParameterSetCache() {
+    }
+
+    public static synchronized void init(Context context) {
+        if (preferences != null) return;
+        preferences = PreferenceManager.getDefaultSharedPreferences(context.getApplicationContext());
+        deviceKey = preferences.getString(LastDevice, "");
+    }
+
+    /**
+     * Returns the key identifying the given device, its serial number included when readable.
+     */
+    public static String getDeviceKey(UsbDevice device) {
+        String serialNumber = null;
+        try {
+            serialNumber = device.getSerialNumber();
+        } catch (SecurityException e) {
+            // not readable without permission
+        }
+        return device.getVendorId() + ":" + device.getProductId() + (serialNumber != null ? ":" + serialNumber : "");
+    }
+
+    /**
+     * Selects the device whose parameter sets are returned and stored from now on.
+     */
+    public static synchronized void setDevice(String key) {
+        if (preferences == null || key.equals(deviceKey)) return;
+        deviceKey = key;
+        preferences.edit().putString(LastDevice, key).apply();
+    }
+
+    /**
+     * Returns the last parameter sets seen from the current device, or null if none were ever stored.
+     */
+    public static synchronized H264ParameterSets get() {
+        if (preferences == null) return null;
+        if (!cache.containsKey(deviceKey)) {
+            H264ParameterSets parameterSets = null;
+            String sps = preferences.getString(LastSps + deviceKey, null);
+            String pps = preferences.getString(LastPps + deviceKey, null);
+            if (sps != null && pps != null) {
+                parameterSets = H264ParameterSets.fromNalUnits(Base64.decode(sps, Base64.NO_WRAP), Base64.decode(pps, Base64.NO_WRAP));
+            }
+            cache.put(deviceKey, parameterSets);
+        }
+        return cache.get(deviceKey);
+    }
+
+    /**
+     * Stores the parameter sets of the current device, the preferences are only written when they changed.
+     */
+    public static synchronized void put(H264ParameterSets parameterSets) {
+        if (preferences == null || parameterSets.sameAs(cache.get(deviceKey))) return;
+        cache.put(deviceKey, parameterSets);
+        preferences.edit()
+                .putString(LastSps + deviceKey, Base64.encodeToString(parameterSets.sps, Base64.NO_WRAP))
+                .putString(LastPps + deviceKey, Base64.encodeToString(parameterSets.pps, Base64.NO_WRAP))
+                .apply();
+    }
+}
@@ -0,0 +1,146 @@
+package com.fpvout.digiview;
+
+import android.content.Context;
+import android.os.Build;
+import android.os.Process;
+import android.util.Log;
+
+import java.lang.reflect.Method;
+import java.util.ArrayList;
+import java.util.List;
+
+/**
+ * Reports the per-frame work of pipeline threads to {@code PerformanceHintManager} on API 31+, so the OS sizes clocks
+ * and cores to the actual load rather than reacting late to it.
+ *
+ * A thread brackets its work with {@link #startWork()} and {@link #stopWork()}, which may span several reads or parts
+ * of one, and calls {@link #endFrame()} once per access unit: the session compares whole frames against the target
+ * duration, reports for single reads would look like a light load.
+ *
+ * Each reporting thread gets its own hint session on its first frame. The API is called through reflection as the
+ * app is built against API 30; on older versions every call is a no-op.
+ */
+public final class PerformanceHints {
+    private static final String TAG = "DIGIVIEW";
+    private static final String PERFORMANCE_HINT_SERVICE = "performance_hint";
+    private static final long TARGET_WORK_DURATION_NS = 16_666_666; // one frame at 60fps
+
+    private static final class Session {
+        final Object session;
+        // Reused for every report, only the boxed duration is allocated.
+        final Object[] reportArgs = new Object[1];
+        volatile boolean closed;
+        long workStartNs = -1;
+        long frameWorkNs;
+
+        Session(Object session) {
+            this.session = session;
+        }
+    }
+
+    private static volatile Object manager;
+    private static Method createHintSession;
+    private static Method reportActualWorkDuration;
+    private static Method closeSession;
+    private static final List<Session> sessions = new ArrayList<>();
+    private static final ThreadLocal<Session> threadSession = new ThreadLocal<>();
+
+    private PerformanceHints() {
+    }
+
+    public static synchronized void init(Context context) {
+        if (manager != null || Build.VERSION.SDK_INT < 31) return;
+        try {
+            Object service = context.getSystemService(PERFORMANCE_HINT_SERVICE);
+            if (service == null) return;
+            Class<?> managerClass = Class.forName("android.os.PerformanceHintManager");
+            Class<?> sessionClass = Class.forName("android.os.PerformanceHintManager$Session");
+            createHintSession = managerClass.getMethod("createHintSession", int[].class, long.class);
+            reportActualWorkDuration = sessionClass.getMethod("reportActualWorkDuration", long.class);
+            closeSession = sessionClass.getMethod("close");
+            manager = service;
+        } catch (ReflectiveOperationException e) {
+            Log.e(TAG, "performance hints unavailable: " + e.getMessage());
+        }
+    }
+
+    /**
+     * Marks the calling thread as working on the current frame.
+     */
+    public static void startWork() {
+        Session session = getSession();
+        if (session != null && session.workStartNs < 0) session.workStartNs = System.nanoTime();
+    }
+
+    /**
+     * Marks the calling thread as idle, e.g. waiting for input, adding the time since {@link #startWork()} to the
+     * current frame.
+     */
+    public static void stopWork() {
+        Session session = getSession();
+        if (session == null || session.workStartNs < 0) return;
+        session.frameWorkNs += System.nanoTime() - session.workStartNs;
+        session.workStartNs = -1;
+    }
+
+    /**
+     * Reports the work done by the calling thread since the previous frame ended. Work in progress carries over to the
+     * next frame.
+     */
+    public static void endFrame() {
+        Session session = getSession();
+        if (session == null) return;
+        long workNs = session.frameWorkNs;
+        if (session.workStartNs >= 0) {
+            long now = System.nanoTime();
+            workNs += now - session.workStartNs;
+            session.workStartNs = now;
+        }
+        session.frameWorkNs = 0;
+        if (session.session == null || workNs <= 0) return;
+        session.reportArgs[0] = workNs;
+        try {
+            reportActualWorkDuration.invoke(session.session, session.reportArgs);
+        } catch (ReflectiveOperationException | IllegalArgumentException e) {
+            session.closed = true;
+        }
+    }
+
+    /**
+     * Closes every session, to be called when the pipeline stops as its threads are recreated on restart.
+     */
+    public static synchronized void closeSessions() {
+        for (Session session : sessions) {
+            session.closed = true;
+            try {
+                closeSession.invoke(session.session);
+            } catch (ReflectiveOperationException e) {
+                Log.e(TAG, "unable to close hint session: " + e.getMessage());
+            }
+        }
+        sessions.clear();
+    }
+
+    private static Session getSession() {
+        if (manager == null) return null;
+        Session session = threadSession.get();
+        if (session == null || session.closed) {
+            session = createSession();
+            threadSession.set(session);
+        }
+        return session;
+    }
+
+    private static synchronized Session createSession() {
+        try {
+            Object hintSession = createHintSession.invoke(manager, new int[]{Process.myTid()}, TARGET_WORK_DURATION_NS);
+            if (hintSession == null) return new Session(null); // not supported by the device
+            Session session = new Session(hintSession);
+            sessions.add(session);
+            return session;
+        } catch (ReflectiveOperationException e) {
+            Log.e(TAG, "unable to create hint session: " + e.getMessage());
+            return new Session(null);
+        }
+    }
+}
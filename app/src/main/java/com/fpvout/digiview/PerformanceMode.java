@@ -0,0 +1,74 @@
+package com.fpvout.digiview;
+
+import android.app.Activity;
+import android.content.Context;
+import android.os.Build;
+import android.os.PowerManager;
+import android.util.Log;
+
+import usb.PipelineStats;
+
+/**
+ * Tells the OS about the long running video workload while the activity is in the foreground: opts the window into
+ * sustained performance mode, which trades peak clocks for clocks the device can hold for a whole flight, and follows
+ * the thermal status so the pipeline can lower its work before the OS throttles it.
+ *
+ * The thermal status is published through {@link PipelineStats#getThermalStatus()}.
+ */
+public class PerformanceMode {
+    private static final String TAG = "DIGIVIEW";
+
+    private final Activity activity;
+    private final PowerManager powerManager;
+    private PowerManager.OnThermalStatusChangedListener thermalListener;
+
+    PerformanceMode(Activity activity) {
+        this.activity = activity;
+        powerManager = (PowerManager) activity.getSystemService(Context.POWER_SERVICE);
+    }
+
+    public void start() {
+        if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.N && powerManager.isSustainedPerformanceModeSupported()) {
+            activity.getWindow().setSustainedPerformanceMode(true);
+        }
+        if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.Q) {
+            thermalListener = status -> {
+                Log.d(TAG, "thermal status: " + getThermalStatusName(status));
+                PipelineStats.getInstance().setThermalStatus(status);
+            };
+            PipelineStats.getInstance().setThermalStatus(powerManager.getCurrentThermalStatus());
+            powerManager.addThermalStatusListener(activity.getMainExecutor(), thermalListener);
+        }
+    }
+
+    public void stop() {
+        if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.N && powerManager.isSustainedPerformanceModeSupported()) {
+            activity.getWindow().setSustainedPerformanceMode(false);
+        }
+        if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.Q && thermalListener != null) {
+            powerManager.removeThermalStatusListener(thermalListener);
+            thermalListener = null;
+        }
+    }
+
+    public static String getThermalStatusName(int status) {
+        switch (status) {
+            case PowerManager.THERMAL_STATUS_NONE:
+                return "none";
+            case PowerManager.THERMAL_STATUS_LIGHT:
+                return "light";
+            case PowerManager.THERMAL_STATUS_MODERATE:
+                return "moderate";
+            case PowerManager.THERMAL_STATUS_SEVERE:
+                return "severe";
+            case PowerManager.THERMAL_STATUS_CRITICAL:
+                return "critical";
+            case PowerManager.THERMAL_STATUS_EMERGENCY:
+                return "emergency";
+            case PowerManager.THERMAL_STATUS_SHUTDOWN:
+                return "shutdown";
+            default:
+                return "unknown";
+        }
+    }
+}
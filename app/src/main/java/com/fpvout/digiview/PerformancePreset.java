@@ -1,19 +1,29 @@
 package com.fpvout.digiview;
 
+import android.content.SharedPreferences;
+
 public class PerformancePreset {
     int h264ReaderMaxSyncFrameSize = 131072;
+    // Timestamp step per read, only used by the extractor when not in access unit mode.
     int h264ReaderSampleTime = 10000;
     int exoPlayerMinBufferMs = 500;
     int exoPlayerMaxBufferMs = 2000;
     int exoPlayerBufferForPlaybackMs = 17;
     int exoPlayerBufferForPlaybackAfterRebufferMs = 17;
     DataSourceType dataSourceType = DataSourceType.INPUT_STREAM;
+    int usbTransferSize = 131072;
+    boolean h264ReaderAccessUnitMode = false;
+    VideoEngineType videoEngineType = VideoEngineType.EXOPLAYER;
+    boolean adaptiveLatency = false;
+    int catchUpThresholdBytes = 0;
+    // Stream the buffered data source's ring holds, at the measured bitrate.
+    int bufferLatencyMs = 200;
 
     private PerformancePreset(){
 
     }
 
-    private PerformancePreset(int mH264ReaderMaxSyncFrameSize, int mH264ReaderSampleTime, int mExoPlayerMinBufferMs, int mExoPlayerMaxBufferMs, int mExoPlayerBufferForPlaybackMs, int mExoPlayerBufferForPlaybackAfterRebufferMs, DataSourceType mDataSourceType){
+    private PerformancePreset(int mH264ReaderMaxSyncFrameSize, int mH264ReaderSampleTime, int mExoPlayerMinBufferMs, int mExoPlayerMaxBufferMs, int mExoPlayerBufferForPlaybackMs, int mExoPlayerBufferForPlaybackAfterRebufferMs, DataSourceType mDataSourceType, int mUsbTransferSize){
         h264ReaderMaxSyncFrameSize = mH264ReaderMaxSyncFrameSize;
         h264ReaderSampleTime = mH264ReaderSampleTime;
         exoPlayerMinBufferMs = mExoPlayerMinBufferMs;
@@ -21,27 +31,71 @@ public class PerformancePreset {
         exoPlayerBufferForPlaybackMs = mExoPlayerBufferForPlaybackMs;
         exoPlayerBufferForPlaybackAfterRebufferMs = mExoPlayerBufferForPlaybackAfterRebufferMs;
         dataSourceType = mDataSourceType;
+        usbTransferSize = mUsbTransferSize;
     }
 
     static PerformancePreset getPreset(PresetType p) {
         switch (p) {
             case CONSERVATIVE:
-                return new PerformancePreset(131072, 14000, 500, 2000, 34, 34, DataSourceType.INPUT_STREAM);
+                return new PerformancePreset(131072, 14000, 500, 2000, 34, 34, DataSourceType.INPUT_STREAM, 131072);
             case AGGRESSIVE:
-                return new PerformancePreset(131072, 7000, 50, 2000, 17, 17, DataSourceType.INPUT_STREAM);
+                return new PerformancePreset(131072, 7000, 50, 2000, 17, 17, DataSourceType.INPUT_STREAM, 131072);
             case LEGACY:
-                return new PerformancePreset(30720, 200, 32768, 65536, 0, 0, DataSourceType.BUFFERED_INPUT_STREAM);
+                return new PerformancePreset(30720, 200, 32768, 65536, 0, 0, DataSourceType.BUFFERED_INPUT_STREAM, 16384);
             case LEGACY_BUFFERED:
-                return new PerformancePreset(30720, 300, 32768, 65536, 34, 34, DataSourceType.BUFFERED_INPUT_STREAM);
+                return new PerformancePreset(30720, 300, 32768, 65536, 34, 34, DataSourceType.BUFFERED_INPUT_STREAM, 16384);
+            case ASYNC:
+                return new PerformancePreset(131072, 10000, 500, 2000, 17, 17, DataSourceType.ASYNC_INPUT_STREAM, 16384);
+            case NATIVE:
+                return new PerformancePreset(131072, 10000, 500, 2000, 17, 17, DataSourceType.NATIVE_INPUT_STREAM, 16384);
+            case LOW_LATENCY: {
+                PerformancePreset preset = new PerformancePreset(131072, 16666, 50, 2000, 17, 17, DataSourceType.ASYNC_INPUT_STREAM, 16384);
+                preset.h264ReaderAccessUnitMode = true;
+                return preset;
+            }
+            case ADAPTIVE: {
+                PerformancePreset preset = new PerformancePreset(131072, 10000, 50, 2000, 17, 17, DataSourceType.INPUT_STREAM, 131072);
+                preset.adaptiveLatency = true;
+                return preset;
+            }
+            case LATEST_FRAME: {
+                PerformancePreset preset = new PerformancePreset(131072, 10000, 50, 2000, 17, 17, DataSourceType.BUFFERED_INPUT_STREAM, 16384);
+                preset.catchUpThresholdBytes = 262144;
+                return preset;
+            }
+            case DIRECT_DECODE: {
+                PerformancePreset preset = new PerformancePreset(131072, 16666, 0, 0, 0, 0, DataSourceType.ASYNC_INPUT_STREAM, 16384);
+                preset.videoEngineType = VideoEngineType.MEDIA_CODEC;
+                return preset;
+            }
             case DEFAULT:
             default:
-                return new PerformancePreset(131072, 10000, 500, 2000, 17, 17, DataSourceType.INPUT_STREAM);
+                return new PerformancePreset(131072, 10000, 500, 2000, 17, 17, DataSourceType.INPUT_STREAM, 131072);
         }
     }
 
+    public enum VideoEngineType {
+        EXOPLAYER,
+        MEDIA_CODEC
+    }
+
     public enum DataSourceType {
         INPUT_STREAM,
-        BUFFERED_INPUT_STREAM
+        BUFFERED_INPUT_STREAM,
+        ASYNC_INPUT_STREAM,
+        // usbdevfs URBs queued by the native library, falls back to ASYNC_INPUT_STREAM without it.
+        NATIVE_INPUT_STREAM
+    }
+
+    /**
+     * Returns the preset selected in the settings, the one picked by {@link DecoderProbe} when set to auto.
+     */
+    static PerformancePreset getPreset(SharedPreferences preferences) {
+        String p = preferences.getString(VideoPipeline.VideoPreset, DecoderProbe.AUTO_PRESET);
+        if (DecoderProbe.AUTO_PRESET.equals(p)) {
+            p = DecoderProbe.getAutoPreset(preferences);
+        }
+        return getPreset(p);
     }
 
     static PerformancePreset getPreset(String p) {
@@ -54,6 +108,18 @@ public class PerformancePreset {
                 return getPreset(PresetType.LEGACY);
             case "new_legacy":
                 return getPreset(PresetType.LEGACY_BUFFERED);
+            case "async":
+                return getPreset(PresetType.ASYNC);
+            case "native":
+                return getPreset(PresetType.NATIVE);
+            case "low_latency":
+                return getPreset(PresetType.LOW_LATENCY);
+            case "direct_decode":
+                return getPreset(PresetType.DIRECT_DECODE);
+            case "adaptive":
+                return getPreset(PresetType.ADAPTIVE);
+            case "latest_frame":
+                return getPreset(PresetType.LATEST_FRAME);
             case "default":
             default:
                 return getPreset(PresetType.DEFAULT);
@@ -65,7 +131,13 @@ public class PerformancePreset {
         CONSERVATIVE,
         AGGRESSIVE,
         LEGACY,
-        LEGACY_BUFFERED
+        LEGACY_BUFFERED,
+        ASYNC,
+        NATIVE,
+        LOW_LATENCY,
+        DIRECT_DECODE,
+        ADAPTIVE,
+        LATEST_FRAME
     }
 
     @Override
@@ -78,6 +150,12 @@ public class PerformancePreset {
                 ", exoPlayerBufferForPlaybackMs=" + exoPlayerBufferForPlaybackMs +
                 ", exoPlayerBufferForPlaybackAfterRebufferMs=" + exoPlayerBufferForPlaybackAfterRebufferMs +
                 ", dataSourceType=" + dataSourceType +
+                ", usbTransferSize=" + usbTransferSize +
+                ", h264ReaderAccessUnitMode=" + h264ReaderAccessUnitMode +
+                ", videoEngineType=" + videoEngineType +
+                ", adaptiveLatency=" + adaptiveLatency +
+                ", bufferLatencyMs=" + bufferLatencyMs +
+                ", catchUpThresholdBytes=" + catchUpThresholdBytes +
                 '}';
     }
 }
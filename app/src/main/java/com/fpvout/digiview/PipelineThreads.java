@@ -0,0 +1,44 @@
+package com.fpvout.digiview;
+
+import android.os.Process;
+
+/**
+ * Threading model of the video pipeline. Every thread on the frame path runs at an explicit priority above the UI:
+ * - USB I/O, doing nothing but receive transfers: {@link #USB_IO_PRIORITY},
+ * - parsing and decoder feeding: {@link #PARSE_PRIORITY} / {@link #DECODE_FEED_PRIORITY},
+ * - decoder output, which times frame releases: {@link #RENDER_PRIORITY},
+ * - the goggles control channel, idle but prompt when the stream stalls: {@link #CONTROL_PRIORITY},
+ * - side work such as recording: {@link #BACKGROUND_PRIORITY}, so it never competes with the live view.
+ * ExoPlayer's playback thread already runs at {@code THREAD_PRIORITY_AUDIO}. Android doesn't let apps pin threads to
+ * cores, so priorities are what steers frame path threads towards the fast cores on big.LITTLE SoCs.
+ */
+public final class PipelineThreads {
+    public static final int USB_IO_PRIORITY = Process.THREAD_PRIORITY_URGENT_DISPLAY;
+    public static final int PARSE_PRIORITY = Process.THREAD_PRIORITY_DISPLAY;
+    public static final int DECODE_FEED_PRIORITY = Process.THREAD_PRIORITY_DISPLAY;
+    public static final int RENDER_PRIORITY = Process.THREAD_PRIORITY_URGENT_DISPLAY;
+    public static final int CONTROL_PRIORITY = Process.THREAD_PRIORITY_DISPLAY;
+    public static final int BACKGROUND_PRIORITY = Process.THREAD_PRIORITY_BACKGROUND;
+
+    private PipelineThreads() {
+    }
+
+    /**
+     * Returns a new, not started, thread running {@code runnable} at the given {@code android.os.Process} priority.
+     */
+    public static Thread newThread(String name, int priority, Runnable runnable) {
+        return new Thread(() -> {
+            Process.setThreadPriority(priority);
+            runnable.run();
+        }, name);
+    }
+
+    /**
+     * Sets the priority of a thread the pipeline doesn't own, such as an ExoPlayer loader thread, from within it.
+     */
+    public static void setCurrentThreadPriority(int priority) {
+        if (Process.getThreadPriority(Process.myTid()) != priority) {
+            Process.setThreadPriority(priority);
+        }
+    }
+}
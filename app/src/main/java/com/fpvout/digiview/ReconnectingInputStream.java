@@ -0,0 +1,192 @@
+package com.fpvout.digiview;
+
+import java.io.IOException;
+import java.io.InputStream;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.locks.LockSupport;
+
+import usb.BroadcastRingBuffer;
+import usb.PipelineStats;
+
+/**
+ * Stream handed to the video engines in place of the goggles stream. It survives USB stalls and replugs, so the
+ * decoder and its surface stay configured and video comes back as soon as data flows again.
+ *
+ * Empty transfers and a missing source never end the stream, reads just return 0, so the engines can be started
+ * before the goggles are even connected. Once a source delivered no data for
+ * {@link #STALL_TIMEOUT_NS} the listener is told, and again every {@link #STALL_RETRY_NS} while it lasts. When data
+ * flows again, it is discarded until the next IDR frame so decoding resumes on a clean picture. The source can be
+ * swapped at any time, e.g. after a replug.
+ *
+ * Data is discarded the same way when the source cursor skipped ahead, as it does when the reader fell behind, and when
+ * the source was swapped: either may cut an access unit. Readers that assemble access units learn about the cut through
+ * {@link #takeDiscontinuity()}.
+ */
+public class ReconnectingInputStream extends InputStream {
+    private static final long STALL_TIMEOUT_NS = TimeUnit.MILLISECONDS.toNanos(300);
+    private static final long STALL_RETRY_NS = TimeUnit.MILLISECONDS.toNanos(1000);
+    private static final long NO_SOURCE_WAIT_NS = TimeUnit.MILLISECONDS.toNanos(10);
+
+    public interface Listener {
+        /**
+         * Called on the reading thread when data stopped flowing, then periodically until it flows again.
+         */
+        void onStall();
+
+        /**
+         * Called on the reading thread when data flows again after a stall, before the first key frame is passed on.
+         */
+        void onResume();
+    }
+
+    private volatile InputStream source;
+    private volatile Listener listener;
+    private final NalUnitScanner scanner = new NalUnitScanner();
+    private final byte[] singleByte = new byte[1];
+
+    private volatile long lastDataNs = System.nanoTime();
+    private long lastStallNotificationNs;
+    private boolean stalled;
+    private boolean waitingForKeyFrame;
+    private boolean discontinuity;
+    private volatile boolean sourceChanged;
+
+    /**
+     * Sets the stream to read from, or null while there is none. Stalls are only tracked while there is a source, one
+     * going on when the source is removed lasts until the next source delivers data.
+     */
+    public void setSource(InputStream stream) {
+        if (stream != null && !stalled) {
+            lastDataNs = System.nanoTime();
+        }
+        if (stream != null && source != null) {
+            sourceChanged = true;
+        }
+        source = stream;
+    }
+
+    public InputStream getSource() {
+        return source;
+    }
+
+    public void setListener(Listener l) {
+        listener = l;
+    }
+
+    /**
+     * Returns whether data was discarded or lost since the last call, and clears the flag: the data read next doesn't
+     * follow the data read last, and starts with a key frame.
+     */
+    public boolean takeDiscontinuity() {
+        boolean result = discontinuity;
+        discontinuity = false;
+        return result;
+    }
+
+    /**
+     * Returns the {@link System#nanoTime()} of the last read that returned data.
+     */
+    public long getLastDataNs() {
+        return lastDataNs;
+    }
+
+    @Override
+    public int read() throws IOException {
+        int readBytes = read(singleByte, 0, 1);
+        return readBytes <= 0 ? -1 : singleByte[0] & 0xFF;
+    }
+
+    @Override
+    public int read(byte[] buffer, int offset, int length) throws IOException {
+        InputStream stream = source;
+        if (stream == null) {
+            LockSupport.parkNanos(this, NO_SOURCE_WAIT_NS);
+            return 0;
+        }
+
+        int readBytes = stream.read(buffer, offset, length);
+        if (sourceChanged || (stream instanceof BroadcastRingBuffer.Cursor && ((BroadcastRingBuffer.Cursor) stream).takeDiscontinuity())) {
+            // Skipped ahead, possibly in the middle of an access unit: resume on a key frame, as after a stall.
+            sourceChanged = false;
+            waitingForKeyFrame = true;
+            discontinuity = true;
+        }
+        if (readBytes <= 0) {
+            checkStall();
+            return 0;
+        }
+
+        long now = System.nanoTime();
+        lastDataNs = now;
+        if (stalled) {
+            stalled = false;
+            waitingForKeyFrame = true;
+            discontinuity = true;
+            PipelineStats.getInstance().onStreamResumed(now);
+            Listener l = listener;
+            if (l != null) l.onResume();
+        }
+        if (waitingForKeyFrame) {
+            int keyFrameStart = findKeyFrame(buffer, offset, offset + readBytes);
+            if (keyFrameStart < 0) return 0;
+            waitingForKeyFrame = false;
+            readBytes -= keyFrameStart - offset;
+            System.arraycopy(buffer, keyFrameStart, buffer, offset, readBytes);
+        }
+        return readBytes;
+    }
+
+    private void checkStall() {
+        long now = System.nanoTime();
+        if (!stalled) {
+            if (now - lastDataNs < STALL_TIMEOUT_NS) return;
+            stalled = true;
+            PipelineStats.getInstance().onStreamStalled(lastDataNs);
+        } else if (now - lastStallNotificationNs < STALL_RETRY_NS) {
+            return;
+        }
+        lastStallNotificationNs = now;
+        Listener l = listener;
+        if (l != null) l.onStall();
+    }
+
+    /**
+     * Returns the offset of the first IDR frame starting in {@code data[from, limit)}, parameter sets included, or -1.
+     * Only start codes entirely within the chunk are considered.
+     */
+    private int findKeyFrame(byte[] data, int from, int limit) {
+        scanner.reset();
+        int nonSliceRunStart = -1;
+        int header = scanner.findNalUnit(data, from, limit);
+        while (header != -1) {
+            int nalUnitStart = header - 3;
+            int nalUnitType = NalUnitScanner.getNalUnitType(data[header]);
+            if (NalUnitScanner.isSlice(nalUnitType)) {
+                boolean firstSlice = header + 1 < limit && (data[header + 1] & 0x80) != 0;
+                if (nalUnitType == NalUnitScanner.NAL_UNIT_TYPE_IDR && firstSlice) {
+                    return nonSliceRunStart >= 0 ? nonSliceRunStart : nalUnitStart;
+                }
+                nonSliceRunStart = -1;
+            } else if (nonSliceRunStart < 0) {
+                nonSliceRunStart = nalUnitStart;
+            }
+            header = scanner.findNalUnit(data, header + 1, limit);
+        }
+        return -1;
+    }
+
+    @Override
+    public int available() throws IOException {
+        InputStream stream = source;
+        return stream != null ? stream.available() : 0;
+    }
+
+    /**
+     * Closes the current source, which the data sources do on each restart. The stream itself stays usable.
+     */
+    @Override
+    public void close() throws IOException {
+        InputStream stream = source;
+        if (stream != null) stream.close();
+    }
+}
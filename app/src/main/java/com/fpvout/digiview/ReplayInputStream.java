@@ -0,0 +1,125 @@
+package com.fpvout.digiview;
+
+import android.util.Log;
+
+import java.io.File;
+import java.io.IOException;
+import java.io.InputStream;
+import java.io.RandomAccessFile;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.locks.LockSupport;
+
+import usb.PipelineStats;
+
+/**
+ * Replays a raw H264 capture (Annex B, as received from the goggles) in place of the USB stream, to benchmark the
+ * pipeline without hardware.
+ *
+ * Reads are served in chunks of at most the USB transfer size. When paced, each chunk is held back until the frames it
+ * starts are due at the capture frame rate, as if they were arriving live; otherwise data is served as fast as the
+ * pipeline reads it. {@link #close()} only rewinds, since the data sources close their stream on each restart.
+ */
+public class ReplayInputStream extends InputStream {
+    private static final String TAG = "DIGIVIEW";
+    public static final int DEFAULT_FRAME_RATE = 60;
+
+    private final File file;
+    private final int transferSize;
+    private final boolean paced;
+    private final boolean loop;
+    private final long frameDurationNs;
+    private final NalUnitScanner scanner = new NalUnitScanner();
+    private final byte[] singleByte = new byte[1];
+
+    private RandomAccessFile input;
+    private long startTimeNs = -1;
+    private long frames;
+
+    /**
+     * @param transferSize Maximum number of bytes returned by a single read, like a USB transfer.
+     * @param paced Whether to deliver frames at {@code frameRate} rather than as fast as possible.
+     * @param loop Whether to start again from the beginning at the end of the file instead of ending the stream.
+     */
+    public ReplayInputStream(File file, int transferSize, boolean paced, boolean loop, int frameRate) throws IOException {
+        this.file = file;
+        this.transferSize = transferSize;
+        this.paced = paced;
+        this.loop = loop;
+        this.frameDurationNs = TimeUnit.SECONDS.toNanos(1) / frameRate;
+        input = new RandomAccessFile(file, "r");
+    }
+
+    @Override
+    public int read() throws IOException {
+        int readBytes = read(singleByte, 0, 1);
+        return readBytes <= 0 ? -1 : singleByte[0] & 0xFF;
+    }
+
+    @Override
+    public int read(byte[] buffer, int offset, int length) throws IOException {
+        if (input == null) throw new IOException("Replay of " + file + " released");
+        long startTime = System.nanoTime();
+        int readBytes = input.read(buffer, offset, Math.min(length, transferSize));
+        if (readBytes <= 0 && loop) {
+            rewind();
+            readBytes = input.read(buffer, offset, Math.min(length, transferSize));
+        }
+        if (readBytes <= 0) return -1;
+
+        if (paced) {
+            pace(buffer, offset, readBytes);
+        }
+        PipelineStats.getInstance().onUsbTransfer(readBytes, System.nanoTime() - startTime);
+        return readBytes;
+    }
+
+    private void pace(byte[] buffer, int offset, int length) {
+        int limit = offset + length;
+        int header = scanner.findNalUnit(buffer, offset, limit);
+        while (header != -1) {
+            if (scanner.isAccessUnitStart(buffer, header, limit)) {
+                frames++;
+            }
+            header = scanner.findNalUnit(buffer, header + 1, limit);
+        }
+
+        long now = System.nanoTime();
+        if (startTimeNs < 0) {
+            startTimeNs = now;
+        }
+        long dueTimeNs = startTimeNs + frames * frameDurationNs;
+        while (now < dueTimeNs) {
+            LockSupport.parkNanos(this, dueTimeNs - now);
+            now = System.nanoTime();
+        }
+    }
+
+    private void rewind() throws IOException {
+        input.seek(0);
+        scanner.reset();
+    }
+
+    /**
+     * Rewinds the capture, the next read starts again from the beginning.
+     */
+    @Override
+    public void close() throws IOException {
+        if (input == null) return;
+        rewind();
+        startTimeNs = -1;
+        frames = 0;
+    }
+
+    /**
+     * Closes the capture file.
+     */
+    public void release() {
+        if (input == null) return;
+        try {
+            input.close();
+        } catch (IOException e) {
+            Log.e(TAG, "REPLAY - unable to close " + file + ": " + e.getMessage());
+        }
+        input = null;
+    }
+}
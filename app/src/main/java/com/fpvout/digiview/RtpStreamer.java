@@ -0,0 +1,281 @@
+package com.fpvout.digiview;
+
+import android.util.Base64;
+import android.util.Log;
+
+import java.io.IOException;
+import java.net.DatagramPacket;
+import java.net.InetAddress;
+import java.net.InetSocketAddress;
+import java.net.MulticastSocket;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Random;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.locks.LockSupport;
+
+import usb.BroadcastRingBuffer;
+import usb.ByteArrayPool;
+
+/**
+ * Restreams the raw H264 stream over RTP (RFC 6184, packetization mode 1), without re-encoding, to one or more UDP
+ * receivers such as a spectator screen running {@code ffplay} or VLC with the SDP logged on start.
+ *
+ * A sender thread reads the stream through its own cursor on the capture ring, reassembles access units, packetizes
+ * each once, single NAL unit packets or FU-A fragments, and sends every packet to all receivers. Multicast groups are
+ * supported. The live view is never held back: when the network can't keep up the cursor skips to live data and
+ * streaming resumes at the next key frame, and packets of large frames are only paced while the sender is not behind.
+ */
+public class RtpStreamer {
+    private static final String TAG = "DIGIVIEW";
+    private static final int INITIAL_ACCESS_UNIT_SIZE = 131072;
+    private static final int READ_SIZE = 131072;
+    public static final int DEFAULT_PORT = 5004;
+
+    private static final int MAX_PACKET_SIZE = 1400;
+    private static final int RTP_HEADER_SIZE = 12;
+    private static final int PAYLOAD_TYPE = 96;
+    private static final int CLOCK_RATE = 90000;
+    private static final int NAL_UNIT_TYPE_FU_A = 28;
+    private static final int MULTICAST_TTL = 4;
+    // Packets of large frames are sent in bursts at most this often, rather than all at once into the Wi-Fi queue.
+    private static final int PACING_BURST_PACKETS = 8;
+    private static final long PACING_BURST_INTERVAL_NS = TimeUnit.MICROSECONDS.toNanos(500);
+
+    private final List<String> targets;
+    private volatile boolean streaming;
+    private volatile BroadcastRingBuffer.Cursor cursor;
+    private Thread senderThread;
+
+    // Sender thread only.
+    private MulticastSocket socket;
+    private final List<InetSocketAddress> receivers = new ArrayList<>();
+    private final NalUnitScanner nalUnitScanner = new NalUnitScanner();
+    private final byte[] packet = new byte[MAX_PACKET_SIZE];
+    private final DatagramPacket datagram = new DatagramPacket(packet, MAX_PACKET_SIZE);
+    private final int ssrc = new Random().nextInt();
+    private int sequenceNumber = new Random().nextInt(0x10000);
+    private long firstArrivalTimeNs;
+    private boolean waitingForKeyFrame = true;
+    private int accessUnitPackets;
+    private long burstStartNs;
+    private long sentPackets;
+    private long sendErrors;
+
+    /**
+     * @param targets Receivers as {@code host[:port]}, unicast or multicast, the port defaulting to {@link #DEFAULT_PORT}.
+     */
+    public RtpStreamer(List<String> targets) {
+        this.targets = targets;
+    }
+
+    /**
+     * Parses a comma or whitespace separated list of targets.
+     */
+    public static List<String> parseTargets(String targets) {
+        List<String> list = new ArrayList<>();
+        if (targets == null) return list;
+        for (String target : targets.split("[,\\s]+")) {
+            if (!target.isEmpty()) list.add(target);
+        }
+        return list;
+    }
+
+    /**
+     * Starts streaming from the given cursor, which should skip to live data when it falls behind.
+     */
+    public void start(BroadcastRingBuffer.Cursor stream) {
+        if (streaming) return;
+        streaming = true;
+        cursor = stream;
+        waitingForKeyFrame = true;
+        firstArrivalTimeNs = 0;
+        sentPackets = 0;
+        sendErrors = 0;
+        senderThread = PipelineThreads.newThread("RtpSender", PipelineThreads.BACKGROUND_PRIORITY, this::send);
+        senderThread.start();
+    }
+
+    public void stop() {
+        if (!streaming) return;
+        streaming = false;
+        if (senderThread != null) {
+            try {
+                senderThread.join();
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+            }
+            senderThread = null;
+        }
+    }
+
+    /**
+     * @return Bytes dropped because the network couldn't keep up.
+     */
+    public long getDroppedBytes() {
+        BroadcastRingBuffer.Cursor stream = cursor;
+        return stream != null ? stream.getSkippedBytes() : 0;
+    }
+
+    private void send() {
+        AccessUnitAssembler assembler = new AccessUnitAssembler(INITIAL_ACCESS_UNIT_SIZE, this::sendAccessUnit);
+        byte[] buffer = ByteArrayPool.getInstance().acquire(READ_SIZE);
+        BroadcastRingBuffer.Cursor stream = cursor;
+        try {
+            if (!openSocket()) return;
+            while (streaming) {
+                int readBytes = stream.read(buffer, 0, READ_SIZE);
+                if (stream.takeDiscontinuity()) {
+                    assembler.reset();
+                    waitingForKeyFrame = true;
+                }
+                if (readBytes <= 0) continue;
+                assembler.consume(buffer, 0, readBytes, stream.getLastArrivalTimeNs());
+            }
+        } finally {
+            assembler.release();
+            ByteArrayPool.getInstance().release(buffer);
+            if (socket != null) {
+                socket.close();
+                socket = null;
+            }
+            receivers.clear();
+            Log.d(TAG, "RTP - stopped, " + sentPackets + " packets sent, " + sendErrors + " send errors, " + getDroppedBytes() + " bytes dropped");
+        }
+    }
+
+    /**
+     * Resolves the targets, on the sender thread as it may hit the network, and opens the socket.
+     */
+    private boolean openSocket() {
+        for (String target : targets) {
+            int separator = target.lastIndexOf(':');
+            String host = separator > 0 ? target.substring(0, separator) : target;
+            try {
+                int port = separator > 0 ? Integer.parseInt(target.substring(separator + 1)) : DEFAULT_PORT;
+                receivers.add(new InetSocketAddress(InetAddress.getByName(host), port));
+            } catch (IOException | NumberFormatException e) {
+                Log.e(TAG, "RTP - ignoring target " + target + ": " + e.getMessage());
+            }
+        }
+        if (receivers.isEmpty()) {
+            Log.e(TAG, "RTP - no valid target, not streaming");
+            return false;
+        }
+        try {
+            socket = new MulticastSocket();
+            socket.setTimeToLive(MULTICAST_TTL);
+        } catch (IOException e) {
+            Log.e(TAG, "RTP - unable to open socket: " + e.getMessage());
+            return false;
+        }
+        for (InetSocketAddress receiver : receivers) {
+            Log.d(TAG, "RTP - streaming to " + receiver + (receiver.getAddress().isMulticastAddress() ? " (multicast)" : ""));
+        }
+        return true;
+    }
+
+    private void sendAccessUnit(byte[] data, int length, boolean keyFrame, long arrivalTimeNs) {
+        if (waitingForKeyFrame) {
+            if (!keyFrame) return;
+            waitingForKeyFrame = false;
+            if (firstArrivalTimeNs == 0) {
+                firstArrivalTimeNs = arrivalTimeNs;
+                logSdp(data, length);
+            }
+        }
+        // Arrival times on the 90kHz RTP clock.
+        int timestamp = (int) ((arrivalTimeNs - firstArrivalTimeNs) * CLOCK_RATE / 1_000_000_000L);
+        accessUnitPackets = 0;
+        burstStartNs = System.nanoTime();
+
+        nalUnitScanner.reset();
+        int header = nalUnitScanner.findNalUnit(data, 0, length);
+        while (header != -1) {
+            int next = nalUnitScanner.findNalUnit(data, header + 1, length);
+            int end = next == -1 ? length : next - 3;
+            while (end > header + 1 && data[end - 1] == 0) end--; // zero byte of a 4 byte start code
+            if (NalUnitScanner.getNalUnitType(data[header]) != NalUnitScanner.NAL_UNIT_TYPE_AUD) {
+                sendNalUnit(data, header, end, timestamp, next == -1);
+            }
+            header = next;
+        }
+    }
+
+    private void sendNalUnit(byte[] data, int start, int end, int timestamp, boolean last) {
+        int maxPayload = MAX_PACKET_SIZE - RTP_HEADER_SIZE;
+        int size = end - start;
+        if (size <= maxPayload) {
+            System.arraycopy(data, start, packet, RTP_HEADER_SIZE, size);
+            sendPacket(timestamp, last, RTP_HEADER_SIZE + size);
+            return;
+        }
+        // FU-A: the NAL unit header is split between the FU indicator and the FU header of every fragment.
+        byte nalHeader = data[start];
+        int position = start + 1;
+        int fragmentSize = maxPayload - 2;
+        boolean first = true;
+        while (position < end) {
+            int fragment = Math.min(fragmentSize, end - position);
+            boolean lastFragment = position + fragment == end;
+            packet[RTP_HEADER_SIZE] = (byte) ((nalHeader & 0xE0) | NAL_UNIT_TYPE_FU_A);
+            packet[RTP_HEADER_SIZE + 1] = (byte) ((first ? 0x80 : 0) | (lastFragment ? 0x40 : 0) | (nalHeader & 0x1F));
+            System.arraycopy(data, position, packet, RTP_HEADER_SIZE + 2, fragment);
+            sendPacket(timestamp, last && lastFragment, RTP_HEADER_SIZE + 2 + fragment);
+            position += fragment;
+            first = false;
+        }
+    }
+
+    private void sendPacket(int timestamp, boolean marker, int size) {
+        packet[0] = (byte) 0x80; // version 2
+        packet[1] = (byte) ((marker ? 0x80 : 0) | PAYLOAD_TYPE);
+        packet[2] = (byte) (sequenceNumber >> 8);
+        packet[3] = (byte) sequenceNumber;
+        packet[4] = (byte) (timestamp >> 24);
+        packet[5] = (byte) (timestamp >> 16);
+        packet[6] = (byte) (timestamp >> 8);
+        packet[7] = (byte) timestamp;
+        packet[8] = (byte) (ssrc >> 24);
+        packet[9] = (byte) (ssrc >> 16);
+        packet[10] = (byte) (ssrc >> 8);
+        packet[11] = (byte) ssrc;
+        sequenceNumber = (sequenceNumber + 1) & 0xFFFF;
+
+        datagram.setLength(size);
+        for (InetSocketAddress receiver : receivers) {
+            datagram.setSocketAddress(receiver);
+            try {
+                socket.send(datagram);
+            } catch (IOException e) {
+                if (sendErrors++ == 0) {
+                    Log.e(TAG, "RTP - send to " + receiver + " failed: " + e.getMessage());
+                }
+            }
+        }
+        sentPackets++;
+        pace();
+    }
+
+    private void pace() {
+        if (++accessUnitPackets % PACING_BURST_PACKETS != 0 || cursor.available() > 0) return;
+        long elapsedNs = System.nanoTime() - burstStartNs;
+        if (elapsedNs < PACING_BURST_INTERVAL_NS) {
+            LockSupport.parkNanos(PACING_BURST_INTERVAL_NS - elapsedNs);
+        }
+        burstStartNs = System.nanoTime();
+    }
+
+    private void logSdp(byte[] data, int length) {
+        H264ParameterSets parameterSets = H264ParameterSets.extract(data, length);
+        String fmtp = "packetization-mode=1";
+        if (parameterSets != null) {
+            fmtp += "; sprop-parameter-sets=" + Base64.encodeToString(parameterSets.sps, 3, parameterSets.sps.length - 3, Base64.NO_WRAP)
+                    + "," + Base64.encodeToString(parameterSets.pps, 3, parameterSets.pps.length - 3, Base64.NO_WRAP);
+        }
+        InetSocketAddress receiver = receivers.get(0);
+        Log.i(TAG, "RTP - SDP:\nv=0\no=- 0 0 IN IP4 127.0.0.1\ns=DigiView\nc=IN IP4 " + receiver.getAddress().getHostAddress()
+                + "\nt=0 0\nm=video " + receiver.getPort() + " RTP/AVP " + PAYLOAD_TYPE + "\na=rtpmap:" + PAYLOAD_TYPE + " H264/" + CLOCK_RATE
+                + "\na=fmtp:" + PAYLOAD_TYPE + " " + fmtp);
+    }
+}
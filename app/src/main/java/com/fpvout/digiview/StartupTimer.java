@@ -0,0 +1,60 @@
+package com.fpvout.digiview;
+
+import android.os.Build;
+import android.os.Process;
+import android.os.SystemClock;
+import android.util.Log;
+
+/**
+ * Times the phases from process start to the first rendered frame, so cold start regressions show up in the log:
+ * {@code STARTUP - created 180ms, pipeline warm 240ms, ... first frame 1310ms}.
+ *
+ * Only the first occurrence of each phase is kept, the summary is logged once on the first frame.
+ */
+public final class StartupTimer {
+    private static final String TAG = "DIGIVIEW";
+
+    public enum Phase {
+        ACTIVITY_CREATED("created"),
+        PIPELINE_WARM("pipeline warm"),
+        SENTRY_READY("sentry ready"),
+        DEVICE_FOUND("device found"),
+        PERMISSION_GRANTED("permission granted"),
+        CONNECTED("connected"),
+        DECODER_CONFIGURED("decoder configured"),
+        FIRST_FRAME("first frame");
+
+        final String label;
+
+        Phase(String label) {
+            this.label = label;
+        }
+    }
+
+    private static final long startMs = Build.VERSION.SDK_INT >= Build.VERSION_CODES.N ? Process.getStartElapsedRealtime() : SystemClock.elapsedRealtime();
+    private static final long[] phaseMs = new long[Phase.values().length];
+    private static boolean reported;
+
+    private StartupTimer() {
+    }
+
+    public static synchronized void mark(Phase phase) {
+        if (reported || phaseMs[phase.ordinal()] != 0) return;
+        phaseMs[phase.ordinal()] = Math.max(1, SystemClock.elapsedRealtime() - startMs);
+        if (phase == Phase.FIRST_FRAME) {
+            reported = true;
+            Log.i(TAG, "STARTUP - " + summary());
+        }
+    }
+
+    private static String summary() {
+        StringBuilder summary = new StringBuilder();
+        for (Phase phase : Phase.values()) {
+            long ms = phaseMs[phase.ordinal()];
+            if (ms == 0) continue;
+            if (summary.length() > 0) summary.append(", ");
+            summary.append(phase.label).append(' ').append(ms).append("ms");
+        }
+        return summary.toString();
+    }
+}
@@ -0,0 +1,125 @@
+package com.fpvout.digiview;
+
+import android.content.Context;
+import android.util.AttributeSet;
+import android.view.View;
+
+import androidx.appcompat.widget.AppCompatTextView;
+
+import java.util.Locale;
+
+import usb.ByteArrayPool;
+import usb.LatencyHistogram;
+import usb.PipelineStats;
+
+/**
+ * Debug overlay showing live pipeline statistics, refreshed periodically while visible.
+ */
+public class StatsView extends AppCompatTextView {
+    private static final long REFRESH_INTERVAL_MS = 1000;
+
+    private final PipelineStats stats = PipelineStats.getInstance();
+    private final long[][] windowCounts = new long[PipelineStats.Stage.values().length][LatencyHistogram.BUCKET_COUNT];
+    private final StringBuilder text = new StringBuilder();
+    private long lastRefreshNs;
+    private long lastReceivedBytes;
+    private long lastRenderedFrames;
+
+    private final Runnable refresh = new Runnable() {
+        @Override
+        public void run() {
+            update();
+            postDelayed(this, REFRESH_INTERVAL_MS);
+        }
+    };
+
+    public StatsView(Context context, AttributeSet attrs) {
+        super(context, attrs);
+    }
+
+    public void show() {
+        setVisibility(View.VISIBLE);
+        startRefreshing();
+    }
+
+    public void hide() {
+        setVisibility(View.GONE);
+        removeCallbacks(refresh);
+    }
+
+    @Override
+    protected void onAttachedToWindow() {
+        super.onAttachedToWindow();
+        if (getVisibility() == View.VISIBLE) {
+            startRefreshing();
+        }
+    }
+
+    @Override
+    protected void onDetachedFromWindow() {
+        removeCallbacks(refresh);
+        super.onDetachedFromWindow();
+    }
+
+    private void startRefreshing() {
+        removeCallbacks(refresh);
+        lastRefreshNs = 0;
+        post(refresh);
+    }
+
+    private void update() {
+        long now = System.nanoTime();
+        long receivedBytes = stats.getReceivedBytes();
+        long renderedFrames = stats.getRenderedFrames();
+
+        if (lastRefreshNs == 0) {
+            snapshot(now, receivedBytes, renderedFrames);
+            return;
+        }
+
+        float elapsedS = (now - lastRefreshNs) / 1e9f;
+        float mbps = (receivedBytes - lastReceivedBytes) * 8 / 1e6f / elapsedS;
+        float fps = (renderedFrames - lastRenderedFrames) / elapsedS;
+        int capacity = stats.getBufferCapacityBytes();
+
+        text.setLength(0);
+        text.append(String.format(Locale.US, "%.1f Mbit/s  %.1f fps  dropped %d  skipped %d\n", mbps, fps, stats.getDroppedFrames(), stats.getSkippedFrames()));
+        if (capacity > 0) {
+            text.append(String.format(Locale.US, "buffer %d / %d KB\n", stats.getBufferUsedBytes() / 1024, capacity / 1024));
+        }
+        for (PipelineStats.Stage stage : PipelineStats.Stage.values()) {
+            LatencyHistogram histogram = stats.getHistogram(stage);
+            long[] since = windowCounts[stage.ordinal()];
+            float p50 = histogram.getPercentileMs(50, since);
+            if (p50 < 0) continue;
+            text.append(String.format(Locale.US, "%s p50 %.1f ms  p99 %.1f ms\n", stage.name().toLowerCase(Locale.US), p50, histogram.getPercentileMs(99, since)));
+        }
+        text.append(String.format(Locale.US, "slices I %d P %d B %d  %.1f Mbit/s\n", stats.getISlices(), stats.getPSlices(), stats.getBSlices(), stats.getBitstreamBitrate() / 1e6f));
+        text.append(String.format(Locale.US, "frame gaps %d (%d lost)  lost slices %d  truncated %d  corrupt %d  overruns %d\n", stats.getFrameNumGaps(), stats.getMissingFrames(), stats.getLostSlices(), stats.getTruncatedNalUnits(), stats.getCorruptNalUnits(), stats.getBufferOverruns()));
+        if (stats.getConcealments() > 0) {
+            text.append(String.format(Locale.US, "concealed %d frames in %d losses\n", stats.getConcealedFrames(), stats.getConcealments()));
+        }
+        if (stats.getReconnectCount() > 0) {
+            text.append(String.format(Locale.US, "reconnects %d  first frame %d ms  blind %d ms\n", stats.getReconnectCount(), stats.getLastReconnectFirstFrameMs(), stats.getLastReconnectBlindMs()));
+        }
+        if (stats.getThermalStatus() >= 0) {
+            text.append("thermal ").append(PerformanceMode.getThermalStatusName(stats.getThermalStatus())).append('\n');
+        }
+        Runtime runtime = Runtime.getRuntime();
+        long heapUsed = runtime.totalMemory() - runtime.freeMemory();
+        text.append(String.format(Locale.US, "heap %d / %d MB  ", heapUsed / (1024 * 1024), runtime.maxMemory() / (1024 * 1024)));
+        text.append("pool allocations ").append(ByteArrayPool.getInstance().getAllocationCount());
+        setText(text);
+
+        snapshot(now, receivedBytes, renderedFrames);
+    }
+
+    private void snapshot(long now, long receivedBytes, long renderedFrames) {
+        lastRefreshNs = now;
+        lastReceivedBytes = receivedBytes;
+        lastRenderedFrames = renderedFrames;
+        for (PipelineStats.Stage stage : PipelineStats.Stage.values()) {
+            stats.getHistogram(stage).copyCounts(windowCounts[stage.ordinal()]);
+        }
+    }
+}
@@ -0,0 +1,388 @@
+package com.fpvout.digiview;
+
+import android.graphics.SurfaceTexture;
+import android.opengl.EGL14;
+import android.opengl.EGLConfig;
+import android.opengl.EGLContext;
+import android.opengl.EGLDisplay;
+import android.opengl.EGLExt;
+import android.opengl.EGLSurface;
+import android.opengl.GLES11Ext;
+import android.opengl.GLES20;
+import android.opengl.GLES30;
+import android.os.Handler;
+import android.os.HandlerThread;
+import android.util.Log;
+import android.view.Surface;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.FloatBuffer;
+import java.util.concurrent.CountDownLatch;
+
+import usb.PipelineStats;
+
+/**
+ * Side by side stereo rendering for phone-in-headset viewers. The decoder renders once into a texture, and each frame
+ * is drawn for both eyes, letterboxed in its half of the view, by a single full screen draw. Lens distortion can be
+ * compensated in the fragment shader by a radial barrel distortion.
+ *
+ * Rendering happens on its own GL thread as frames are decoded, and each one is presented at the vsync it was
+ * released for (see {@link VsyncFrameScheduler}) through {@code eglPresentationTimeANDROID}. The GPU time of the pass
+ * is measured with timer queries where {@code GL_EXT_disjoint_timer_query} is available, and shown in the stats
+ * overlay.
+ */
+public class StereoRenderer implements SurfaceTexture.OnFrameAvailableListener {
+    private static final String TAG = "DIGIVIEW";
+    // Radial distortion coefficients of common cardboard-style headset lenses.
+    private static final float DISTORTION_K1 = 0.22f;
+    private static final float DISTORTION_K2 = 0.24f;
+    private static final int DEFAULT_VIDEO_WIDTH = 1280;
+    private static final int DEFAULT_VIDEO_HEIGHT = 720;
+
+    private static final int EGL_OPENGL_ES3_BIT_KHR = 0x40;
+    private static final int GL_TIME_ELAPSED_EXT = 0x88BF;
+    private static final int GL_GPU_DISJOINT_EXT = 0x8FBB;
+
+    private static final String VERTEX_SHADER =
+            "attribute vec2 aPosition;\n" +
+            "varying vec2 vScreen;\n" +
+            "void main() {\n" +
+            "    vScreen = aPosition * 0.5 + 0.5;\n" +
+            "    gl_Position = vec4(aPosition, 0.0, 1.0);\n" +
+            "}\n";
+
+    // Maps each half of the view to eye coordinates in [-1, 1], distorts them and letterboxes the video in the eye.
+    private static final String FRAGMENT_SHADER =
+            "#extension GL_OES_EGL_image_external : require\n" +
+            "precision mediump float;\n" +
+            "uniform samplerExternalOES uTexture;\n" +
+            "uniform mat4 uTexMatrix;\n" +
+            "uniform vec2 uVideoScale;\n" +
+            "uniform vec2 uDistortion;\n" +
+            "varying vec2 vScreen;\n" +
+            "void main() {\n" +
+            "    float eye = step(0.5, vScreen.x);\n" +
+            "    vec2 p = vec2(vScreen.x * 2.0 - eye, vScreen.y) * 2.0 - 1.0;\n" +
+            "    float r2 = dot(p, p);\n" +
+            "    p *= 1.0 + uDistortion.x * r2 + uDistortion.y * r2 * r2;\n" +
+            "    vec2 uv = p / uVideoScale * 0.5 + 0.5;\n" +
+            "    if (uv.x < 0.0 || uv.x > 1.0 || uv.y < 0.0 || uv.y > 1.0) {\n" +
+            "        gl_FragColor = vec4(0.0, 0.0, 0.0, 1.0);\n" +
+            "    } else {\n" +
+            "        gl_FragColor = texture2D(uTexture, (uTexMatrix * vec4(uv, 0.0, 1.0)).xy);\n" +
+            "    }\n" +
+            "}\n";
+
+    private static final float[] QUAD = {-1, -1, 1, -1, -1, 1, 1, 1};
+
+    private final SurfaceTexture outputTexture;
+    private final boolean distortion;
+    private HandlerThread thread;
+    private Handler handler;
+    private volatile int outputWidth;
+    private volatile int outputHeight;
+    private volatile int videoWidth = DEFAULT_VIDEO_WIDTH;
+    private volatile int videoHeight = DEFAULT_VIDEO_HEIGHT;
+
+    // GL thread only.
+    private EGLDisplay eglDisplay = EGL14.EGL_NO_DISPLAY;
+    private EGLContext eglContext = EGL14.EGL_NO_CONTEXT;
+    private EGLSurface eglSurface = EGL14.EGL_NO_SURFACE;
+    private int program;
+    private int textureId;
+    private int positionLocation;
+    private int texMatrixLocation;
+    private int videoScaleLocation;
+    private int distortionLocation;
+    private final FloatBuffer quad = ByteBuffer.allocateDirect(QUAD.length * 4).order(ByteOrder.nativeOrder()).asFloatBuffer();
+    private final float[] texMatrix = new float[16];
+    private SurfaceTexture inputTexture;
+    private Surface inputSurface;
+    private boolean timerQueries;
+    private final int[] queries = new int[2];
+    private final boolean[] queryPending = new boolean[2];
+    private final int[] queryResult = new int[1];
+    private int frameCount;
+
+    /**
+     * @param output Texture of the view to render to.
+     * @param distortion Whether to compensate the headset lens distortion.
+     */
+    StereoRenderer(SurfaceTexture output, int width, int height, boolean distortion) {
+        outputTexture = output;
+        outputWidth = width;
+        outputHeight = height;
+        this.distortion = distortion;
+        quad.put(QUAD).position(0);
+    }
+
+    /**
+     * Starts the GL thread.
+     *
+     * @return The surface the decoder should render to, or null if GL could not be set up.
+     */
+    public Surface start() {
+        thread = new HandlerThread("StereoRender", PipelineThreads.RENDER_PRIORITY);
+        thread.start();
+        handler = new Handler(thread.getLooper());
+        CountDownLatch started = new CountDownLatch(1);
+        handler.post(() -> {
+            try {
+                setUp();
+            } catch (RuntimeException e) {
+                Log.e(TAG, "STEREO - unable to set up rendering: " + e.getMessage());
+                tearDown();
+            }
+            started.countDown();
+        });
+        try {
+            started.await();
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+        }
+        if (inputSurface == null) {
+            release();
+            return null;
+        }
+        return inputSurface;
+    }
+
+    public void release() {
+        if (thread == null) return;
+        handler.post(this::tearDown);
+        thread.quitSafely();
+        try {
+            thread.join();
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+        }
+        thread = null;
+        handler = null;
+    }
+
+    public void setOutputSize(int width, int height) {
+        outputWidth = width;
+        outputHeight = height;
+    }
+
+    public void setVideoSize(int width, int height) {
+        if (width <= 0 || height <= 0) return;
+        videoWidth = width;
+        videoHeight = height;
+    }
+
+    private void setUp() {
+        eglDisplay = EGL14.eglGetDisplay(EGL14.EGL_DEFAULT_DISPLAY);
+        int[] version = new int[2];
+        if (!EGL14.eglInitialize(eglDisplay, version, 0, version, 1)) {
+            throw new RuntimeException("eglInitialize failed");
+        }
+        // GLES 3 for the timer queries, GLES 2 is enough to render.
+        boolean gles3 = createContext(3);
+        if (!gles3 && !createContext(2)) {
+            throw new RuntimeException("eglCreateContext failed");
+        }
+        EGLConfig config = chooseConfig(gles3 ? 3 : 2);
+        eglSurface = EGL14.eglCreateWindowSurface(eglDisplay, config, outputTexture, new int[]{EGL14.EGL_NONE}, 0);
+        if (eglSurface == EGL14.EGL_NO_SURFACE || !EGL14.eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext)) {
+            throw new RuntimeException("eglCreateWindowSurface failed: " + EGL14.eglGetError());
+        }
+        EGL14.eglSwapInterval(eglDisplay, 1);
+
+        program = createProgram();
+        positionLocation = GLES20.glGetAttribLocation(program, "aPosition");
+        texMatrixLocation = GLES20.glGetUniformLocation(program, "uTexMatrix");
+        videoScaleLocation = GLES20.glGetUniformLocation(program, "uVideoScale");
+        distortionLocation = GLES20.glGetUniformLocation(program, "uDistortion");
+
+        int[] textures = new int[1];
+        GLES20.glGenTextures(1, textures, 0);
+        textureId = textures[0];
+        GLES20.glBindTexture(GLES11Ext.GL_TEXTURE_EXTERNAL_OES, textureId);
+        GLES20.glTexParameteri(GLES11Ext.GL_TEXTURE_EXTERNAL_OES, GLES20.GL_TEXTURE_MIN_FILTER, GLES20.GL_LINEAR);
+        GLES20.glTexParameteri(GLES11Ext.GL_TEXTURE_EXTERNAL_OES, GLES20.GL_TEXTURE_MAG_FILTER, GLES20.GL_LINEAR);
+        GLES20.glTexParameteri(GLES11Ext.GL_TEXTURE_EXTERNAL_OES, GLES20.GL_TEXTURE_WRAP_S, GLES20.GL_CLAMP_TO_EDGE);
+        GLES20.glTexParameteri(GLES11Ext.GL_TEXTURE_EXTERNAL_OES, GLES20.GL_TEXTURE_WRAP_T, GLES20.GL_CLAMP_TO_EDGE);
+
+        String extensions = GLES20.glGetString(GLES20.GL_EXTENSIONS);
+        timerQueries = gles3 && extensions != null && extensions.contains("GL_EXT_disjoint_timer_query");
+        if (timerQueries) {
+            GLES30.glGenQueries(queries.length, queries, 0);
+        } else {
+            Log.d(TAG, "STEREO - GPU timer queries not available, GPU time won't be measured");
+        }
+
+        inputTexture = new SurfaceTexture(textureId);
+        inputTexture.setOnFrameAvailableListener(this, handler);
+        inputSurface = new Surface(inputTexture);
+        Log.d(TAG, "STEREO - rendering " + outputWidth + "x" + outputHeight + (distortion ? " with" : " without") + " lens distortion, GLES " + (gles3 ? 3 : 2));
+    }
+
+    private boolean createContext(int glesVersion) {
+        EGLConfig config = chooseConfig(glesVersion);
+        if (config == null) return false;
+        eglContext = EGL14.eglCreateContext(eglDisplay, config, EGL14.EGL_NO_CONTEXT, new int[]{EGL14.EGL_CONTEXT_CLIENT_VERSION, glesVersion, EGL14.EGL_NONE}, 0);
+        return eglContext != null && eglContext != EGL14.EGL_NO_CONTEXT;
+    }
+
+    private EGLConfig chooseConfig(int glesVersion) {
+        int renderableType = glesVersion >= 3 ? EGL_OPENGL_ES3_BIT_KHR : EGL14.EGL_OPENGL_ES2_BIT;
+        int[] attributes = {
+                EGL14.EGL_RED_SIZE, 8,
+                EGL14.EGL_GREEN_SIZE, 8,
+                EGL14.EGL_BLUE_SIZE, 8,
+                EGL14.EGL_RENDERABLE_TYPE, renderableType,
+                EGL14.EGL_NONE
+        };
+        EGLConfig[] configs = new EGLConfig[1];
+        int[] count = new int[1];
+        if (!EGL14.eglChooseConfig(eglDisplay, attributes, 0, configs, 0, 1, count, 0) || count[0] == 0) return null;
+        return configs[0];
+    }
+
+    private int createProgram() {
+        int vertexShader = compileShader(GLES20.GL_VERTEX_SHADER, VERTEX_SHADER);
+        int fragmentShader = compileShader(GLES20.GL_FRAGMENT_SHADER, FRAGMENT_SHADER);
+        int glProgram = GLES20.glCreateProgram();
+        GLES20.glAttachShader(glProgram, vertexShader);
+        GLES20.glAttachShader(glProgram, fragmentShader);
+        GLES20.glLinkProgram(glProgram);
+        GLES20.glDeleteShader(vertexShader);
+        GLES20.glDeleteShader(fragmentShader);
+        int[] status = new int[1];
+        GLES20.glGetProgramiv(glProgram, GLES20.GL_LINK_STATUS, status, 0);
+        if (status[0] != GLES20.GL_TRUE) {
+            String log = GLES20.glGetProgramInfoLog(glProgram);
+            GLES20.glDeleteProgram(glProgram);
+            throw new RuntimeException("program link failed: " + log);
+        }
+        return glProgram;
+    }
+
+    private static int compileShader(int type, String source) {
+        int shader = GLES20.glCreateShader(type);
+        GLES20.glShaderSource(shader, source);
+        GLES20.glCompileShader(shader);
+        int[] status = new int[1];
+        GLES20.glGetShaderiv(shader, GLES20.GL_COMPILE_STATUS, status, 0);
+        if (status[0] != GLES20.GL_TRUE) {
+            String log = GLES20.glGetShaderInfoLog(shader);
+            GLES20.glDeleteShader(shader);
+            throw new RuntimeException("shader compile failed: " + log);
+        }
+        return shader;
+    }
+
+    @Override
+    public void onFrameAvailable(SurfaceTexture surfaceTexture) {
+        if (inputTexture == null) return;
+        try {
+            inputTexture.updateTexImage();
+        } catch (RuntimeException e) {
+            Log.e(TAG, "STEREO - unable to update the video texture: " + e.getMessage());
+            return;
+        }
+        inputTexture.getTransformMatrix(texMatrix);
+        draw();
+        // The texture timestamp is the release time the decoder asked for, the vsync the frame is meant for.
+        long timestampNs = inputTexture.getTimestamp();
+        if (timestampNs > 0) {
+            EGLExt.eglPresentationTimeANDROID(eglDisplay, eglSurface, timestampNs);
+        }
+        EGL14.eglSwapBuffers(eglDisplay, eglSurface);
+    }
+
+    private void draw() {
+        int query = frameCount++ & 1;
+        if (timerQueries) {
+            GLES30.glBeginQuery(GL_TIME_ELAPSED_EXT, queries[query]);
+        }
+
+        int width = outputWidth;
+        int height = outputHeight;
+        GLES20.glViewport(0, 0, width, height);
+        GLES20.glUseProgram(program);
+        GLES20.glActiveTexture(GLES20.GL_TEXTURE0);
+        GLES20.glBindTexture(GLES11Ext.GL_TEXTURE_EXTERNAL_OES, textureId);
+        GLES20.glUniformMatrix4fv(texMatrixLocation, 1, false, texMatrix, 0);
+
+        // Fits the video in an eye, half of the view.
+        float eyeAspect = width / 2f / Math.max(1, height);
+        float videoAspect = (float) videoWidth / videoHeight;
+        if (videoAspect > eyeAspect) {
+            GLES20.glUniform2f(videoScaleLocation, 1, eyeAspect / videoAspect);
+        } else {
+            GLES20.glUniform2f(videoScaleLocation, videoAspect / eyeAspect, 1);
+        }
+        GLES20.glUniform2f(distortionLocation, distortion ? DISTORTION_K1 : 0, distortion ? DISTORTION_K2 : 0);
+
+        GLES20.glEnableVertexAttribArray(positionLocation);
+        GLES20.glVertexAttribPointer(positionLocation, 2, GLES20.GL_FLOAT, false, 0, quad);
+        GLES20.glDrawArrays(GLES20.GL_TRIANGLE_STRIP, 0, 4);
+        GLES20.glDisableVertexAttribArray(positionLocation);
+
+        if (timerQueries) {
+            GLES30.glEndQuery(GL_TIME_ELAPSED_EXT);
+            queryPending[query] = true;
+            readQuery(query ^ 1);
+        }
+    }
+
+    /**
+     * Reads the previous pass' GPU time if it is ready, without waiting for it.
+     */
+    private void readQuery(int query) {
+        if (!queryPending[query]) return;
+        queryPending[query] = false;
+        GLES30.glGetQueryObjectuiv(queries[query], GLES30.GL_QUERY_RESULT_AVAILABLE, queryResult, 0);
+        if (queryResult[0] == GLES20.GL_FALSE) return;
+        GLES30.glGetQueryObjectuiv(queries[query], GLES30.GL_QUERY_RESULT, queryResult, 0);
+        long elapsedNs = queryResult[0] & 0xFFFFFFFFL;
+        // A disjoint operation, e.g. a GPU frequency change, invalidates the measurement.
+        int[] disjoint = new int[1];
+        GLES20.glGetIntegerv(GL_GPU_DISJOINT_EXT, disjoint, 0);
+        if (disjoint[0] == 0) {
+            PipelineStats.getInstance().onStereoPass(elapsedNs);
+        }
+    }
+
+    private void tearDown() {
+        if (inputSurface != null) {
+            inputSurface.release();
+            inputSurface = null;
+        }
+        if (inputTexture != null) {
+            inputTexture.release();
+            inputTexture = null;
+        }
+        if (eglDisplay != EGL14.EGL_NO_DISPLAY) {
+            if (eglContext != EGL14.EGL_NO_CONTEXT && eglSurface != EGL14.EGL_NO_SURFACE) {
+                if (timerQueries) {
+                    GLES30.glDeleteQueries(queries.length, queries, 0);
+                }
+                if (textureId != 0) {
+                    GLES20.glDeleteTextures(1, new int[]{textureId}, 0);
+                }
+                if (program != 0) {
+                    GLES20.glDeleteProgram(program);
+                }
+            }
+            EGL14.eglMakeCurrent(eglDisplay, EGL14.EGL_NO_SURFACE, EGL14.EGL_NO_SURFACE, EGL14.EGL_NO_CONTEXT);
+            if (eglSurface != EGL14.EGL_NO_SURFACE) {
+                EGL14.eglDestroySurface(eglDisplay, eglSurface);
+            }
+            if (eglContext != EGL14.EGL_NO_CONTEXT) {
+                EGL14.eglDestroyContext(eglDisplay, eglContext);
+            }
+            EGL14.eglReleaseThread();
+            EGL14.eglTerminate(eglDisplay);
+        }
+        eglDisplay = EGL14.EGL_NO_DISPLAY;
+        eglContext = EGL14.EGL_NO_CONTEXT;
+        eglSurface = EGL14.EGL_NO_SURFACE;
+        textureId = 0;
+        program = 0;
+        timerQueries = false;
+    }
+}
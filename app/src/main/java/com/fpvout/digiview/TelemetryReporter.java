@@ -0,0 +1,217 @@
+package com.fpvout.digiview;
+
+import android.content.Context;
+import android.content.SharedPreferences;
+import android.os.Build;
+import android.os.Handler;
+import android.os.HandlerThread;
+import android.os.SystemClock;
+import android.util.Base64;
+import android.util.Log;
+
+import androidx.preference.PreferenceManager;
+
+import org.json.JSONArray;
+import org.json.JSONException;
+import org.json.JSONObject;
+
+import java.io.ByteArrayOutputStream;
+import java.io.IOException;
+import java.nio.charset.StandardCharsets;
+import java.util.Collections;
+import java.util.zip.GZIPOutputStream;
+
+import io.sentry.Sentry;
+import io.sentry.SentryEvent;
+import io.sentry.SentryLevel;
+import io.sentry.protocol.Message;
+import usb.LatencyHistogram;
+import usb.PipelineStats;
+import usb.SizeHistogram;
+
+/**
+ * Sends summaries of the pipeline's performance, for comparing presets across devices, once the data collection
+ * agreement mentioning them was accepted, see {@link DataCollectionAgreementPopupActivity}.
+ *
+ * Every minute with video, the counters of {@link PipelineStats} are summed up over the minute: preset, USB throughput
+ * and transfer sizes, latency percentiles of each stage, dropped frames and thermal status. Sampling only reads the
+ * counters the pipeline keeps anyway, off the frame path. Summaries are batched, gzipped, and sent as one Sentry event
+ * every ten minutes and when the session ends, Sentry caches it until it can be sent.
+ */
+public class TelemetryReporter {
+    private static final String TAG = "DIGIVIEW";
+    private static final long SUMMARY_INTERVAL_MS = 60_000;
+    private static final int SUMMARIES_PER_BATCH = 10;
+    private static final double[] PERCENTILES = {50, 90, 99};
+
+    private final SharedPreferences sharedPreferences;
+    private final VideoPipeline videoPipeline;
+    private final PipelineStats stats = PipelineStats.getInstance();
+    private final long[][] histogramStarts = new long[PipelineStats.Stage.values().length][LatencyHistogram.BUCKET_COUNT];
+    private final long[] transferSizeStart = new long[SizeHistogram.BUCKET_COUNT];
+    private final long[] transferSizeCounts = new long[SizeHistogram.BUCKET_COUNT];
+    private final Runnable summaryRunnable = this::summarize;
+    private HandlerThread thread;
+    private Handler handler;
+    private JSONArray batch = new JSONArray();
+    private long windowStartMs;
+    private long receivedBytesStart;
+    private long transferCountStart;
+    private long renderedFramesStart;
+    private long droppedFramesStart;
+    private long skippedFramesStart;
+    private long concealedFramesStart;
+    private long reconnectCountStart;
+
+    TelemetryReporter(Context context, VideoPipeline pipeline) {
+        sharedPreferences = PreferenceManager.getDefaultSharedPreferences(context);
+        videoPipeline = pipeline;
+    }
+
+    public void start() {
+        if (thread != null || !isAccepted()) return;
+        thread = new HandlerThread("Telemetry", PipelineThreads.BACKGROUND_PRIORITY);
+        thread.start();
+        handler = new Handler(thread.getLooper());
+        handler.post(this::startWindow);
+        handler.postDelayed(summaryRunnable, SUMMARY_INTERVAL_MS);
+    }
+
+    /**
+     * Ends the session: the current minute is summed up and everything not sent yet is sent.
+     */
+    public void stop() {
+        if (thread == null) return;
+        handler.removeCallbacks(summaryRunnable);
+        handler.post(() -> {
+            addSummary();
+            send();
+        });
+        thread.quitSafely();
+        thread = null;
+        handler = null;
+    }
+
+    /**
+     * Whether the agreement mentioning the summaries was accepted, and data collection wasn't turned off since.
+     */
+    private boolean isAccepted() {
+        return sharedPreferences.getBoolean(DataCollectionAgreementPopupActivity.TelemetryAccepted, false)
+                && sharedPreferences.getBoolean("dataCollectionAccepted", false);
+    }
+
+    private void summarize() {
+        addSummary();
+        if (batch.length() >= SUMMARIES_PER_BATCH) send();
+        handler.postDelayed(summaryRunnable, SUMMARY_INTERVAL_MS);
+    }
+
+    private void startWindow() {
+        windowStartMs = SystemClock.elapsedRealtime();
+        receivedBytesStart = stats.getReceivedBytes();
+        transferCountStart = stats.getTransferCount();
+        renderedFramesStart = stats.getRenderedFrames();
+        droppedFramesStart = stats.getDroppedFrames();
+        skippedFramesStart = stats.getSkippedFrames();
+        concealedFramesStart = stats.getConcealedFrames();
+        reconnectCountStart = stats.getReconnectCount();
+        for (PipelineStats.Stage stage : PipelineStats.Stage.values()) {
+            stats.getHistogram(stage).copyCounts(histogramStarts[stage.ordinal()]);
+        }
+        stats.getTransferSizes().copyCounts(transferSizeStart);
+    }
+
+    /**
+     * Sums up the window since {@link #startWindow()}, unless no video came in, and starts the next one.
+     */
+    private void addSummary() {
+        long durationMs = SystemClock.elapsedRealtime() - windowStartMs;
+        long receivedBytes = stats.getReceivedBytes() - receivedBytesStart;
+        if (receivedBytes > 0 && durationMs > 0) {
+            try {
+                batch.put(getSummary(durationMs, receivedBytes));
+            } catch (JSONException e) {
+                Log.e(TAG, "TELEMETRY - " + e.getMessage());
+            }
+        }
+        startWindow();
+    }
+
+    private JSONObject getSummary(long durationMs, long receivedBytes) throws JSONException {
+        JSONObject summary = new JSONObject();
+        summary.put("durationMs", durationMs);
+        summary.put("preset", videoPipeline.getPreset().toString());
+        summary.put("usbKbps", receivedBytes * 8 / durationMs);
+        summary.put("usbTransfers", stats.getTransferCount() - transferCountStart);
+
+        // Counts per power of two bucket, keyed by the smallest size in it.
+        stats.getTransferSizes().copyCounts(transferSizeCounts);
+        JSONObject transferSizes = new JSONObject();
+        for (int i = 0; i < SizeHistogram.BUCKET_COUNT; i++) {
+            long count = transferSizeCounts[i] - transferSizeStart[i];
+            if (count > 0) transferSizes.put(String.valueOf(SizeHistogram.getBucketMinBytes(i)), count);
+        }
+        summary.put("transferSizes", transferSizes);
+
+        JSONObject latencies = new JSONObject();
+        for (PipelineStats.Stage stage : PipelineStats.Stage.values()) {
+            LatencyHistogram histogram = stats.getHistogram(stage);
+            long[] since = histogramStarts[stage.ordinal()];
+            if (histogram.getPercentileMs(PERCENTILES[0], since) < 0) continue;
+            JSONArray percentiles = new JSONArray();
+            for (double percentile : PERCENTILES) {
+                percentiles.put(histogram.getPercentileMs(percentile, since));
+            }
+            latencies.put(stage.name().toLowerCase(), percentiles);
+        }
+        summary.put("latencyMsP50P90P99", latencies);
+
+        summary.put("renderedFrames", stats.getRenderedFrames() - renderedFramesStart);
+        summary.put("droppedFrames", stats.getDroppedFrames() - droppedFramesStart);
+        summary.put("skippedFrames", stats.getSkippedFrames() - skippedFramesStart);
+        summary.put("concealedFrames", stats.getConcealedFrames() - concealedFramesStart);
+        summary.put("reconnections", stats.getReconnectCount() - reconnectCountStart);
+        summary.put("thermal", PerformanceMode.getThermalStatusName(stats.getThermalStatus()));
+        return summary;
+    }
+
+    private void send() {
+        if (batch.length() == 0) return;
+        JSONArray summaries = batch;
+        batch = new JSONArray();
+        // Consent may have been withdrawn since the start of the session.
+        if (!isAccepted()) return;
+
+        PerformancePreset preset = videoPipeline.getPreset();
+        SentryEvent event = new SentryEvent();
+        Message message = new Message();
+        message.setMessage("performance summary");
+        event.setMessage(message);
+        event.setLevel(SentryLevel.INFO);
+        event.setFingerprints(Collections.singletonList("performance-summary"));
+        event.setTag("engine", preset.videoEngineType.name());
+        event.setTag("dataSource", preset.dataSourceType.name());
+        event.setTag("usbTransferSize", String.valueOf(preset.usbTransferSize));
+        event.setTag("soc", Build.HARDWARE);
+        event.setExtra("summaryCount", summaries.length());
+        try {
+            event.setExtra("summaries", compress(summaries.toString()));
+        } catch (IOException e) {
+            Log.e(TAG, "TELEMETRY - " + e.getMessage());
+            return;
+        }
+        Sentry.captureEvent(event);
+        Log.d(TAG, "TELEMETRY - sent " + summaries.length() + " summaries");
+    }
+
+    /**
+     * Returns the gzipped text, in base 64.
+     */
+    private static String compress(String text) throws IOException {
+        ByteArrayOutputStream bytes = new ByteArrayOutputStream();
+        try (GZIPOutputStream gzip = new GZIPOutputStream(bytes)) {
+            gzip.write(text.getBytes(StandardCharsets.UTF_8));
+        }
+        return Base64.encodeToString(bytes.toByteArray(), Base64.NO_WRAP);
+    }
+}
@@ -1,28 +1,102 @@
 package com.fpvout.digiview;
 
+import android.content.ComponentCallbacks2;
 import android.hardware.usb.UsbDevice;
 import android.hardware.usb.UsbDeviceConnection;
 import android.hardware.usb.UsbInterface;
+import android.os.Build;
+import android.os.Handler;
+import android.os.HandlerThread;
+import android.util.Log;
 
 import java.io.IOException;
+import java.io.InputStream;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.locks.LockSupport;
 
+import usb.AndroidUSBAsyncInputStream;
 import usb.AndroidUSBInputStream;
 import usb.AndroidUSBOutputStream;
+import usb.BroadcastRingBuffer;
+import usb.ByteArrayPool;
+import usb.NativeUSBInputStream;
 
 public class UsbMaskConnection {
+    private static final String TAG = "DIGIVIEW";
+    // Control channel timings: liveness is checked every heartbeat, the magic packet is sent again once no data arrived
+    // for the stall timeout, retrying with a doubling backoff.
+    private static final long HEARTBEAT_INTERVAL_MS = 100;
+    private static final long STALL_TIMEOUT_NS = TimeUnit.MILLISECONDS.toNanos(300);
+    private static final long MAGIC_PACKET_MIN_BACKOFF_NS = TimeUnit.MILLISECONDS.toNanos(200);
+    private static final long MAGIC_PACKET_MAX_BACKOFF_NS = TimeUnit.MILLISECONDS.toNanos(2000);
+    // Capture ring shared by the live view, the DVR and the restreamer, sized like the data source rings for this
+    // latency: about a second at the goggles' top bitrate, half that while memory is low.
+    private static final int CAPTURE_LATENCY_MS = 500;
+    // Past this lag the restreamer skips to live data, so spectators stay within a few frames of the pilot.
+    private static final int RESTREAM_MAX_LAG_BYTES = 1024 * 1024;
+    private static final int REPLAY_TRANSFER_SIZE = 131072;
+    private static final long CAPTURE_IDLE_WAIT_NS = TimeUnit.MILLISECONDS.toNanos(1);
+    private static final long CAPTURE_ERROR_BACKOFF_NS = TimeUnit.MILLISECONDS.toNanos(100);
 
     private final byte[] magicPacket = "RMVT".getBytes();
     private UsbDeviceConnection usbConnection;
     private UsbDevice device;
     private UsbInterface usbInterface;
-    AndroidUSBInputStream mInputStream;
-    AndroidUSBOutputStream mOutputStream;
+    // Handed to the video engines for the lifetime of the connection, across stalls and replugs.
+    private final ReconnectingInputStream reconnectingStream = new ReconnectingInputStream();
+    InputStream mInputStream = reconnectingStream;
+    private InputStream usbInputStream;
+    private UsbReads usbReads;
+    private int usbTransferSize;
+    // A single capture thread reads the goggles into the ring; each consumer reads it through its own cursor, so a
+    // slow recorder or network never holds back the capture or the live view.
+    private BroadcastRingBuffer captureBuffer;
+    private Thread captureThread;
+    private volatile boolean capturing;
+    // Last capture of data from the goggles, whether or not a video engine is reading it meanwhile.
+    private volatile long lastCaptureNs;
+    private final BitstreamAnalyzer bitstreamAnalyzer = new BitstreamAnalyzer();
+    private DvrRecorder dvrRecorder;
+    private RtpStreamer rtpStreamer;
+    volatile AndroidUSBOutputStream mOutputStream;
     private boolean ready = false;
 
+    // Sends the magic packet off the read path, so a dropout never blocks the stream on the 2 s write timeout.
+    private HandlerThread controlThread;
+    private volatile Handler controlHandler;
+    private long magicPacketBackoffNs;
+    private long nextMagicPacketNs;
+    private final Runnable heartbeat = this::heartbeat;
+
     public UsbMaskConnection() {
     }
 
+    /**
+     * Records the stream of the next connections with the given recorder, or stops recording if null.
+     */
+    public void setDvrRecorder(DvrRecorder recorder) {
+        dvrRecorder = recorder;
+    }
+
+    /**
+     * Restreams the next connections with the given streamer, or stops restreaming if null.
+     */
+    public void setRtpStreamer(RtpStreamer streamer) {
+        rtpStreamer = streamer;
+    }
+
+    /**
+     * Listens to stalls and resumptions of the stream.
+     */
+    public void setStreamListener(ReconnectingInputStream.Listener listener) {
+        reconnectingStream.setListener(listener);
+    }
+
     public void setUsbDevice(UsbDeviceConnection c, UsbDevice d) {
+        setUsbDevice(c, d, PerformancePreset.getPreset(PerformancePreset.PresetType.DEFAULT));
+    }
+
+    public void setUsbDevice(UsbDeviceConnection c, UsbDevice d, PerformancePreset performancePreset) {
         usbConnection = c;
         device = d;
         usbInterface = device.getInterface(3);
@@ -30,29 +104,256 @@ public class UsbMaskConnection {
         usbConnection.claimInterface(usbInterface,true);
 
         mOutputStream = new AndroidUSBOutputStream(usbInterface.getEndpoint(0), usbConnection);
-        mInputStream = new AndroidUSBInputStream(usbInterface.getEndpoint(1), usbInterface.getEndpoint(0), usbConnection);
+        prepareCaptureBuffer(performancePreset.usbTransferSize);
+        openInputStream(performancePreset);
+        if (dvrRecorder != null)
+            dvrRecorder.start(captureBuffer.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_OLDEST, captureBuffer.getCapacity()));
+        if (rtpStreamer != null)
+            rtpStreamer.start(captureBuffer.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_NEWEST, RESTREAM_MAX_LAG_BYTES));
         ready = true;
+        startControl();
+    }
+
+    /**
+     * Switches to the USB reads of the given preset, sync, async or native and their transfer size, on the open device.
+     * The stream handed to the video engines stays the same; nothing changes while replaying.
+     */
+    public void applyPreset(PerformancePreset performancePreset) {
+        if (usbConnection == null) return;
+        UsbReads reads = getUsbReads(performancePreset);
+        if (reads == usbReads && performancePreset.usbTransferSize == usbTransferSize) return;
+        Log.d(TAG, "switching USB reads to " + reads.name().toLowerCase() + " " + performancePreset.usbTransferSize + " byte transfers");
+        stopCapture();
+        releaseInputStream();
+        openInputStream(performancePreset);
+    }
+
+    private enum UsbReads {SYNC, ASYNC, NATIVE}
+
+    /**
+     * Returns the reads the preset asks for, or the closest ones this device can do: native reads fall back to async
+     * ones without the native library, async ones to sync ones before Android O.
+     */
+    private static UsbReads getUsbReads(PerformancePreset performancePreset) {
+        if (performancePreset.dataSourceType == PerformancePreset.DataSourceType.NATIVE_INPUT_STREAM && NativeUSBInputStream.isAvailable())
+            return UsbReads.NATIVE;
+        if ((performancePreset.dataSourceType == PerformancePreset.DataSourceType.ASYNC_INPUT_STREAM || performancePreset.dataSourceType == PerformancePreset.DataSourceType.NATIVE_INPUT_STREAM) && Build.VERSION.SDK_INT >= Build.VERSION_CODES.O)
+            return UsbReads.ASYNC;
+        return UsbReads.SYNC;
     }
 
+    private void openInputStream(PerformancePreset performancePreset) {
+        usbReads = getUsbReads(performancePreset);
+        usbTransferSize = performancePreset.usbTransferSize;
+        switch (usbReads) {
+            case NATIVE:
+                usbInputStream = new NativeUSBInputStream(usbInterface.getEndpoint(1), usbConnection, NativeUSBInputStream.DEFAULT_REQUEST_COUNT, usbTransferSize);
+                break;
+            case ASYNC:
+                usbInputStream = new AndroidUSBAsyncInputStream(usbInterface.getEndpoint(1), usbConnection, AndroidUSBAsyncInputStream.DEFAULT_REQUEST_COUNT, usbTransferSize);
+                break;
+            case SYNC:
+            default:
+                usbInputStream = new AndroidUSBInputStream(usbInterface.getEndpoint(1), usbConnection, usbTransferSize);
+                break;
+        }
+        startCapture(usbInputStream, usbTransferSize);
+    }
+
+    private void releaseInputStream() {
+        try {
+            if (usbInputStream instanceof AndroidUSBAsyncInputStream)
+                ((AndroidUSBAsyncInputStream) usbInputStream).release();
+            else if (usbInputStream instanceof NativeUSBInputStream)
+                ((NativeUSBInputStream) usbInputStream).release();
+            else if (usbInputStream instanceof ReplayInputStream)
+                ((ReplayInputStream) usbInputStream).release();
+            else if (usbInputStream != null)
+                usbInputStream.close();
+        } catch (IOException e) {
+            e.printStackTrace();
+        }
+        usbInputStream = null;
+        usbReads = null;
+    }
+
+    /**
+     * Serves the given stream, e.g. a {@link ReplayInputStream}, in place of the goggles.
+     */
+    public void setReplayStream(InputStream stream) {
+        usbConnection = null;
+        mOutputStream = null;
+        usbInputStream = stream;
+        prepareCaptureBuffer(REPLAY_TRANSFER_SIZE);
+        startCapture(stream, REPLAY_TRANSFER_SIZE);
+        ready = true;
+    }
+
+    /**
+     * Sizes the capture ring for the next connection with {@link InputStreamBufferedDataSource#getBufferSize}, keeping
+     * the current one if it has that capacity already.
+     */
+    private void prepareCaptureBuffer(int transferSize) {
+        int size = InputStreamBufferedDataSource.getBufferSize(transferSize, 0, CAPTURE_LATENCY_MS);
+        if (captureBuffer != null && captureBuffer.getCapacity() >= size && captureBuffer.getCapacity() / 2 < size) return;
+        // The previous ring isn't released to the pool: the video engine may still be finishing a read from it.
+        captureBuffer = new BroadcastRingBuffer(ByteArrayPool.getInstance().acquire(size));
+    }
+
+    /**
+     * Follows {@link ComponentCallbacks2#onTrimMemory(int)} like {@link InputStreamBufferedDataSource#onTrimMemory}: the
+     * capture ring is dropped while nothing is captured, the next connection sizes it again.
+     */
+    public void onTrimMemory(int level) {
+        if (level >= ComponentCallbacks2.TRIM_MEMORY_RUNNING_LOW && captureThread == null) {
+            captureBuffer = null;
+        }
+    }
+
+    private void startCapture(InputStream stream, int transferSize) {
+        stopCapture();
+        BroadcastRingBuffer ring = captureBuffer;
+        // The live view only skips data it lost, which it never should as it is read as fast as it arrives.
+        reconnectingStream.setSource(ring.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_NEWEST, ring.getCapacity()));
+        capturing = true;
+        bitstreamAnalyzer.start(ring.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_NEWEST, BitstreamAnalyzer.MAX_LAG_BYTES));
+        captureThread = PipelineThreads.newThread("UsbCapture", PipelineThreads.USB_IO_PRIORITY, () -> capture(stream, ring, transferSize));
+        captureThread.start();
+    }
+
+    private void stopCapture() {
+        if (captureThread == null) return;
+        capturing = false;
+        try {
+            captureThread.join();
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+        }
+        captureThread = null;
+        bitstreamAnalyzer.stop();
+    }
+
+    private void capture(InputStream stream, BroadcastRingBuffer ring, int transferSize) {
+        // Native transfers go from their URB slot to the ring, the other streams through this buffer.
+        NativeUSBInputStream nativeStream = stream instanceof NativeUSBInputStream ? (NativeUSBInputStream) stream : null;
+        byte[] buffer = nativeStream == null ? ByteArrayPool.getInstance().acquire(transferSize) : null;
+        try {
+            while (capturing) {
+                try {
+                    int readBytes;
+                    if (nativeStream != null) {
+                        readBytes = nativeStream.transferTo(ring);
+                        if (readBytes > 0)
+                            lastCaptureNs = System.nanoTime();
+                    } else {
+                        readBytes = stream.read(buffer, 0, transferSize);
+                        if (readBytes > 0) {
+                            long now = System.nanoTime();
+                            lastCaptureNs = now;
+                            ring.write(buffer, 0, readBytes, now);
+                        }
+                    }
+                    if (readBytes < 0) {
+                        // A failed bulk transfer or the end of a replay, which may return at once.
+                        LockSupport.parkNanos(CAPTURE_IDLE_WAIT_NS);
+                    }
+                } catch (IOException e) {
+                    // Rewinds the stream, as a data source restart used to, and lets the stall handling take over.
+                    Log.e(TAG, "capture failed: " + e.getMessage());
+                    try {
+                        stream.close();
+                    } catch (IOException closeError) {
+                        // Retried on the next failure, the capture goes on until stopped.
+                        Log.e(TAG, "capture rewind failed: " + closeError.getMessage());
+                    }
+                    LockSupport.parkNanos(CAPTURE_ERROR_BACKOFF_NS);
+                }
+            }
+        } finally {
+            ByteArrayPool.getInstance().release(buffer);
+        }
+    }
+
+    /**
+     * Asks the goggles to start streaming now, rather than at the next stall check.
+     */
     public void start(){
-        mOutputStream.write(magicPacket);
+        Handler handler = controlHandler;
+        if (handler != null)
+            handler.post(() -> sendMagicPacket(System.nanoTime()));
+    }
+
+    private void startControl() {
+        if (controlThread != null) return;
+        controlThread = new HandlerThread("UsbControl", PipelineThreads.CONTROL_PRIORITY);
+        controlThread.start();
+        controlHandler = new Handler(controlThread.getLooper());
+        magicPacketBackoffNs = 0;
+        nextMagicPacketNs = 0;
+        lastCaptureNs = System.nanoTime();
+        controlHandler.post(heartbeat);
+    }
+
+    private void stopControl() {
+        if (controlThread == null) return;
+        controlHandler.removeCallbacksAndMessages(null);
+        controlThread.quitSafely();
+        controlThread = null;
+        controlHandler = null;
+    }
+
+    private void heartbeat() {
+        long now = System.nanoTime();
+        // Based on the capture, the engines stop reading while the settings show or while they restart.
+        if (now - lastCaptureNs < STALL_TIMEOUT_NS) {
+            magicPacketBackoffNs = 0;
+        } else if (now >= nextMagicPacketNs) {
+            sendMagicPacket(now);
+        }
+        Handler handler = controlHandler;
+        if (handler != null)
+            handler.postDelayed(heartbeat, HEARTBEAT_INTERVAL_MS);
+    }
+
+    private void sendMagicPacket(long now) {
+        AndroidUSBOutputStream outputStream = mOutputStream;
+        if (outputStream == null) return;
+        magicPacketBackoffNs = magicPacketBackoffNs == 0 ? MAGIC_PACKET_MIN_BACKOFF_NS : Math.min(magicPacketBackoffNs * 2, MAGIC_PACKET_MAX_BACKOFF_NS);
+        nextMagicPacketNs = now + magicPacketBackoffNs;
+        Log.d(TAG, "no video data, sending magic packet, next retry in " + TimeUnit.NANOSECONDS.toMillis(magicPacketBackoffNs) + "ms");
+        outputStream.write(magicPacket);
     }
 
     public void stop() {
         ready = false;
-        try {
-            if (mInputStream != null)
-                mInputStream.close();
+        detach();
+    }
 
+    /**
+     * Releases the USB device, e.g. when it is unplugged, while the stream handed to the video engines stays open so
+     * they keep their decoder until the next {@link #setUsbDevice}.
+     */
+    public void detach() {
+        stopControl();
+        reconnectingStream.setSource(null);
+        stopCapture();
+        if (dvrRecorder != null)
+            dvrRecorder.stop();
+        if (rtpStreamer != null)
+            rtpStreamer.stop();
+        releaseInputStream();
+        try {
             if (mOutputStream != null)
                 mOutputStream.close();
         } catch (IOException e) {
             e.printStackTrace();
         }
+        mOutputStream = null;
 
         if (usbConnection != null) {
             usbConnection.releaseInterface(usbInterface);
             usbConnection.close();
+            usbConnection = null;
         }
     }
 
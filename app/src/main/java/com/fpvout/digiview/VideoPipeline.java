@@ -0,0 +1,238 @@
+package com.fpvout.digiview;
+
+import android.content.Context;
+import android.content.SharedPreferences;
+import android.os.Handler;
+import android.os.Looper;
+import android.os.Message;
+import android.util.Log;
+
+import androidx.preference.PreferenceManager;
+
+import usb.PipelineStats;
+
+/**
+ * Runs the video engine of the current preset on the connection's stream, and everything around it: zoom, restarts,
+ * reconnections and the events telling {@link MainActivity} what to show.
+ *
+ * Engines and presets are switched in place with {@link #setPreset(PerformancePreset)}: the engine is restarted on the
+ * same stream and the USB device stays open, so engines can be compared back to back on the same flight.
+ */
+public class VideoPipeline {
+    private static final String TAG = "DIGIVIEW";
+    private static final long RESTART_DELAY_MS = 1000;
+    static final String VideoPreset = "VideoPreset";
+    static final String VideoZoomedIn = "VideoZoomedIn";
+    static final String ErrorConcealment = "ErrorConcealment";
+
+    private final Handler videoReaderEventListener;
+    private final VideoTextureView videoView;
+    private UsbMaskConnection mUsbMaskConnection;
+    private boolean zoomedIn;
+    private volatile PerformancePreset performancePreset = PerformancePreset.getPreset(PerformancePreset.PresetType.DEFAULT);
+    private final SharedPreferences sharedPreferences;
+    private final VideoReader exoPlayerReader;
+    private final VideoReader mediaCodecReader;
+    private VideoReader activeReader;
+    // The engines live on the main looper, restarts are posted there but deduplicated and cancelled on stop.
+    private final Handler restartHandler = new Handler(Looper.getMainLooper());
+    private final Runnable restartRunnable = this::restart;
+    private boolean running;
+    private volatile boolean streamStalled;
+    private volatile boolean awaitingFrameAfterReconnect;
+
+    // Keeps the decoder across stalls, the connection asks the goggles to stream again meanwhile. The first frame after
+    // data flows again is measured.
+    private final ReconnectingInputStream.Listener streamListener = new ReconnectingInputStream.Listener() {
+        @Override
+        public void onStall() {
+            if (!streamStalled) {
+                streamStalled = true;
+                Log.d(TAG, "stream stalled, waiting for reconnection");
+                sendEvent(VideoReaderEventMessageCode.WAITING_FOR_VIDEO);
+            }
+        }
+
+        @Override
+        public void onResume() {
+            streamStalled = false;
+            awaitingFrameAfterReconnect = true;
+            VideoReader reader = activeReader;
+            if (reader != null) reader.expectFirstFrame();
+        }
+    };
+
+    private final VideoReader.Listener readerListener = new VideoReader.Listener() {
+        @Override
+        public void onRenderedFirstFrame() {
+            StartupTimer.mark(StartupTimer.Phase.FIRST_FRAME);
+            if (awaitingFrameAfterReconnect) {
+                awaitingFrameAfterReconnect = false;
+                logReconnection();
+            }
+            sendEvent(VideoReaderEventMessageCode.VIDEO_PLAYING); // let MainActivity know so it can hide watermark/show settings button
+        }
+
+        @Override
+        public void onVideoSizeChanged(int width, int height) {
+            videoView.setVideoSize(width, height);
+        }
+
+        @Override
+        public void onStreamEnded() {
+            sendEvent(VideoReaderEventMessageCode.WAITING_FOR_VIDEO); // let MainActivity know so it can hide watermark/show settings button
+            scheduleRestart();
+        }
+    };
+
+    // Called from the extractor or the decoder feed thread, see ErrorConcealer.
+    private final ErrorConcealer.Listener concealmentListener = concealing -> {
+        Log.d(TAG, concealing ? "video loss, holding the last frame" : "video recovered");
+        sendEvent(concealing ? VideoReaderEventMessageCode.VIDEO_CONCEALING : VideoReaderEventMessageCode.VIDEO_RECOVERED);
+    };
+
+    VideoPipeline(VideoTextureView view, Context c, Handler v) {
+        videoView = view;
+        videoReaderEventListener = v;
+        sharedPreferences = PreferenceManager.getDefaultSharedPreferences(c);
+        exoPlayerReader = new VideoReaderExoplayer(view, c, readerListener);
+        mediaCodecReader = new VideoReaderMediaCodec(view, readerListener);
+    }
+
+    public void setUsbMaskConnection(UsbMaskConnection connection) {
+        mUsbMaskConnection = connection;
+        mUsbMaskConnection.setStreamListener(streamListener);
+    }
+
+    public void start() {
+        start(PerformancePreset.getPreset(sharedPreferences));
+    }
+
+    public void start(PerformancePreset preset) {
+        zoomedIn = sharedPreferences.getBoolean(VideoZoomedIn, true);
+        videoView.setZoomedIn(zoomedIn, false);
+        performancePreset = preset;
+        running = true;
+        streamStalled = false;
+        awaitingFrameAfterReconnect = false;
+        startReader();
+    }
+
+    /**
+     * Switches to the given preset, and its engine, in place: the running engine is stopped and the new one started on
+     * the same stream, and the connection switches its USB reads on the open device.
+     */
+    public void setPreset(PerformancePreset preset) {
+        if (!running) {
+            performancePreset = preset;
+            return;
+        }
+        Log.d(TAG, "switching preset in place");
+        restartHandler.removeCallbacks(restartRunnable);
+        stopReader();
+        performancePreset = preset;
+        mUsbMaskConnection.applyPreset(preset);
+        startReader();
+    }
+
+    private void startReader() {
+        Log.d(TAG, "preset: " + performancePreset);
+        ErrorConcealer.Listener concealment = sharedPreferences.getBoolean(ErrorConcealment, false) ? concealmentListener : null;
+        activeReader = performancePreset.videoEngineType == PerformancePreset.VideoEngineType.MEDIA_CODEC ? mediaCodecReader : exoPlayerReader;
+        activeReader.start(mUsbMaskConnection.mInputStream, performancePreset, concealment);
+    }
+
+    private void stopReader() {
+        if (activeReader != null) {
+            activeReader.stop();
+            activeReader = null;
+        }
+        PerformanceHints.closeSessions();
+    }
+
+    private void sendEvent(VideoReaderEventMessageCode eventCode) {
+        if (videoReaderEventListener != null) { // let MainActivity know so it can hide watermark/show settings button
+            Message videoReaderEventMessage = new Message();
+            videoReaderEventMessage.obj = eventCode;
+            videoReaderEventListener.sendMessage(videoReaderEventMessage);
+        }
+    }
+
+    public void toggleZoom() {
+        zoomedIn = !zoomedIn;
+
+        SharedPreferences.Editor preferencesEditor = sharedPreferences.edit();
+        preferencesEditor.putBoolean(VideoZoomedIn, zoomedIn);
+        preferencesEditor.apply();
+
+        videoView.setZoomedIn(zoomedIn, true);
+    }
+
+    /**
+     * Zooms continuously while pinching, without persisting anything until {@link #endScale()}.
+     */
+    public void scaleBy(float factor, float focusX, float focusY) {
+        videoView.scaleBy(factor, focusX, focusY);
+    }
+
+    /**
+     * Settles the zoom at the end of a pinch and persists whether it ended zoomed in.
+     */
+    public void endScale() {
+        if (videoView.endScale() == zoomedIn) return;
+        zoomedIn = !zoomedIn;
+
+        SharedPreferences.Editor preferencesEditor = sharedPreferences.edit();
+        preferencesEditor.putBoolean(VideoZoomedIn, zoomedIn);
+        preferencesEditor.apply();
+    }
+
+    public void zoomIn() {
+        if (!zoomedIn) {
+            toggleZoom();
+        }
+    }
+
+    public void zoomOut() {
+        if (zoomedIn) {
+            toggleZoom();
+        }
+    }
+
+    public void restart() {
+        stopReader();
+
+        if (mUsbMaskConnection.isReady()) {
+            mUsbMaskConnection.start();
+            start(performancePreset);
+        } else {
+            running = false;
+        }
+    }
+
+    public PerformancePreset getPreset() {
+        return performancePreset;
+    }
+
+    public boolean isRunning() {
+        return running;
+    }
+
+    public void stop() {
+        running = false;
+        restartHandler.removeCallbacks(restartRunnable);
+        stopReader();
+    }
+
+    private void logReconnection() {
+        PipelineStats stats = PipelineStats.getInstance();
+        Log.d(TAG, "reconnected - first frame " + stats.getLastReconnectFirstFrameMs() + "ms after data resumed, blind for " + stats.getLastReconnectBlindMs() + "ms");
+    }
+
+    private void scheduleRestart() {
+        restartHandler.removeCallbacks(restartRunnable);
+        restartHandler.postDelayed(restartRunnable, RESTART_DELAY_MS);
+    }
+
+    public enum VideoReaderEventMessageCode {WAITING_FOR_VIDEO, VIDEO_PLAYING, VIDEO_CONCEALING, VIDEO_RECOVERED}
+}
@@ -0,0 +1,41 @@
+package com.fpvout.digiview;
+
+import java.io.InputStream;
+
+/**
+ * A video engine, decoding the goggles' stream and rendering it to the video view.
+ *
+ * Engines bind to the view's surface themselves and may be started before it exists. Each run reads the stream it is
+ * given until stopped, so engines and presets can be switched in place on the same stream, see {@link VideoPipeline}.
+ */
+public interface VideoReader {
+    interface Listener {
+        /**
+         * Called on the main thread when the first frame is rendered, or the first since {@link #expectFirstFrame()}.
+         */
+        void onRenderedFirstFrame();
+
+        /**
+         * Called on the main thread with the displayed size of the video, as soon as it is known.
+         */
+        void onVideoSizeChanged(int width, int height);
+
+        /**
+         * Called on the main thread when the engine can't go on with the stream and needs a restart.
+         */
+        void onStreamEnded();
+    }
+
+    /**
+     * @param concealmentListener Told when a loss is concealed, see {@link ErrorConcealer}, or null to decode
+     *                            everything.
+     */
+    void start(InputStream stream, PerformancePreset preset, ErrorConcealer.Listener concealmentListener);
+
+    /**
+     * Reports the next rendered frame through {@link Listener#onRenderedFirstFrame()} again, e.g. after a reconnection.
+     */
+    void expectFirstFrame();
+
+    void stop();
+}
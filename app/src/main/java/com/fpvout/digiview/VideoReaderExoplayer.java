@@ -1,25 +1,20 @@
 package com.fpvout.digiview;
 
 import android.content.Context;
-import android.content.SharedPreferences;
 import android.net.Uri;
 import android.os.Handler;
 import android.os.Looper;
-import android.os.Message;
 import android.util.Log;
-import android.view.SurfaceView;
-
-import androidx.constraintlayout.widget.ConstraintLayout;
-import androidx.preference.PreferenceManager;
+import android.view.Surface;
 
 import com.google.android.exoplayer2.C;
 import com.google.android.exoplayer2.DefaultLoadControl;
 import com.google.android.exoplayer2.ExoPlaybackException;
 import com.google.android.exoplayer2.ExoPlayer;
-import com.google.android.exoplayer2.Format;
 import com.google.android.exoplayer2.MediaItem;
 import com.google.android.exoplayer2.Player;
 import com.google.android.exoplayer2.SimpleExoPlayer;
+import com.google.android.exoplayer2.analytics.AnalyticsListener;
 import com.google.android.exoplayer2.extractor.Extractor;
 import com.google.android.exoplayer2.extractor.ExtractorsFactory;
 import com.google.android.exoplayer2.source.MediaSource;
@@ -29,178 +24,166 @@ import com.google.android.exoplayer2.upstream.DataSpec;
 import com.google.android.exoplayer2.util.NonNullApi;
 import com.google.android.exoplayer2.video.VideoListener;
 
-import usb.AndroidUSBInputStream;
+import java.io.InputStream;
+
+import usb.PipelineStats;
 
-public class VideoReaderExoplayer {
+/**
+ * Video engine playing the stream through ExoPlayer, with the {@link H264Extractor} and the data source of the preset.
+ */
+public class VideoReaderExoplayer implements VideoReader {
     private static final String TAG = "DIGIVIEW";
-    private Handler videoReaderEventListener;
     private SimpleExoPlayer mPlayer;
-    static final String VideoPreset = "VideoPreset";
-    private final SurfaceView surfaceView;
-    private AndroidUSBInputStream inputStream;
-        private UsbMaskConnection mUsbMaskConnection;
-    private boolean zoomedIn;
+    private final VideoTextureView videoView;
     private final Context context;
+    private final Listener listener;
+    private final Handler mainHandler = new Handler(Looper.getMainLooper());
     private PerformancePreset performancePreset = PerformancePreset.getPreset(PerformancePreset.PresetType.DEFAULT);
-    static final String VideoZoomedIn = "VideoZoomedIn";
-    private final SharedPreferences sharedPreferences;
-
-    VideoReaderExoplayer(SurfaceView videoSurface, Context c) {
-        surfaceView = videoSurface;
-        context = c;
-        sharedPreferences = PreferenceManager.getDefaultSharedPreferences(c);
-    }
+    private AdaptiveLatencyController adaptiveLatencyController;
+    private volatile boolean firstFrameExpected;
+
+    // The player renders to the view's surface, which may only be created after the player.
+    private final VideoTextureView.SurfaceListener surfaceListener = new VideoTextureView.SurfaceListener() {
+        @Override
+        public void onSurfaceAvailable(Surface surface) {
+            if (mPlayer != null) mPlayer.setVideoSurface(surface);
+        }
 
-    VideoReaderExoplayer(SurfaceView videoSurface, Context c, Handler v) {
-        this(videoSurface, c);
-        videoReaderEventListener = v;
-    }
+        @Override
+        public void onSurfaceDestroyed(Surface surface) {
+            if (mPlayer != null) mPlayer.clearVideoSurface(surface);
+        }
+    };
 
-    public void setUsbMaskConnection(UsbMaskConnection connection) {
-        mUsbMaskConnection = connection;
-        inputStream = mUsbMaskConnection.mInputStream;
+    VideoReaderExoplayer(VideoTextureView view, Context c, Listener l) {
+        videoView = view;
+        context = c;
+        listener = l;
     }
 
-    public void start() {
-        zoomedIn = sharedPreferences.getBoolean(VideoZoomedIn, true);
-        performancePreset = PerformancePreset.getPreset(sharedPreferences.getString(VideoPreset, "default"));
-
-            DefaultLoadControl loadControl = new DefaultLoadControl.Builder().setBufferDurationsMs(performancePreset.exoPlayerMinBufferMs, performancePreset.exoPlayerMaxBufferMs, performancePreset.exoPlayerBufferForPlaybackMs, performancePreset.exoPlayerBufferForPlaybackAfterRebufferMs).build();
-            mPlayer = new SimpleExoPlayer.Builder(context).setLoadControl(loadControl).build();
-            mPlayer.setVideoSurfaceView(surfaceView);
-            mPlayer.setVideoScalingMode(C.VIDEO_SCALING_MODE_SCALE_TO_FIT_WITH_CROPPING);
-            mPlayer.setWakeMode(C.WAKE_MODE_LOCAL);
-
-            DataSpec dataSpec = new DataSpec(Uri.EMPTY, 0, C.LENGTH_UNSET);
-
-            Log.d(TAG, "preset: " + performancePreset);
-
-            DataSource.Factory dataSourceFactory = () -> {
-                switch (performancePreset.dataSourceType){
-                    case INPUT_STREAM:
-                        return (DataSource) new InputStreamDataSource(context, dataSpec, inputStream);
-                    case BUFFERED_INPUT_STREAM:
-                    default:
-                        return (DataSource) new InputStreamBufferedDataSource(context, dataSpec, inputStream);
-                }
-            };
-
-            ExtractorsFactory extractorsFactory = () ->new Extractor[] {new H264Extractor(performancePreset.h264ReaderMaxSyncFrameSize, performancePreset.h264ReaderSampleTime)};
-            MediaSource mediaSource = new ProgressiveMediaSource.Factory(dataSourceFactory, extractorsFactory).createMediaSource(MediaItem.fromUri(Uri.EMPTY));
-            mPlayer.setMediaSource(mediaSource);
-
-            mPlayer.prepare();
-            mPlayer.play();
-            mPlayer.addListener(new ExoPlayer.EventListener() {
-                @Override
-                @NonNullApi
-                public void onPlayerError(ExoPlaybackException error) {
-                    switch (error.type) {
-                        case ExoPlaybackException.TYPE_SOURCE:
-                            Log.e(TAG, "PLAYER_SOURCE - TYPE_SOURCE: " + error.getSourceException().getMessage());
-                            (new Handler(Looper.getMainLooper())).postDelayed(() -> restart(), 1000);
-                            break;
-                        case ExoPlaybackException.TYPE_REMOTE:
-                            Log.e(TAG, "PLAYER_SOURCE - TYPE_REMOTE: " + error.getSourceException().getMessage());
-                            break;
-                        case ExoPlaybackException.TYPE_RENDERER:
-                            Log.e(TAG, "PLAYER_SOURCE - TYPE_RENDERER: " + error.getSourceException().getMessage());
-                            break;
-                        case ExoPlaybackException.TYPE_UNEXPECTED:
-                            Log.e(TAG, "PLAYER_SOURCE - TYPE_UNEXPECTED: " + error.getSourceException().getMessage());
-                            break;
-                    }
-                }
+    @Override
+    public void start(InputStream inputStream, PerformancePreset preset, ErrorConcealer.Listener concealment) {
+        if (mPlayer != null) return;
+        performancePreset = preset;
+        firstFrameExpected = false;
+        PipelineStats.getInstance().resetTimeline();
+
+        DefaultLoadControl loadControl = new DefaultLoadControl.Builder().setBufferDurationsMs(performancePreset.exoPlayerMinBufferMs, performancePreset.exoPlayerMaxBufferMs, performancePreset.exoPlayerBufferForPlaybackMs, performancePreset.exoPlayerBufferForPlaybackAfterRebufferMs).build();
+        mPlayer = new SimpleExoPlayer.Builder(context).setLoadControl(loadControl).build();
+        mPlayer.setVideoSurface(videoView.getSurface());
+        videoView.addSurfaceListener(surfaceListener);
+        mPlayer.setVideoScalingMode(C.VIDEO_SCALING_MODE_SCALE_TO_FIT_WITH_CROPPING);
+        mPlayer.setWakeMode(C.WAKE_MODE_LOCAL);
+
+        DataSpec dataSpec = new DataSpec(Uri.EMPTY, 0, C.LENGTH_UNSET);
+
+        DataSource.Factory dataSourceFactory = () -> {
+            switch (performancePreset.dataSourceType){
+                case INPUT_STREAM:
+                case ASYNC_INPUT_STREAM:
+                case NATIVE_INPUT_STREAM:
+                    return (DataSource) new InputStreamDataSource(context, dataSpec, inputStream);
+                case BUFFERED_INPUT_STREAM:
+                default:
+                    return (DataSource) new InputStreamBufferedDataSource(context, dataSpec, inputStream, performancePreset.usbTransferSize, performancePreset.catchUpThresholdBytes, performancePreset.bufferLatencyMs);
+            }
+        };
 
-                @Override
-                public void onPlaybackStateChanged(@NonNullApi int state) {
-                    switch (state) {
-                        case Player.STATE_IDLE:
-                        case Player.STATE_READY:
-                        case Player.STATE_BUFFERING:
-                            break;
-                        case Player.STATE_ENDED:
-                            Log.d(TAG, "PLAYER_STATE - ENDED");
-                            sendEvent(VideoReaderEventMessageCode.WAITING_FOR_VIDEO); // let MainActivity know so it can hide watermark/show settings button
-                            (new Handler(Looper.getMainLooper())).postDelayed(() -> restart(), 1000);
-                            break;
-                    }
-                }
-            });
+        ExtractorsFactory extractorsFactory = () ->new Extractor[] {new H264Extractor(0, performancePreset.h264ReaderMaxSyncFrameSize, performancePreset.h264ReaderSampleTime, performancePreset.h264ReaderAccessUnitMode, concealment)};
+        MediaSource mediaSource = new ProgressiveMediaSource.Factory(dataSourceFactory, extractorsFactory).createMediaSource(MediaItem.fromUri(Uri.EMPTY));
+        mPlayer.setMediaSource(mediaSource);
 
-            mPlayer.addVideoListener(new VideoListener() {
-                @Override
-                public void onRenderedFirstFrame() {
-                    Log.d(TAG, "PLAYER_RENDER - FIRST FRAME");
-                    sendEvent(VideoReaderEventMessageCode.VIDEO_PLAYING); // let MainActivity know so it can hide watermark/show settings button
+        mPlayer.prepare();
+        mPlayer.play();
+        if (performancePreset.adaptiveLatency) {
+            adaptiveLatencyController = new AdaptiveLatencyController(mPlayer, performancePreset);
+            adaptiveLatencyController.start();
+        }
+        mPlayer.addListener(new ExoPlayer.EventListener() {
+            @Override
+            @NonNullApi
+            public void onPlayerError(ExoPlaybackException error) {
+                switch (error.type) {
+                    case ExoPlaybackException.TYPE_SOURCE:
+                        Log.e(TAG, "PLAYER_SOURCE - TYPE_SOURCE: " + error.getSourceException().getMessage());
+                        listener.onStreamEnded();
+                        break;
+                    case ExoPlaybackException.TYPE_REMOTE:
+                        Log.e(TAG, "PLAYER_SOURCE - TYPE_REMOTE: " + error.getSourceException().getMessage());
+                        break;
+                    case ExoPlaybackException.TYPE_RENDERER:
+                        Log.e(TAG, "PLAYER_SOURCE - TYPE_RENDERER: " + error.getSourceException().getMessage());
+                        break;
+                    case ExoPlaybackException.TYPE_UNEXPECTED:
+                        Log.e(TAG, "PLAYER_SOURCE - TYPE_UNEXPECTED: " + error.getSourceException().getMessage());
+                        break;
                 }
+            }
 
-                @Override
-                public void onVideoSizeChanged(int width, int height, int unappliedRotationDegrees, float pixelWidthHeightRatio) {
-                    if (!zoomedIn) {
-                        ConstraintLayout.LayoutParams params = (ConstraintLayout.LayoutParams) surfaceView.getLayoutParams();
-                        params.dimensionRatio = width + ":" + height;
-                        surfaceView.setLayoutParams(params);
-                    }
+            @Override
+            public void onPlaybackStateChanged(@NonNullApi int state) {
+                switch (state) {
+                    case Player.STATE_IDLE:
+                    case Player.STATE_READY:
+                    case Player.STATE_BUFFERING:
+                        break;
+                    case Player.STATE_ENDED:
+                        Log.d(TAG, "PLAYER_STATE - ENDED");
+                        listener.onStreamEnded();
+                        break;
                 }
-            });
-    }
-
-    private void sendEvent(VideoReaderEventMessageCode eventCode) {
-        if (videoReaderEventListener != null) { // let MainActivity know so it can hide watermark/show settings button
-            Message videoReaderEventMessage = new Message();
-            videoReaderEventMessage.obj = eventCode;
-            videoReaderEventListener.sendMessage(videoReaderEventMessage);
-        }
-    }
-
-    public void toggleZoom() {
-        zoomedIn = !zoomedIn;
-
-        SharedPreferences.Editor preferencesEditor = sharedPreferences.edit();
-        preferencesEditor.putBoolean(VideoZoomedIn, zoomedIn);
-        preferencesEditor.apply();
-
-        ConstraintLayout.LayoutParams params = (ConstraintLayout.LayoutParams) surfaceView.getLayoutParams();
-
-            if (zoomedIn) {
-                params.dimensionRatio = "";
-            } else {
-                if (mPlayer == null) return;
-                Format videoFormat = mPlayer.getVideoFormat();
-                if (videoFormat == null) return;
-
-                params.dimensionRatio = videoFormat.width + ":" + videoFormat.height;
             }
+        });
 
-            surfaceView.setLayoutParams(params);
-        }
-
-        public void zoomIn() {
-            if (!zoomedIn) {
-                toggleZoom();
+        mPlayer.setVideoFrameMetadataListener((presentationTimeUs, releaseTimeNs, format, mediaFormat) -> {
+            PipelineStats.getInstance().onFrameRendered(presentationTimeUs, releaseTimeNs);
+            if (firstFrameExpected) {
+                firstFrameExpected = false;
+                mainHandler.post(listener::onRenderedFirstFrame);
             }
-        }
-
-        public void zoomOut() {
-            if (zoomedIn) {
-                toggleZoom();
+        });
+        mPlayer.addAnalyticsListener(new AnalyticsListener() {
+            @Override
+            public void onDroppedVideoFrames(EventTime eventTime, int droppedFrames, long elapsedMs) {
+                PipelineStats.getInstance().onFramesDropped(droppedFrames);
             }
-        }
 
-        public void restart() {
-            mPlayer.release();
+            @Override
+            public void onVideoDecoderInitialized(EventTime eventTime, String decoderName, long initializationDurationMs) {
+                StartupTimer.mark(StartupTimer.Phase.DECODER_CONFIGURED);
+            }
+        });
+
+        mPlayer.addVideoListener(new VideoListener() {
+            @Override
+            public void onRenderedFirstFrame() {
+                Log.d(TAG, "PLAYER_RENDER - FIRST FRAME");
+                firstFrameExpected = false;
+                listener.onRenderedFirstFrame();
+            }
 
-            if (mUsbMaskConnection.isReady()) {
-                mUsbMaskConnection.start();
-                start();
+            @Override
+            public void onVideoSizeChanged(int width, int height, int unappliedRotationDegrees, float pixelWidthHeightRatio) {
+                listener.onVideoSizeChanged(Math.round(width * pixelWidthHeightRatio), height);
             }
-        }
+        });
+    }
 
+    @Override
+    public void expectFirstFrame() {
+        firstFrameExpected = true;
+    }
+
+    @Override
     public void stop() {
-        if (mPlayer != null)
+        if (adaptiveLatencyController != null) {
+            adaptiveLatencyController.stop();
+            adaptiveLatencyController = null;
+        }
+        videoView.removeSurfaceListener(surfaceListener);
+        if (mPlayer != null) {
             mPlayer.release();
+            mPlayer = null;
+        }
     }
-
-    public enum VideoReaderEventMessageCode {WAITING_FOR_VIDEO, VIDEO_PLAYING}
 }
@@ -0,0 +1,385 @@
+package com.fpvout.digiview;
+
+import android.media.MediaCodec;
+import android.media.MediaCodecInfo;
+import android.media.MediaFormat;
+import android.os.Build;
+import android.os.Handler;
+import android.os.Looper;
+import android.util.Log;
+import android.view.Surface;
+
+import com.google.android.exoplayer2.util.MimeTypes;
+
+import java.io.IOException;
+import java.io.InputStream;
+import java.nio.ByteBuffer;
+import java.util.concurrent.ArrayBlockingQueue;
+import java.util.concurrent.TimeUnit;
+
+import usb.ByteArrayPool;
+import usb.PipelineStats;
+
+/**
+ * Low latency video engine feeding access units straight into a {@link MediaCodec} rendering to the video view,
+ * without ExoPlayer's loader, buffering and renderer hops.
+ *
+ * Decoded frames are released for the first display vsync they can make, see {@link VsyncFrameScheduler}; timestamps
+ * follow the measured frame rate rather than the preset sample time.
+ *
+ * The decoder is configured on start with the parameter sets of the last session when there are some, or as soon as
+ * the surface exists, so it is ready by the time the first key frame arrives. Configuring takes tens of milliseconds,
+ * it is always done on the feed thread, never on the main one.
+ */
+public class VideoReaderMediaCodec implements VideoReader {
+    private static final String TAG = "DIGIVIEW";
+    private static final int READ_SIZE = 131072;
+    private static final long INPUT_TIMEOUT_US = 10000;
+    private static final long OUTPUT_TIMEOUT_US = 10000;
+    private static final int CHUNK_COUNT = 8;
+    private static final long CHUNK_WAIT_MS = 100;
+
+    private static final class Chunk {
+        final byte[] data;
+        // -1 at the end of the stream.
+        int length;
+        // Whether data was lost before this chunk, see ReconnectingInputStream#takeDiscontinuity().
+        boolean discontinuity;
+
+        Chunk(byte[] data) {
+            this.data = data;
+        }
+    }
+
+    private final VideoTextureView videoView;
+    private final Listener listener;
+    private final Handler mainHandler = new Handler(Looper.getMainLooper());
+
+    private InputStream inputStream;
+    private PerformancePreset performancePreset;
+    private volatile MediaCodec codec;
+    private final ArrayBlockingQueue<Chunk> filledChunks = new ArrayBlockingQueue<>(CHUNK_COUNT);
+    private final ArrayBlockingQueue<Chunk> freeChunks = new ArrayBlockingQueue<>(CHUNK_COUNT);
+    private Thread usbThread;
+    private Thread feedThread;
+    private Thread outputThread;
+    private volatile boolean working;
+    private volatile boolean firstFrameRendered;
+    private int videoWidth;
+    private int videoHeight;
+
+    private FrameDurationEstimator frameDurationEstimator;
+    private VsyncFrameScheduler vsyncFrameScheduler;
+    private long presentationTimeUs;
+    private volatile H264ParameterSets parameterSets;
+    // Asks the feed thread to configure the decoder ahead of the first key frame.
+    private volatile boolean configurePending;
+    // Feed thread only.
+    private boolean waitingForKeyFrame;
+    private ErrorConcealer errorConcealer;
+    // Kept across starts, the decoder input buffers are sized for it.
+    private int largestAccessUnitSize;
+
+    private final VideoTextureView.SurfaceListener surfaceListener = new VideoTextureView.SurfaceListener() {
+        @Override
+        public void onSurfaceAvailable(Surface surface) {
+            if (working && codec == null && parameterSets != null) {
+                configurePending = true;
+            }
+        }
+
+        @Override
+        public void onSurfaceDestroyed(Surface surface) {
+        }
+    };
+
+    VideoReaderMediaCodec(VideoTextureView view, Listener l) {
+        videoView = view;
+        listener = l;
+    }
+
+    @Override
+    public void start(InputStream stream, PerformancePreset preset, ErrorConcealer.Listener concealmentListener) {
+        if (working) return;
+        inputStream = stream;
+        performancePreset = preset;
+        errorConcealer = concealmentListener != null ? new ErrorConcealer(concealmentListener) : null;
+        frameDurationEstimator = new FrameDurationEstimator();
+        vsyncFrameScheduler = new VsyncFrameScheduler(videoView.getDisplay());
+        vsyncFrameScheduler.start();
+        presentationTimeUs = 0;
+        firstFrameRendered = false;
+        PipelineStats.getInstance().resetTimeline();
+        waitingForKeyFrame = true;
+        parameterSets = ParameterSetCache.get();
+        configurePending = parameterSets != null;
+        working = true;
+        videoView.addSurfaceListener(surfaceListener);
+
+        for (int i = 0; i < CHUNK_COUNT; i++) {
+            freeChunks.add(new Chunk(ByteArrayPool.getInstance().acquire(READ_SIZE)));
+        }
+        // USB reads go on while the decoder input is full, parsing and feeding happen on their own thread.
+        usbThread = PipelineThreads.newThread("MediaCodecUsb", PipelineThreads.USB_IO_PRIORITY, this::receive);
+        feedThread = PipelineThreads.newThread("MediaCodecFeed", PipelineThreads.DECODE_FEED_PRIORITY, this::feed);
+        usbThread.start();
+        feedThread.start();
+    }
+
+    private void receive() {
+        try {
+            // Stalls don't end the stream, the decoder is kept until data flows again (see ReconnectingInputStream).
+            while (working) {
+                Chunk chunk = freeChunks.poll(CHUNK_WAIT_MS, TimeUnit.MILLISECONDS);
+                if (chunk == null) continue; // the feed thread is behind
+                int receivedBytes = inputStream.read(chunk.data, 0, READ_SIZE);
+                chunk.discontinuity = inputStream instanceof ReconnectingInputStream && ((ReconnectingInputStream) inputStream).takeDiscontinuity();
+                if (receivedBytes < 0) {
+                    // Lets the feed thread emit the last access unit.
+                    chunk.length = -1;
+                    filledChunks.offer(chunk);
+                    Log.d(TAG, "MEDIACODEC - stream ended");
+                    notifyStreamEnded();
+                    break;
+                }
+                chunk.length = receivedBytes;
+                filledChunks.offer(chunk);
+            }
+        } catch (IOException e) {
+            Log.e(TAG, "MEDIACODEC - read error: " + e.getMessage());
+            notifyStreamEnded();
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+        }
+    }
+
+    private void feed() {
+        AccessUnitAssembler assembler = new AccessUnitAssembler(performancePreset.h264ReaderMaxSyncFrameSize, this::queueAccessUnit);
+        try {
+            while (working) {
+                if (configurePending) {
+                    configurePending = false;
+                    if (codec == null && parameterSets != null) configureCodec();
+                }
+                Chunk chunk = filledChunks.poll(CHUNK_WAIT_MS, TimeUnit.MILLISECONDS);
+                if (chunk == null) continue;
+                if (chunk.discontinuity) {
+                    // The pending access unit was cut, the stream goes on with a key frame.
+                    assembler.reset();
+                }
+                if (chunk.length > 0) {
+                    PerformanceHints.startWork();
+                    assembler.consume(chunk.data, 0, chunk.length);
+                    PerformanceHints.stopWork();
+                } else if (chunk.length < 0) {
+                    // Only the end of the stream completes the pending access unit, a read may return nothing in the
+                    // middle of one.
+                    assembler.flush();
+                }
+                freeChunks.offer(chunk);
+            }
+        } catch (IllegalStateException e) {
+            Log.e(TAG, "MEDIACODEC - feed error: " + e.getMessage());
+            notifyStreamEnded();
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+        } finally {
+            assembler.release();
+        }
+    }
+
+    private void queueAccessUnit(byte[] data, int length, boolean keyFrame, long arrivalTimeNs) {
+        largestAccessUnitSize = Math.max(largestAccessUnitSize, length);
+        // Parsing this access unit, and queueing the previous one.
+        PerformanceHints.endFrame();
+        // The concealer follows the whole stream, it goes first.
+        if (errorConcealer != null && !errorConcealer.onAccessUnit(data, length, arrivalTimeNs)) return;
+        if (waitingForKeyFrame && !keyFrame) return; // wait for a decodable key frame
+        if (keyFrame) {
+            H264ParameterSets found = H264ParameterSets.extract(data, length);
+            if (found != null) {
+                parameterSets = found;
+                ParameterSetCache.put(found);
+            }
+        }
+        // A decoder configured from cached parameter sets picks up changed ones from the key frame itself.
+        if (codec == null && (parameterSets == null || !configureCodec())) return;
+        waitingForKeyFrame = false;
+
+        frameDurationEstimator.onAccessUnit(arrivalTimeNs);
+        presentationTimeUs += frameDurationEstimator.getFrameDurationUs();
+        vsyncFrameScheduler.setFrameRate(videoView.getSurface(), 1e6f / frameDurationEstimator.getFrameDurationUs());
+        PipelineStats.getInstance().markFrameArrival(presentationTimeUs, arrivalTimeNs);
+        PipelineStats.getInstance().onSampleExtracted(presentationTimeUs);
+
+        int index = -1;
+        // Waiting for decoder input buffers isn't work.
+        PerformanceHints.stopWork();
+        while (working && index < 0) {
+            index = codec.dequeueInputBuffer(INPUT_TIMEOUT_US);
+        }
+        PerformanceHints.startWork();
+        if (index < 0) return;
+        ByteBuffer inputBuffer = codec.getInputBuffer(index);
+        if (inputBuffer == null) return;
+        inputBuffer.clear();
+        if (length > inputBuffer.capacity()) {
+            // Cut off, it would decode corrupted: drop it and resume on the next key frame. A key frame that doesn't
+            // fit restarts the engine, the decoder is configured for it then.
+            codec.queueInputBuffer(index, 0, 0, presentationTimeUs, 0);
+            Log.w(TAG, "MEDIACODEC - dropped a " + length + " byte access unit, input buffers hold " + inputBuffer.capacity());
+            PipelineStats.getInstance().onFramesDropped(1);
+            waitingForKeyFrame = true;
+            if (keyFrame) notifyStreamEnded();
+            return;
+        }
+        inputBuffer.put(data, 0, length);
+        codec.queueInputBuffer(index, 0, length, presentationTimeUs, keyFrame ? MediaCodec.BUFFER_FLAG_KEY_FRAME : 0);
+    }
+
+    private synchronized boolean configureCodec() {
+        if (codec != null) return true;
+        Surface surface = videoView.getSurface();
+        if (surface == null || !surface.isValid()) return false;
+
+        MediaCodec mediaCodec = null;
+        try {
+            videoWidth = parameterSets.width;
+            videoHeight = parameterSets.height;
+            MediaFormat format = parameterSets.createVideoFormat();
+            // Room for the largest access unit seen so far, with a margin as key frames grow with the scene.
+            format.setInteger(MediaFormat.KEY_MAX_INPUT_SIZE, Math.max(performancePreset.h264ReaderMaxSyncFrameSize * 2, largestAccessUnitSize * 3 / 2));
+            if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.M) {
+                format.setInteger(MediaFormat.KEY_PRIORITY, 0); // realtime
+            }
+
+            mediaCodec = MediaCodec.createDecoderByType(MimeTypes.VIDEO_H264);
+            if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.R) {
+                MediaCodecInfo.CodecCapabilities capabilities = mediaCodec.getCodecInfo().getCapabilitiesForType(MimeTypes.VIDEO_H264);
+                if (capabilities.isFeatureSupported(MediaCodecInfo.CodecCapabilities.FEATURE_LowLatency)) {
+                    format.setInteger(MediaFormat.KEY_LOW_LATENCY, 1);
+                }
+            }
+            Log.d(TAG, "MEDIACODEC - configure " + mediaCodec.getName() + " " + format);
+            mediaCodec.configure(format, surface, null, 0);
+            mediaCodec.start();
+            codec = mediaCodec;
+            StartupTimer.mark(StartupTimer.Phase.DECODER_CONFIGURED);
+        } catch (IOException | IllegalStateException | IllegalArgumentException e) {
+            Log.e(TAG, "MEDIACODEC - unable to configure decoder: " + e.getMessage());
+            if (mediaCodec != null) {
+                mediaCodec.release();
+            }
+            return false;
+        }
+
+        int width = videoWidth;
+        int height = videoHeight;
+        mainHandler.post(() -> listener.onVideoSizeChanged(width, height));
+        outputThread = PipelineThreads.newThread("MediaCodecOutput", PipelineThreads.RENDER_PRIORITY, this::drainOutput);
+        outputThread.start();
+        return true;
+    }
+
+    private void drainOutput() {
+        MediaCodec.BufferInfo info = new MediaCodec.BufferInfo();
+        try {
+            while (working) {
+                int index = codec.dequeueOutputBuffer(info, OUTPUT_TIMEOUT_US);
+                if (index >= 0) {
+                    PipelineStats.getInstance().onFrameDecoded(info.presentationTimeUs);
+                    // Present at the first vsync the frame can make, a newer frame for the same vsync replaces it.
+                    long releaseTimeNs = vsyncFrameScheduler.getReleaseTimeNs(System.nanoTime());
+                    codec.releaseOutputBuffer(index, releaseTimeNs);
+                    PipelineStats.getInstance().onFrameRendered(info.presentationTimeUs, releaseTimeNs);
+                    if (!firstFrameRendered) {
+                        firstFrameRendered = true;
+                        Log.d(TAG, "MEDIACODEC - FIRST FRAME");
+                        mainHandler.post(listener::onRenderedFirstFrame);
+                    }
+                } else if (index == MediaCodec.INFO_OUTPUT_FORMAT_CHANGED) {
+                    MediaFormat format = codec.getOutputFormat();
+                    int width = format.getInteger(MediaFormat.KEY_WIDTH);
+                    int height = format.getInteger(MediaFormat.KEY_HEIGHT);
+                    if (format.containsKey("crop-right") && format.containsKey("crop-left")) {
+                        width = format.getInteger("crop-right") - format.getInteger("crop-left") + 1;
+                    }
+                    if (format.containsKey("crop-bottom") && format.containsKey("crop-top")) {
+                        height = format.getInteger("crop-bottom") - format.getInteger("crop-top") + 1;
+                    }
+                    videoWidth = width;
+                    videoHeight = height;
+                    int w = width;
+                    int h = height;
+                    mainHandler.post(() -> listener.onVideoSizeChanged(w, h));
+                }
+            }
+        } catch (IllegalStateException e) {
+            Log.e(TAG, "MEDIACODEC - decoder error: " + e.getMessage());
+            notifyStreamEnded();
+        }
+    }
+
+    private void notifyStreamEnded() {
+        if (working) {
+            mainHandler.post(listener::onStreamEnded);
+        }
+    }
+
+    @Override
+    public void expectFirstFrame() {
+        firstFrameRendered = false;
+    }
+
+    public int getVideoWidth() {
+        return videoWidth;
+    }
+
+    public int getVideoHeight() {
+        return videoHeight;
+    }
+
+    public boolean hasVideoSize() {
+        return videoWidth > 0 && videoHeight > 0;
+    }
+
+    @Override
+    public void stop() {
+        working = false;
+        videoView.removeSurfaceListener(surfaceListener);
+        if (vsyncFrameScheduler != null) {
+            vsyncFrameScheduler.stop();
+        }
+        joinThread(usbThread);
+        joinThread(feedThread);
+        joinThread(outputThread);
+        usbThread = null;
+        feedThread = null;
+        outputThread = null;
+        Chunk chunk;
+        while ((chunk = filledChunks.poll()) != null) {
+            freeChunks.offer(chunk);
+        }
+        while ((chunk = freeChunks.poll()) != null) {
+            ByteArrayPool.getInstance().release(chunk.data);
+        }
+        if (codec != null) {
+            try {
+                codec.stop();
+            } catch (IllegalStateException e) {
+                Log.e(TAG, "MEDIACODEC - stop error: " + e.getMessage());
+            }
+            codec.release();
+            codec = null;
+        }
+    }
+
+    private static void joinThread(Thread thread) {
+        if (thread == null || thread == Thread.currentThread()) return;
+        try {
+            thread.join(500);
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+        }
+    }
+}
@@ -0,0 +1,293 @@
+package com.fpvout.digiview;
+
+import android.animation.ValueAnimator;
+import android.content.Context;
+import android.graphics.Matrix;
+import android.graphics.SurfaceTexture;
+import android.util.AttributeSet;
+import android.util.Log;
+import android.view.Surface;
+import android.view.TextureView;
+
+import androidx.annotation.NonNull;
+
+import java.util.concurrent.CopyOnWriteArrayList;
+
+/**
+ * Full screen view the decoders render to. Aspect ratio, letterboxing, crop and pinch zoom are applied as a transform
+ * of the texture when it is composited, so the view is never laid out again and the decoder surface is never resized:
+ * zooming can follow the fingers continuously without a dropped frame.
+ *
+ * The zoom goes from fit (letterboxed, zoomed out) to fill (cropped, zoomed in) and beyond while pinching, and settles
+ * on fit or fill when the gesture ends.
+ *
+ * In stereo mode the decoders render to a {@link StereoRenderer} instead, which draws each frame for both eyes into
+ * the view; zoom doesn't apply then.
+ */
+public class VideoTextureView extends TextureView implements TextureView.SurfaceTextureListener {
+    private static final String TAG = "DIGIVIEW";
+    private static final long ZOOM_ANIMATION_MS = 150;
+    private static final float MAX_ZOOM_OVER_FILL = 2f;
+
+    public interface SurfaceListener {
+        /**
+         * Called on the main thread when the surface to render to is created.
+         */
+        void onSurfaceAvailable(Surface surface);
+
+        /**
+         * Called on the main thread before the surface is released; rendering to it must have stopped on return.
+         */
+        void onSurfaceDestroyed(Surface surface);
+    }
+
+    private final CopyOnWriteArrayList<SurfaceListener> surfaceListeners = new CopyOnWriteArrayList<>();
+    private final Matrix transform = new Matrix();
+    private SurfaceTexture viewTexture;
+    private volatile Surface surface;
+    private boolean stereo;
+    private boolean stereoDistortion;
+    private StereoRenderer stereoRenderer;
+    private int videoWidth;
+    private int videoHeight;
+    // Zoom relative to the fit scale, 1 being letterboxed; kept between fit and the fill scale times the maximum.
+    private float zoom = 1;
+    private float focusX = 0.5f;
+    private float focusY = 0.5f;
+    private boolean zoomedIn;
+    private ValueAnimator zoomAnimator;
+
+    public VideoTextureView(Context context, AttributeSet attrs) {
+        super(context, attrs);
+        setSurfaceTextureListener(this);
+        setOpaque(true);
+    }
+
+    public void addSurfaceListener(SurfaceListener listener) {
+        surfaceListeners.add(listener);
+    }
+
+    public void removeSurfaceListener(SurfaceListener listener) {
+        surfaceListeners.remove(listener);
+    }
+
+    /**
+     * Returns the surface to render to, or null until it is available. Can be called from any thread.
+     */
+    public Surface getSurface() {
+        return surface;
+    }
+
+    /**
+     * Switches between the regular and the stereo (side by side) rendering. The engines are handed a new surface, so
+     * this is meant to be called while they are stopped.
+     *
+     * @param distortion Whether to compensate the headset lens distortion in stereo mode.
+     */
+    public void setStereoMode(boolean enabled, boolean distortion) {
+        if (enabled == stereo && distortion == stereoDistortion) return;
+        stereo = enabled;
+        stereoDistortion = distortion;
+        if (viewTexture != null) {
+            closeSurface();
+            openSurface(getWidth(), getHeight());
+        }
+    }
+
+    public void setVideoSize(int width, int height) {
+        if (width <= 0 || height <= 0 || (width == videoWidth && height == videoHeight)) return;
+        videoWidth = width;
+        videoHeight = height;
+        if (stereoRenderer != null) stereoRenderer.setVideoSize(width, height);
+        cancelZoomAnimation();
+        zoom = zoomedIn ? getFillZoom() : 1;
+        updateTransform();
+    }
+
+    /**
+     * Settles on fill (cropped) when zoomed in, or on fit (letterboxed), centered.
+     */
+    public void setZoomedIn(boolean zoomedIn, boolean animate) {
+        this.zoomedIn = zoomedIn;
+        animateZoom(zoomedIn ? getFillZoom() : 1, animate);
+    }
+
+    public boolean isZoomedIn() {
+        return zoomedIn;
+    }
+
+    /**
+     * Zooms by the given factor around a point of the view while pinching, see {@link #endScale()}.
+     */
+    public void scaleBy(float factor, float x, float y) {
+        cancelZoomAnimation();
+        float newZoom = Math.max(1, Math.min(zoom * factor, getFillZoom() * MAX_ZOOM_OVER_FILL));
+        if (getWidth() > 0 && getHeight() > 0) {
+            // Keeps the point under the fingers in place: moves the focus, in video coordinates, accordingly.
+            float ratio = 1 - zoom / newZoom;
+            focusX += (x / getWidth() - 0.5f) * ratio / getTextureScaleX(zoom);
+            focusY += (y / getHeight() - 0.5f) * ratio / getTextureScaleY(zoom);
+        }
+        zoom = newZoom;
+        updateTransform();
+    }
+
+    /**
+     * Ends a pinch, settling on fill if zoomed past half way between fit and fill, or on fit.
+     *
+     * @return Whether the view settled zoomed in.
+     */
+    public boolean endScale() {
+        setZoomedIn(zoom >= (1 + getFillZoom()) / 2, true);
+        return zoomedIn;
+    }
+
+    private void animateZoom(float target, boolean animate) {
+        cancelZoomAnimation();
+        if (!animate || !isAttachedToWindow()) {
+            zoom = target;
+            focusX = 0.5f;
+            focusY = 0.5f;
+            updateTransform();
+            return;
+        }
+        float startZoom = zoom;
+        float startFocusX = focusX;
+        float startFocusY = focusY;
+        zoomAnimator = ValueAnimator.ofFloat(0, 1);
+        zoomAnimator.setDuration(ZOOM_ANIMATION_MS);
+        zoomAnimator.addUpdateListener(animation -> {
+            float fraction = (float) animation.getAnimatedValue();
+            zoom = startZoom + (target - startZoom) * fraction;
+            focusX = startFocusX + (0.5f - startFocusX) * fraction;
+            focusY = startFocusY + (0.5f - startFocusY) * fraction;
+            updateTransform();
+        });
+        zoomAnimator.start();
+    }
+
+    private void cancelZoomAnimation() {
+        if (zoomAnimator != null) {
+            zoomAnimator.cancel();
+            zoomAnimator = null;
+        }
+    }
+
+    /**
+     * Returns the zoom, relative to fit, at which the video fills the view.
+     */
+    private float getFillZoom() {
+        if (videoWidth == 0 || videoHeight == 0 || getWidth() == 0 || getHeight() == 0) return 1;
+        float videoAspect = (float) videoWidth / videoHeight;
+        float viewAspect = (float) getWidth() / getHeight();
+        return videoAspect > viewAspect ? videoAspect / viewAspect : viewAspect / videoAspect;
+    }
+
+    /**
+     * Returns the horizontal scale of the texture, which is stretched to the view, at the given zoom.
+     */
+    private float getTextureScaleX(float atZoom) {
+        if (videoWidth == 0 || videoHeight == 0 || getWidth() == 0 || getHeight() == 0) return atZoom;
+        float videoAspect = (float) videoWidth / videoHeight;
+        float viewAspect = (float) getWidth() / getHeight();
+        return atZoom * Math.min(1, videoAspect / viewAspect);
+    }
+
+    private float getTextureScaleY(float atZoom) {
+        if (videoWidth == 0 || videoHeight == 0 || getWidth() == 0 || getHeight() == 0) return atZoom;
+        float videoAspect = (float) videoWidth / videoHeight;
+        float viewAspect = (float) getWidth() / getHeight();
+        return atZoom * Math.min(1, viewAspect / videoAspect);
+    }
+
+    private void updateTransform() {
+        if (stereoRenderer != null) {
+            // The renderer lays out both eyes itself.
+            transform.reset();
+            setTransform(transform);
+            return;
+        }
+        int width = getWidth();
+        int height = getHeight();
+        if (width == 0 || height == 0) return;
+        float scaleX = getTextureScaleX(zoom);
+        float scaleY = getTextureScaleY(zoom);
+        // The focus can't move the video edges inside the view, nor off center while letterboxed.
+        focusX = clampFocus(focusX, scaleX);
+        focusY = clampFocus(focusY, scaleY);
+        transform.setScale(scaleX, scaleY, width / 2f, height / 2f);
+        transform.postTranslate((0.5f - focusX) * scaleX * width, (0.5f - focusY) * scaleY * height);
+        setTransform(transform);
+    }
+
+    private static float clampFocus(float focus, float scale) {
+        if (scale <= 1) return 0.5f;
+        float margin = 0.5f / scale;
+        return Math.max(margin, Math.min(focus, 1 - margin));
+    }
+
+    @Override
+    protected void onSizeChanged(int w, int h, int oldw, int oldh) {
+        super.onSizeChanged(w, h, oldw, oldh);
+        cancelZoomAnimation();
+        zoom = zoomedIn ? getFillZoom() : 1;
+        updateTransform();
+    }
+
+    private void openSurface(int width, int height) {
+        if (stereo) {
+            stereoRenderer = new StereoRenderer(viewTexture, width, height, stereoDistortion);
+            if (videoWidth > 0) stereoRenderer.setVideoSize(videoWidth, videoHeight);
+            surface = stereoRenderer.start();
+            if (surface == null) {
+                Log.e(TAG, "stereo rendering unavailable, falling back to the regular view");
+                stereoRenderer = null;
+            }
+        }
+        if (surface == null) {
+            surface = new Surface(viewTexture);
+        }
+        updateTransform();
+        for (SurfaceListener listener : surfaceListeners) {
+            listener.onSurfaceAvailable(surface);
+        }
+    }
+
+    private void closeSurface() {
+        Surface closed = surface;
+        surface = null;
+        if (closed == null) return;
+        for (SurfaceListener listener : surfaceListeners) {
+            listener.onSurfaceDestroyed(closed);
+        }
+        if (stereoRenderer != null) {
+            // Releases the surface it handed out.
+            stereoRenderer.release();
+            stereoRenderer = null;
+        } else {
+            closed.release();
+        }
+    }
+
+    @Override
+    public void onSurfaceTextureAvailable(@NonNull SurfaceTexture surfaceTexture, int width, int height) {
+        viewTexture = surfaceTexture;
+        openSurface(width, height);
+    }
+
+    @Override
+    public void onSurfaceTextureSizeChanged(@NonNull SurfaceTexture surfaceTexture, int width, int height) {
+        if (stereoRenderer != null) stereoRenderer.setOutputSize(width, height);
+    }
+
+    @Override
+    public boolean onSurfaceTextureDestroyed(@NonNull SurfaceTexture surfaceTexture) {
+        closeSurface();
+        viewTexture = null;
+        return true;
+    }
+
+    @Override
+    public void onSurfaceTextureUpdated(@NonNull SurfaceTexture surfaceTexture) {
+    }
+}
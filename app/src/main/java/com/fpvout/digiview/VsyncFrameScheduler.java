@@ -0,0 +1,117 @@
+package com.fpvout.digiview;
+
+import android.os.Build;
+import android.os.Handler;
+import android.os.HandlerThread;
+import android.util.Log;
+import android.view.Choreographer;
+import android.view.Display;
+import android.view.Surface;
+
+/**
+ * Picks the release time of decoded frames from the display vsync, for {@code MediaCodec.releaseOutputBuffer(index,
+ * renderTimeNs)}: each frame targets the first vsync it can still make. A frame superseded before its vsync is dropped
+ * by the compositor instead of queueing behind it, and frames are presented at even intervals instead of whenever
+ * they happen to be decoded.
+ *
+ * Vsync timestamps come from a {@link Choreographer} running on its own thread. On API 30+ the surface is also told the
+ * stream frame rate, so 90/120 Hz displays can switch to a matching refresh rate.
+ */
+public class VsyncFrameScheduler implements Choreographer.FrameCallback {
+    private static final String TAG = "DIGIVIEW";
+    // Time the compositor needs to latch a buffer before the vsync it is presented at.
+    private static final long LATCH_MARGIN_NS = 4_000_000;
+    private static final long DEFAULT_VSYNC_PERIOD_NS = 16_666_666;
+    private static final int REFRESH_RATE_CHECK_FRAMES = 60;
+    private static final float FRAME_RATE_CHANGE_THRESHOLD = 2f;
+
+    private final Display display;
+    private HandlerThread thread;
+    private Choreographer choreographer;
+    private volatile boolean running;
+    private volatile long lastVsyncNs;
+    private volatile long vsyncPeriodNs = DEFAULT_VSYNC_PERIOD_NS;
+    private int framesSinceRefreshRateCheck;
+    private float surfaceFrameRate;
+
+    /**
+     * @param display Display the frames are shown on, or null to assume 60Hz until vsyncs are received.
+     */
+    VsyncFrameScheduler(Display display) {
+        this.display = display;
+    }
+
+    public void start() {
+        if (running) return;
+        running = true;
+        lastVsyncNs = 0;
+        surfaceFrameRate = 0;
+        updateVsyncPeriod();
+        thread = new HandlerThread("Vsync", PipelineThreads.RENDER_PRIORITY);
+        thread.start();
+        new Handler(thread.getLooper()).post(() -> {
+            choreographer = Choreographer.getInstance();
+            choreographer.postFrameCallback(this);
+        });
+    }
+
+    public void stop() {
+        if (!running) return;
+        running = false;
+        thread.quitSafely();
+        thread = null;
+    }
+
+    @Override
+    public void doFrame(long frameTimeNanos) {
+        if (!running) return;
+        lastVsyncNs = frameTimeNanos;
+        if (++framesSinceRefreshRateCheck >= REFRESH_RATE_CHECK_FRAMES) {
+            // The refresh rate changes with the display mode, e.g. after setFrameRate.
+            framesSinceRefreshRateCheck = 0;
+            updateVsyncPeriod();
+        }
+        choreographer.postFrameCallback(this);
+    }
+
+    /**
+     * Returns the time to release a frame decoded at {@code nowNs} at, as the first vsync it can make.
+     */
+    public long getReleaseTimeNs(long nowNs) {
+        long vsyncNs = lastVsyncNs;
+        long periodNs = vsyncPeriodNs;
+        if (vsyncNs == 0) return nowNs;
+        long earliestNs = nowNs + LATCH_MARGIN_NS;
+        if (earliestNs <= vsyncNs) return vsyncNs;
+        long periods = (earliestNs - vsyncNs + periodNs - 1) / periodNs;
+        return vsyncNs + periods * periodNs;
+    }
+
+    public long getVsyncPeriodNs() {
+        return vsyncPeriodNs;
+    }
+
+    /**
+     * Tells the surface the stream frame rate, on API 30+. Only changes larger than a couple of fps are passed on, as
+     * each one may switch the display mode.
+     */
+    public void setFrameRate(Surface surface, float frameRate) {
+        if (Build.VERSION.SDK_INT < Build.VERSION_CODES.R || surface == null || !surface.isValid()) return;
+        if (Math.abs(frameRate - surfaceFrameRate) < FRAME_RATE_CHANGE_THRESHOLD) return;
+        surfaceFrameRate = frameRate;
+        try {
+            surface.setFrameRate(frameRate, Surface.FRAME_RATE_COMPATIBILITY_FIXED_SOURCE);
+            Log.d(TAG, "surface frame rate set to " + frameRate);
+        } catch (IllegalArgumentException | IllegalStateException e) {
+            Log.e(TAG, "unable to set surface frame rate: " + e.getMessage());
+        }
+    }
+
+    private void updateVsyncPeriod() {
+        if (display == null) return;
+        float refreshRate = display.getRefreshRate();
+        if (refreshRate > 0) {
+            vsyncPeriodNs = (long) (1e9 / refreshRate);
+        }
+    }
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright 2019, Digi International Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+package usb;
+
+import java.io.IOException;
+import java.io.InputStream;
+import java.nio.ByteBuffer;
+import java.util.concurrent.TimeoutException;
+
+import android.hardware.usb.UsbDeviceConnection;
+import android.hardware.usb.UsbEndpoint;
+import android.hardware.usb.UsbRequest;
+import android.os.Build;
+import android.util.Log;
+
+import androidx.annotation.RequiresApi;
+
+/**
+ * This class reads data from the USB Interface in Android keeping several
+ * {@code UsbRequest}s queued on the receive end point at once, so the device
+ * never waits for the host between two transfers. It behaves like an
+ * {@code InputStream} class.
+ *
+ * <p>A fixed pool of direct {@code ByteBuffer}s is allocated up front and
+ * recycled: each buffer is re-queued as soon as its content has been fully
+ * consumed by the reader.</p>
+ *
+ * <p>Reads only move bytes: an empty transfer is returned as is, asking the
+ * goggles to stream again is left to the connection's control thread.</p>
+ */
+@RequiresApi(api = Build.VERSION_CODES.O)
+public class AndroidUSBAsyncInputStream extends InputStream {
+
+	private final String TAG = "USBAsyncInputStream";
+	// Constants.
+	private static final int READ_TIMEOUT = 100;
+
+	public static final int DEFAULT_REQUEST_COUNT = 8;
+	public static final int DEFAULT_REQUEST_SIZE = 16384;
+	// Requests were limited to 16 KB before Android P.
+	private static final int LEGACY_MAX_REQUEST_SIZE = 16384;
+
+	// Variables.
+	private final UsbDeviceConnection usbConnection;
+
+	private final UsbEndpoint receiveEndPoint;
+
+	private final UsbRequest[] requests;
+	private final ByteBuffer[] buffers;
+
+	private UsbRequest currentRequest;
+	private ByteBuffer currentBuffer;
+
+	private boolean working = false;
+
+	private final byte[] singleByte = new byte[1];
+
+	/**
+	 * Class constructor. Instantiates a new {@code AndroidUSBAsyncInputStream}
+	 * object with the default request count and size.
+	 *
+	 * @param readEndpoint The USB end point to use to read data from.
+	 * @param connection The USB connection to use to read data from.
+	 *
+	 * @see UsbDeviceConnection
+	 * @see UsbEndpoint
+	 */
+	public AndroidUSBAsyncInputStream(UsbEndpoint readEndpoint, UsbDeviceConnection connection) {
+		this(readEndpoint, connection, DEFAULT_REQUEST_COUNT, DEFAULT_REQUEST_SIZE);
+	}
+
+	/**
+	 * Class constructor. Instantiates a new {@code AndroidUSBAsyncInputStream}
+	 * object with the given parameters.
+	 *
+	 * @param readEndpoint The USB end point to use to read data from.
+	 * @param connection The USB connection to use to read data from.
+	 * @param requestCount Number of requests kept queued on the end point.
+	 * @param requestSize Size in bytes of each request buffer, capped to
+	 *                    16 KB on Android versions older than P.
+	 *
+	 * @throws IllegalArgumentException if {@code requestCount < 1} or
+	 *                                  if {@code requestSize < 1}.
+	 *
+	 * @see UsbDeviceConnection
+	 * @see UsbEndpoint
+	 */
+	public AndroidUSBAsyncInputStream(UsbEndpoint readEndpoint, UsbDeviceConnection connection, int requestCount, int requestSize) {
+		if (requestCount < 1)
+			throw new IllegalArgumentException("Request count must be greater than 0.");
+		if (requestSize < 1)
+			throw new IllegalArgumentException("Request size must be greater than 0.");
+
+		if (Build.VERSION.SDK_INT < Build.VERSION_CODES.P)
+			requestSize = Math.min(requestSize, LEGACY_MAX_REQUEST_SIZE);
+
+		this.usbConnection = connection;
+		this.receiveEndPoint = readEndpoint;
+		this.requests = new UsbRequest[requestCount];
+		this.buffers = new ByteBuffer[requestCount];
+
+		for (int i = 0; i < requestCount; i++) {
+			buffers[i] = ByteBuffer.allocateDirect(requestSize);
+			requests[i] = new UsbRequest();
+			requests[i].initialize(usbConnection, receiveEndPoint);
+			requests[i].setClientData(buffers[i]);
+		}
+	}
+
+	/**
+	 * Queues every request of the pool on the receive end point.
+	 */
+	private void startRequests() {
+		working = true;
+		for (int i = 0; i < requests.length; i++)
+			queue(requests[i], buffers[i]);
+	}
+
+	private void queue(UsbRequest request, ByteBuffer buffer) {
+		buffer.clear();
+		if (!request.queue(buffer))
+			Log.w(TAG, "unable to queue usb request");
+	}
+
+	@Override
+	public int read() throws IOException {
+		int receivedBytes = read(singleByte, 0, 1);
+		if (receivedBytes <= 0)
+			return -1;
+		return singleByte[0] & 0xFF;
+	}
+
+	@Override
+	public int read(byte[] buffer, int offset, int length) throws IOException {
+		if (!working)
+			startRequests();
+
+		if (currentBuffer == null || !currentBuffer.hasRemaining()) {
+			if (!nextBuffer())
+				return 0;
+		}
+
+		int readBytes = Math.min(length, currentBuffer.remaining());
+		currentBuffer.get(buffer, offset, readBytes);
+		return readBytes;
+	}
+
+	/**
+	 * Re-queues the request whose buffer has been consumed and waits for the
+	 * next completed one.
+	 *
+	 * @return {@code true} if a non empty buffer is ready to be consumed.
+	 */
+	private boolean nextBuffer() throws IOException {
+		if (currentRequest != null) {
+			queue(currentRequest, currentBuffer);
+			currentRequest = null;
+			currentBuffer = null;
+		}
+
+		UsbRequest request;
+		long startTime = System.nanoTime();
+		try {
+			request = usbConnection.requestWait(READ_TIMEOUT);
+		} catch (TimeoutException e) {
+			PipelineStats.getInstance().onUsbTransfer(0, System.nanoTime() - startTime);
+			return false;
+		}
+		if (request == null)
+			throw new IOException("USB request wait failed");
+
+		currentRequest = request;
+		currentBuffer = (ByteBuffer) request.getClientData();
+		currentBuffer.flip();
+		PipelineStats.getInstance().onUsbTransfer(currentBuffer.remaining(), System.nanoTime() - startTime);
+		return currentBuffer.hasRemaining();
+	}
+
+	/**
+	 * Cancels every queued request and waits for them to be returned, so the
+	 * stream can be read again later (the pool is re-queued on next read).
+	 */
+	@Override
+	public void close() throws IOException {
+		if (!working)
+			return;
+		working = false;
+		currentRequest = null;
+		currentBuffer = null;
+
+		for (UsbRequest request : requests)
+			request.cancel();
+		for (int i = 0; i < requests.length; i++) {
+			try {
+				if (usbConnection.requestWait(READ_TIMEOUT) == null)
+					break;
+			} catch (TimeoutException e) {
+				break;
+			}
+		}
+	}
+
+	/**
+	 * Closes the stream and releases the native resources of every request.
+	 * The stream cannot be used anymore afterwards.
+	 */
+	public void release() throws IOException {
+		close();
+		for (UsbRequest request : requests)
+			request.close();
+	}
+
+}
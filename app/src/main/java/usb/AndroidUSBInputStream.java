@@ -20,27 +20,51 @@ import java.io.InputStream;
 
 import android.hardware.usb.UsbDeviceConnection;
 import android.hardware.usb.UsbEndpoint;
-import android.util.Log;
+import android.os.Build;
 
 /**
  * This class acts as a wrapper to read data from the USB Interface in Android
  * behaving like an {@code InputputStream} class.
+ *
+ * <p>Reads only move bytes: an empty transfer is returned as is, asking the
+ * goggles to stream again is left to the connection's control thread.</p>
  */
 public class AndroidUSBInputStream extends InputStream {
 
-	private final String TAG = "USBInputStream";
 	// Constants.
-	private static final int OFFSET = 0;
 	private static final int READ_TIMEOUT = 100;
+	private static final int SINGLE_READ_BUFFER_SIZE = 131072;
+
+	// Bulk transfers were limited to 16 KB before Android P.
+	private static final int LEGACY_MAX_TRANSFER_SIZE = 16384;
+	public static final int DEFAULT_TRANSFER_SIZE = 131072;
 
 	// Variables.
 	private UsbDeviceConnection usbConnection;
 
 	private UsbEndpoint receiveEndPoint;
-	private final UsbEndpoint sendEndPoint;
 
 	private boolean working = false;
 
+	private int transferSize;
+
+	private byte[] singleReadBuffer;
+	private int singleReadPosition;
+	private int singleReadLimit;
+
+	/**
+	 * Class constructor. Instantiates a new {@code AndroidUSBInputStream}
+	 * object with the given parameters.
+	 *
+	 * @param readEndpoint The USB end point to use to read data from.
+	 * @param connection The USB connection to use to read data from.
+	 *
+	 * @see UsbDeviceConnection
+	 * @see UsbEndpoint
+	 */
+	public AndroidUSBInputStream( UsbEndpoint readEndpoint, UsbDeviceConnection connection) {
+		this(readEndpoint, connection, DEFAULT_TRANSFER_SIZE);
+	}
 
 	/**
 	 * Class constructor. Instantiates a new {@code AndroidUSBInputStream}
@@ -48,36 +72,88 @@ public class AndroidUSBInputStream extends InputStream {
 	 *
 	 * @param readEndpoint The USB end point to use to read data from.
 	 * @param connection The USB connection to use to read data from.
+	 * @param transferSize Maximum number of bytes requested by a single bulk
+	 *                     transfer.
 	 *
 	 * @see UsbDeviceConnection
 	 * @see UsbEndpoint
 	 */
-	public AndroidUSBInputStream( UsbEndpoint readEndpoint, UsbEndpoint sendEndpoint, UsbDeviceConnection connection) {
+	public AndroidUSBInputStream( UsbEndpoint readEndpoint, UsbDeviceConnection connection, int transferSize) {
 		this.usbConnection = connection;
 		this.receiveEndPoint = readEndpoint;
-		this.sendEndPoint = sendEndpoint;
+		setTransferSize(transferSize);
+	}
+
+	/**
+	 * Sets the maximum number of bytes requested by a single bulk transfer.
+	 * The value is capped to 16 KB on Android versions older than P.
+	 *
+	 * @param size Transfer size in bytes.
+	 *
+	 * @throws IllegalArgumentException if {@code size < 1}.
+	 */
+	public void setTransferSize(int size) {
+		if (size < 1)
+			throw new IllegalArgumentException("Transfer size must be greater than 0.");
+		if (Build.VERSION.SDK_INT < Build.VERSION_CODES.P)
+			size = Math.min(size, LEGACY_MAX_TRANSFER_SIZE);
+		transferSize = size;
+	}
+
+	/**
+	 * Returns the maximum number of bytes requested by a single bulk transfer.
+	 *
+	 * @return The transfer size in bytes.
+	 */
+	public int getTransferSize() {
+		return transferSize;
 	}
 
 	@Override
 	public int read() throws IOException {
-		byte[] buffer = new byte[131072];
-		return read(buffer, 0,  buffer.length);
+		if (singleReadPosition >= singleReadLimit) {
+			if (singleReadBuffer == null)
+				singleReadBuffer = ByteArrayPool.getInstance().acquire(SINGLE_READ_BUFFER_SIZE);
+			singleReadPosition = 0;
+			singleReadLimit = Math.max(transfer(singleReadBuffer, 0, singleReadBuffer.length), 0);
+			if (singleReadLimit == 0)
+				return -1;
+		}
+		return singleReadBuffer[singleReadPosition++] & 0xFF;
 	}
 
 	@Override
 	public int read(byte[] buffer, int offset, int length) throws IOException {
-		int receivedBytes = usbConnection.bulkTransfer(receiveEndPoint, buffer, buffer.length, READ_TIMEOUT);
-		if (receivedBytes <= 0) {
-			// send magic packet again; Would be great to handle this in UsbMaskConnection directly...
-			Log.d(TAG, "received buffer empty, sending magic packet again...");
-			usbConnection.bulkTransfer(sendEndPoint, "RMVT".getBytes(), "RMVT".getBytes().length, 2000);
-			receivedBytes = usbConnection.bulkTransfer(receiveEndPoint, buffer, buffer.length, READ_TIMEOUT);
+		if (offset < 0 || length < 0 || length > buffer.length - offset)
+			throw new IndexOutOfBoundsException();
+		if (length == 0)
+			return 0;
+
+		// Serve bytes left over by a previous single byte read first.
+		if (singleReadPosition < singleReadLimit) {
+			int readBytes = Math.min(length, singleReadLimit - singleReadPosition);
+			System.arraycopy(singleReadBuffer, singleReadPosition, buffer, offset, readBytes);
+			singleReadPosition += readBytes;
+			return readBytes;
 		}
+		return transfer(buffer, offset, length);
+	}
+
+	private int transfer(byte[] buffer, int offset, int length) {
+		length = Math.min(length, transferSize);
+		long startTime = System.nanoTime();
+		int receivedBytes = usbConnection.bulkTransfer(receiveEndPoint, buffer, offset, length, READ_TIMEOUT);
+		PipelineStats.getInstance().onUsbTransfer(receivedBytes, System.nanoTime() - startTime);
 		return receivedBytes;
 	}
 
 
 	@Override
-	public void close() throws IOException {}
+	public void close() throws IOException {
+		singleReadPosition = 0;
+		singleReadLimit = 0;
+		ByteArrayPool.getInstance().release(singleReadBuffer);
+		singleReadBuffer = null;
+	}
 
 }
@@ -0,0 +1,471 @@
+/*
+ * Copyright 2019, Digi International Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+package usb;
+
+import java.io.InputStream;
+import java.nio.ByteBuffer;
+import java.util.concurrent.atomic.AtomicInteger;
+
+/**
+ * Circular buffer written by exactly one producer thread and read by any
+ * number of consumers, each through its own {@link Cursor}.
+ *
+ * <p>The producer never waits for the consumers: every write overwrites the
+ * oldest data, and a cursor that fell too far behind skips ahead following
+ * its {@link DropPolicy} and reports a discontinuity. A slow consumer only
+ * ever loses data itself and never holds back the producer or the other
+ * consumers.</p>
+ *
+ * <p>Along with the bytes, each write is kept as a record holding its
+ * position and arrival time. A cursor read never spans two records, so
+ * consumers see the same chunks the producer wrote and can tell when each
+ * one arrived, however late they read it.</p>
+ *
+ * <p>Reads are lock-free. Positions are monotonically increasing counters
+ * published through volatile fields, like a seqlock: a cursor re-reads them
+ * after copying to check whether the producer lapped it meanwhile, and
+ * discards the copy if so. Only cursors waiting for data take a lock, and
+ * the producer only takes it when one is waiting.</p>
+ */
+public class BroadcastRingBuffer {
+
+	/**
+	 * What a cursor skips to when it fell behind.
+	 */
+	public enum DropPolicy {
+		/** Skips everything unread, to stay as close to live as possible. */
+		SKIP_TO_NEWEST,
+		/** Skips only what was lost, to keep as much data as possible. */
+		SKIP_TO_OLDEST
+	}
+
+	// Constants.
+	private static final int RECORD_COUNT = 4096;
+	private static final int RECORD_MASK = RECORD_COUNT - 1;
+
+	private static final long READ_TIMEOUT_MS = 100;
+
+	// Variables.
+	private final byte[] buffer;
+	private final int mask;
+
+	private final long[] recordStarts = new long[RECORD_COUNT];
+	private final int[] recordLengths = new int[RECORD_COUNT];
+	private final long[] recordTimes = new long[RECORD_COUNT];
+
+	// End of the data being written, published before the copy.
+	private volatile long writeLimit;
+	// End of the data written, published after the copy.
+	private volatile long writePosition;
+	// Number of records written, published last.
+	private volatile long writeCount;
+
+	private final Object dataLock = new Object();
+	// Cursors waiting on dataLock.
+	private final AtomicInteger waiterCount = new AtomicInteger();
+
+	/**
+	 * Instantiates a new {@code BroadcastRingBuffer} with the given capacity
+	 * in bytes, rounded up to the next power of two.
+	 *
+	 * @param size Buffer size in bytes.
+	 *
+	 * @throws IllegalArgumentException if {@code size < 1} or
+	 *                                  if {@code size > 2^30}.
+	 */
+	public BroadcastRingBuffer(int size) {
+		if (size < 1)
+			throw new IllegalArgumentException("Buffer size must be greater than 0.");
+		if (size > (1 << 30))
+			throw new IllegalArgumentException("Buffer size must not be greater than 2^30.");
+
+		int capacity = Integer.highestOneBit(size);
+		if (capacity < size)
+			capacity <<= 1;
+
+		buffer = new byte[capacity];
+		mask = capacity - 1;
+	}
+
+	/**
+	 * Instantiates a new {@code BroadcastRingBuffer} storing its bytes in the
+	 * given array, e.g. one recycled from a {@link ByteArrayPool}.
+	 *
+	 * @param array Backing array, whose length is the capacity.
+	 *
+	 * @throws IllegalArgumentException if the length of {@code array} is not
+	 *                                  a power of two.
+	 */
+	public BroadcastRingBuffer(byte[] array) {
+		if (array.length == 0 || Integer.bitCount(array.length) != 1)
+			throw new IllegalArgumentException("Buffer size must be a power of two.");
+
+		buffer = array;
+		mask = array.length - 1;
+	}
+
+	/**
+	 * Returns the capacity of the buffer in bytes.
+	 *
+	 * @return The buffer capacity.
+	 */
+	public int getCapacity() {
+		return buffer.length;
+	}
+
+	/**
+	 * Writes a chunk to the buffer and wakes up the waiting cursors, if any.
+	 * Must only be called from the producer thread.
+	 *
+	 * @param data Bytes to write.
+	 * @param offset Offset inside data where bytes to write start.
+	 * @param numBytes Number of bytes to write.
+	 * @param arrivalTimeNs {@link System#nanoTime()} the chunk arrived at.
+	 *
+	 * @throws IllegalArgumentException if {@code numBytes} is greater than
+	 *                                  the capacity.
+	 */
+	public void write(byte[] data, int offset, int numBytes, long arrivalTimeNs) {
+		if (numBytes <= 0)
+			return;
+		if (numBytes > buffer.length)
+			throw new IllegalArgumentException("Chunk must not be larger than the buffer.");
+
+		long position = beginWrite(numBytes);
+		int index = (int) (position & mask);
+		int firstPart = Math.min(numBytes, buffer.length - index);
+		System.arraycopy(data, offset, buffer, index, firstPart);
+		if (firstPart < numBytes)
+			System.arraycopy(data, offset + firstPart, buffer, 0, numBytes - firstPart);
+		endWrite(position, numBytes, arrivalTimeNs);
+	}
+
+	/**
+	 * Writes the remaining bytes of {@code data} to the buffer as one chunk,
+	 * e.g. a transfer received into a direct {@code ByteBuffer}, without an
+	 * intermediate array. Must only be called from the producer thread.
+	 *
+	 * @param data Bytes to write, from its position to its limit. Its
+	 *             position is moved to its limit.
+	 * @param arrivalTimeNs {@link System#nanoTime()} the chunk arrived at.
+	 *
+	 * @throws IllegalArgumentException if the remaining bytes are more than
+	 *                                  the capacity.
+	 */
+	public void write(ByteBuffer data, long arrivalTimeNs) {
+		int numBytes = data.remaining();
+		if (numBytes <= 0)
+			return;
+		if (numBytes > buffer.length)
+			throw new IllegalArgumentException("Chunk must not be larger than the buffer.");
+
+		long position = beginWrite(numBytes);
+		int index = (int) (position & mask);
+		int firstPart = Math.min(numBytes, buffer.length - index);
+		data.get(buffer, index, firstPart);
+		if (firstPart < numBytes)
+			data.get(buffer, 0, numBytes - firstPart);
+		endWrite(position, numBytes, arrivalTimeNs);
+	}
+
+	/**
+	 * Publishes the end of the data about to be written, so cursors reading
+	 * what it overwrites discard their copy.
+	 *
+	 * @return The position the chunk starts at.
+	 */
+	private long beginWrite(int numBytes) {
+		long position = writePosition;
+		writeLimit = position + numBytes;
+		return position;
+	}
+
+	/**
+	 * Records the chunk written, publishes it and wakes up the waiting
+	 * cursors, if any.
+	 */
+	private void endWrite(long position, int numBytes, long arrivalTimeNs) {
+		long count = writeCount;
+		int record = (int) (count & RECORD_MASK);
+		recordStarts[record] = position;
+		recordLengths[record] = numBytes;
+		recordTimes[record] = arrivalTimeNs;
+
+		writePosition = position + numBytes;
+		writeCount = count + 1;
+
+		// A cursor counts itself before checking writeCount, so it either sees
+		// the new record or gets notified.
+		if (waiterCount.get() > 0) {
+			synchronized (dataLock) {
+				dataLock.notifyAll();
+			}
+		}
+	}
+
+	/**
+	 * Returns the total number of bytes written so far.
+	 *
+	 * @return The write position.
+	 */
+	public long getWritePosition() {
+		return writePosition;
+	}
+
+	/**
+	 * Creates a cursor starting at the data written from now on.
+	 *
+	 * @param policy What to skip to when the cursor fell behind.
+	 * @param maxLagBytes Unread bytes past which a
+	 *                    {@link DropPolicy#SKIP_TO_NEWEST} cursor skips
+	 *                    ahead, even if the data is still there. Bounded by
+	 *                    the capacity.
+	 * @return The new cursor.
+	 */
+	public Cursor newCursor(DropPolicy policy, int maxLagBytes) {
+		return new Cursor(policy, Math.min(maxLagBytes, buffer.length));
+	}
+
+	/**
+	 * Independent read position in a {@link BroadcastRingBuffer}, to be used
+	 * by a single consumer thread.
+	 *
+	 * <p>Reads wait up to 100 ms for data and return 0 on timeout, like a USB
+	 * read would, rather than ending the stream.</p>
+	 */
+	public class Cursor extends InputStream {
+
+		// Variables.
+		private final DropPolicy policy;
+		private final int maxLagBytes;
+
+		private long readPosition;
+		private long recordIndex;
+		private long lastArrivalTimeNs;
+		private boolean discontinuity;
+		private volatile boolean resetRequested;
+
+		private volatile long skippedBytes;
+		private volatile int skipCount;
+
+		private final byte[] singleByte = new byte[1];
+
+		private Cursor(DropPolicy policy, int maxLagBytes) {
+			this.policy = policy;
+			this.maxLagBytes = maxLagBytes;
+			skipToNewest();
+		}
+
+		@Override
+		public int read() {
+			int readBytes = read(singleByte, 0, 1);
+			return readBytes <= 0 ? -1 : singleByte[0] & 0xFF;
+		}
+
+		@Override
+		public int read(byte[] data, int offset, int length) {
+			if (length <= 0)
+				return 0;
+
+			if (resetRequested) {
+				resetRequested = false;
+				skipToNewest();
+			}
+			while (true) {
+				long count = writeCount;
+				if (recordIndex == count) {
+					if (!awaitData(count))
+						return 0;
+					continue;
+				}
+				if (isLapped()) {
+					dropUnread(count);
+					continue;
+				}
+				if (policy == DropPolicy.SKIP_TO_NEWEST && writePosition - readPosition > maxLagBytes) {
+					dropUnread(count);
+					continue;
+				}
+
+				int record = (int) (recordIndex & RECORD_MASK);
+				long end = recordStarts[record] + recordLengths[record];
+				long arrivalTimeNs = recordTimes[record];
+				int readBytes = (int) Math.min(length, end - readPosition);
+
+				int index = (int) (readPosition & mask);
+				int firstPart = Math.min(readBytes, buffer.length - index);
+				System.arraycopy(buffer, index, data, offset, firstPart);
+				if (firstPart < readBytes)
+					System.arraycopy(buffer, 0, data, offset + firstPart, readBytes - firstPart);
+
+				// The producer may have overwritten the bytes or the record while they were copied.
+				if (isLapped())
+					continue;
+
+				readPosition += readBytes;
+				if (readPosition == end)
+					recordIndex++;
+				lastArrivalTimeNs = arrivalTimeNs;
+				return readBytes;
+			}
+		}
+
+		/**
+		 * Returns the number of bytes written but not read yet, bounded by
+		 * the capacity.
+		 *
+		 * @return The number of unread bytes.
+		 */
+		@Override
+		public int available() {
+			return (int) Math.min(writePosition - readPosition, buffer.length);
+		}
+
+		/**
+		 * Skips all unread data, so the next read returns the next chunk
+		 * written. Unlike a skip after falling behind, this is not reported
+		 * as a discontinuity. The data sources close their stream on each
+		 * restart, which then resumes on live data. Can be called from any
+		 * thread, the skip happens on the next read.
+		 */
+		@Override
+		public void close() {
+			resetRequested = true;
+		}
+
+		/**
+		 * Returns the arrival time of the chunk the last read came from.
+		 *
+		 * @return The {@link System#nanoTime()} the chunk arrived at.
+		 */
+		public long getLastArrivalTimeNs() {
+			return lastArrivalTimeNs;
+		}
+
+		/**
+		 * Returns whether data was skipped since the last call, and clears the
+		 * flag.
+		 *
+		 * @return True if the data read next doesn't follow the data read
+		 *         last.
+		 */
+		public boolean takeDiscontinuity() {
+			boolean result = discontinuity;
+			discontinuity = false;
+			return result;
+		}
+
+		/**
+		 * Returns the total number of bytes skipped because the cursor fell
+		 * behind.
+		 *
+		 * @return The number of skipped bytes.
+		 */
+		public long getSkippedBytes() {
+			return skippedBytes;
+		}
+
+		/**
+		 * Returns the number of times the cursor fell behind.
+		 *
+		 * @return The number of skips.
+		 */
+		public int getSkipCount() {
+			return skipCount;
+		}
+
+		/**
+		 * Returns whether the producer overwrote the unread data or its
+		 * record.
+		 */
+		private boolean isLapped() {
+			return writeLimit - readPosition > buffer.length || writeCount - recordIndex >= RECORD_COUNT;
+		}
+
+		/**
+		 * Skips ahead following the drop policy.
+		 *
+		 * @param count Number of records written.
+		 */
+		private void dropUnread(long count) {
+			long previousPosition = readPosition;
+			if (policy == DropPolicy.SKIP_TO_NEWEST || !skipToOldest(count))
+				skipToNewest();
+			if (readPosition == previousPosition)
+				return;
+			skippedBytes += readPosition - previousPosition;
+			skipCount++;
+			discontinuity = true;
+		}
+
+		private void skipToNewest() {
+			// Taken from the last published record, as writePosition is updated before writeCount.
+			long count = writeCount;
+			int last = (int) ((count - 1) & RECORD_MASK);
+			recordIndex = count;
+			readPosition = count == 0 ? 0 : recordStarts[last] + recordLengths[last];
+		}
+
+		/**
+		 * Moves to the oldest record that leaves the producer half the buffer
+		 * before lapping the cursor again.
+		 *
+		 * @param count Number of records written.
+		 * @return False if there is no such record.
+		 */
+		private boolean skipToOldest(long count) {
+			long minPosition = writeLimit - buffer.length / 2;
+			long index = Math.max(recordIndex, count - RECORD_COUNT / 2);
+			for (; index < count; index++) {
+				long start = recordStarts[(int) (index & RECORD_MASK)];
+				if (start >= minPosition && writeCount - index < RECORD_COUNT) {
+					recordIndex = index;
+					readPosition = start;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/**
+		 * Waits for a record past the given count to be written.
+		 *
+		 * @return False on timeout.
+		 */
+		private boolean awaitData(long count) {
+			long deadlineMs = System.currentTimeMillis() + READ_TIMEOUT_MS;
+			synchronized (dataLock) {
+				waiterCount.incrementAndGet();
+				try {
+					while (writeCount == count) {
+						long remainingMs = deadlineMs - System.currentTimeMillis();
+						if (remainingMs <= 0)
+							return false;
+						try {
+							dataLock.wait(remainingMs);
+						} catch (InterruptedException e) {
+							Thread.currentThread().interrupt();
+							return false;
+						}
+					}
+				} finally {
+					waiterCount.decrementAndGet();
+				}
+			}
+			return true;
+		}
+	}
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2019, Digi International Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+package usb;
+
+import java.util.ArrayDeque;
+
+/**
+ * Helper class used to share and recycle byte arrays between the USB stream,
+ * the data sources and the extractor, so that steady-state streaming does
+ * not allocate.
+ *
+ * <p>Arrays are grouped in power-of-two size classes: an acquired array may
+ * be larger than requested. The allocation counters only grow when the pool
+ * has to create a new array, so they can be watched to make sure the
+ * pipeline does not allocate once started.</p>
+ */
+public class ByteArrayPool {
+
+	// Constants.
+	private static final int MAX_POOLED_PER_CLASS = 8;
+
+	private static final ByteArrayPool INSTANCE = new ByteArrayPool();
+
+	// Variables.
+	@SuppressWarnings("unchecked")
+	private final ArrayDeque<byte[]>[] freeArrays = new ArrayDeque[31];
+
+	private volatile long allocationCount;
+	private volatile long allocatedBytes;
+
+	/**
+	 * Returns the pool shared by the whole streaming pipeline.
+	 *
+	 * @return The shared {@code ByteArrayPool}.
+	 */
+	public static ByteArrayPool getInstance() {
+		return INSTANCE;
+	}
+
+	/**
+	 * Instantiates a new, empty {@code ByteArrayPool}.
+	 */
+	public ByteArrayPool() {
+		for (int i = 0; i < freeArrays.length; i++)
+			freeArrays[i] = new ArrayDeque<>(MAX_POOLED_PER_CLASS);
+	}
+
+	/**
+	 * Returns an array of at least the given size, recycled if possible.
+	 *
+	 * @param minSize Minimum size of the array in bytes.
+	 * @return A byte array, whose content is undefined.
+	 *
+	 * @throws IllegalArgumentException if {@code minSize < 1} or
+	 *                                  if {@code minSize > 2^30}.
+	 *
+	 * @see #release(byte[])
+	 */
+	public byte[] acquire(int minSize) {
+		if (minSize < 1)
+			throw new IllegalArgumentException("Array size must be greater than 0.");
+		if (minSize > (1 << 30))
+			throw new IllegalArgumentException("Array size must not be greater than 2^30.");
+
+		int sizeClass = sizeClass(minSize);
+		ArrayDeque<byte[]> arrays = freeArrays[sizeClass];
+		synchronized (arrays) {
+			byte[] array = arrays.pollFirst();
+			if (array != null)
+				return array;
+		}
+
+		synchronized (this) {
+			allocationCount++;
+			allocatedBytes += 1L << sizeClass;
+		}
+		return new byte[1 << sizeClass];
+	}
+
+	/**
+	 * Gives an array back to the pool. Arrays that were not acquired from a
+	 * pool (whose size is not a power of two) are ignored.
+	 *
+	 * @param array Array to recycle, may be {@code null}.
+	 *
+	 * @see #acquire(int)
+	 */
+	public void release(byte[] array) {
+		if (array == null || array.length == 0 || Integer.bitCount(array.length) != 1)
+			return;
+
+		ArrayDeque<byte[]> arrays = freeArrays[sizeClass(array.length)];
+		synchronized (arrays) {
+			if (arrays.size() < MAX_POOLED_PER_CLASS)
+				arrays.offerFirst(array);
+		}
+	}
+
+	/**
+	 * Drops every pooled array, e.g. when the system runs low on memory.
+	 * Acquired arrays are not affected and are pooled again on release.
+	 */
+	public void clear() {
+		for (ArrayDeque<byte[]> arrays : freeArrays) {
+			synchronized (arrays) {
+				arrays.clear();
+			}
+		}
+	}
+
+	/**
+	 * Returns the number of arrays this pool had to allocate.
+	 *
+	 * @return The number of allocations since creation.
+	 */
+	public long getAllocationCount() {
+		return allocationCount;
+	}
+
+	/**
+	 * Returns the number of bytes this pool had to allocate.
+	 *
+	 * @return The number of allocated bytes since creation.
+	 */
+	public long getAllocatedBytes() {
+		return allocatedBytes;
+	}
+
+	private static int sizeClass(int size) {
+		return 32 - Integer.numberOfLeadingZeros(size - 1);
+	}
+}
@@ -5,229 +5,374 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, you can obtain one at http://mozilla.org/MPL/2.0/.
  *
- * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES 
- * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF 
- * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR 
- * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES 
- * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN 
- * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 package usb;
 
 /**
  * Helper class used to store data bytes as a circular buffer.
+ *
+ * <p>The buffer is lock-free and safe for exactly one producer thread (calling
+ * the {@code write} methods) and one consumer thread (calling the
+ * {@code read}/{@code skip} methods). Read and write positions are
+ * monotonically increasing counters published through volatile fields; the
+ * capacity is always a power of two so positions are mapped to indexes with
+ * a mask.</p>
+ *
+ * <p>Unread data is never overwritten: when there is not enough free space,
+ * only the bytes that fit are written and the rest is reported as an
+ * overrun.</p>
  */
 public class CircularByteBuffer {
 
 	// Variables.
-	private byte[] buffer;
+	private final byte[] buffer;
+	private final int mask;
+
+	private volatile long readPosition;
+	private volatile long writePosition;
 
-	private int readIndex;
-	private int writeIndex;
-	
-	private boolean empty = true;
+	// Owned by the producer thread.
+	private long cachedReadPosition;
+	// Owned by the consumer thread.
+	private long cachedWritePosition;
+
+	private volatile long overrunBytes;
+	private volatile int overrunCount;
 
 	/**
 	 * Instantiates a new {@code CircularByteBuffer} with the given capacity
-	 * in bytes.
-	 * 
+	 * in bytes, rounded up to the next power of two.
+	 *
 	 * @param size Circular byte buffer size in bytes.
-	 * 
-	 * @throws IllegalArgumentException if {@code size < 1}.
+	 *
+	 * @throws IllegalArgumentException if {@code size < 1} or
+	 *                                  if {@code size > 2^30}.
 	 */
 	public CircularByteBuffer(int size) {
 		if (size < 1)
 			throw new IllegalArgumentException("Buffer size must be greater than 0.");
-		
-		buffer = new byte[size];
-		readIndex = 0;
-		writeIndex = 0;
+		if (size > (1 << 30))
+			throw new IllegalArgumentException("Buffer size must not be greater than 2^30.");
+
+		int capacity = Integer.highestOneBit(size);
+		if (capacity < size)
+			capacity <<= 1;
+
+		buffer = new byte[capacity];
+		mask = capacity - 1;
+	}
+
+	/**
+	 * Instantiates a new {@code CircularByteBuffer} storing its bytes in the
+	 * given array, e.g. one recycled from a {@link ByteArrayPool}.
+	 *
+	 * @param array Backing array, whose length is the capacity.
+	 *
+	 * @throws IllegalArgumentException if the length of {@code array} is not
+	 *                                  a power of two.
+	 */
+	public CircularByteBuffer(byte[] array) {
+		if (array.length == 0 || Integer.bitCount(array.length) != 1)
+			throw new IllegalArgumentException("Buffer size must be a power of two.");
+
+		buffer = array;
+		mask = array.length - 1;
 	}
 
 	/**
 	 * Writes the given amount of bytes to the circular byte buffer.
-	 * 
+	 *
 	 * @param data Bytes to write.
 	 * @param offset Offset inside data where bytes to write start.
 	 * @param numBytes Number of bytes to write.
-	 * @return The number of bytes actually written.
-	 * 
+	 * @return The number of bytes actually written. If lower than the
+	 *         requested number of bytes, the remaining ones were dropped and
+	 *         counted as an overrun.
+	 *
 	 * @throws IllegalArgumentException if {@code offset < 0} or
 	 *                                  if {@code numBytes < 1}.
 	 * @throws NullPointerException if {@code data == null}.
-	 * 
+	 *
 	 * @see #read(byte[], int, int)
 	 * @see #skip(int)
+	 * @see #getOverrunCount()
 	 */
-	public synchronized int write(byte[] data, int offset, int numBytes) {
+	public int write(byte[] data, int offset, int numBytes) {
 		if (data == null)
 			throw new NullPointerException("Data cannot be null.");
 		if (offset < 0)
 			throw new IllegalArgumentException("Offset cannot be negative.");
 		if (numBytes < 1)
 			throw new IllegalArgumentException("Number of bytes to write must be greater than 0.");
-		
+
 		// Check if there are enough bytes to write.
 		int availableBytes = data.length - offset;
 		if (numBytes > availableBytes)
 			numBytes = availableBytes;
-		
-		// Check where we should start writing.
-		if (numBytes < buffer.length - getWriteIndex()) {
-			System.arraycopy(data, offset, buffer, getWriteIndex(), numBytes);
-			writeIndex = getWriteIndex() + numBytes;
-		} else {
-			System.arraycopy(data, offset, buffer, getWriteIndex(), buffer.length - getWriteIndex());
-			System.arraycopy(data, offset + buffer.length-getWriteIndex(), buffer, 0, numBytes - (buffer.length - getWriteIndex()));
-			writeIndex = numBytes - (buffer.length-getWriteIndex());
-			if (getReadIndex() < getWriteIndex())
-				readIndex = getWriteIndex();
-		}
-		
-		// Check if we were able to write all the bytes.
-		if (numBytes > getCapacity())
-			numBytes = getCapacity();
-		
-		empty = false;
-		return numBytes;
+		if (numBytes <= 0)
+			return 0;
+
+		int toWrite = Math.min(numBytes, writableBytes(numBytes));
+		if (toWrite < numBytes)
+			reportOverrun(numBytes - toWrite);
+		if (toWrite == 0)
+			return 0;
+
+		long position = writePosition;
+		int index = (int) (position & mask);
+		int firstPart = Math.min(toWrite, buffer.length - index);
+		System.arraycopy(data, offset, buffer, index, firstPart);
+		if (firstPart < toWrite)
+			System.arraycopy(data, offset + firstPart, buffer, 0, toWrite - firstPart);
+
+		writePosition = position + toWrite;
+		return toWrite;
 	}
 
 	/**
 	 * Reads the given amount of bytes to the given array from the circular byte
 	 * buffer.
-	 * 
+	 *
 	 * @param data Byte buffer to place read bytes in.
 	 * @param offset Offset inside data to start placing read bytes in.
 	 * @param numBytes Number of bytes to read.
 	 * @return The number of bytes actually read.
-	 * 
+	 *
 	 * @throws IllegalArgumentException if {@code offset < 0} or
 	 *                                  if {@code numBytes < 1}.
 	 * @throws NullPointerException if {@code data == null}.
-	 * 
+	 *
 	 * @see #skip(int)
 	 * @see #write(byte[], int, int)
 	 */
-	public synchronized int read(byte[] data, int offset, int numBytes) {
+	public int read(byte[] data, int offset, int numBytes) {
 		if (data == null)
 			throw new NullPointerException("Data cannot be null.");
 		if (offset < 0)
 			throw new IllegalArgumentException("Offset cannot be negative.");
 		if (numBytes < 1)
 			throw new IllegalArgumentException("Number of bytes to read must be greater than 0.");
-		
-		// If we are empty, return 0.
-		if (empty)
-			return 0;
-		
+
 		// If we try to place bytes in an index bigger than buffer index, return 0 read bytes.
 		if (offset >= data.length)
 			return 0;
-		
-		if (data.length - offset < numBytes)
-			return read(data, offset, data.length - offset);
-		if (availableToRead() < numBytes)
-			return read(data, offset, availableToRead());
-		if (numBytes < buffer.length - getReadIndex()){
-			System.arraycopy(buffer, getReadIndex(), data, offset, numBytes);
-			readIndex = getReadIndex() + numBytes;
-		} else {
-			System.arraycopy(buffer, getReadIndex(), data, offset, buffer.length - getReadIndex());
-			System.arraycopy(buffer, 0, data, offset + buffer.length - getReadIndex(), numBytes - (buffer.length - getReadIndex()));
-			readIndex = numBytes-(buffer.length - getReadIndex());
-		}
-		
-		// If we have read all bytes, set the buffer as empty.
-		if (readIndex == writeIndex)
-			empty = true;
-		
-		return numBytes;
+
+		numBytes = Math.min(numBytes, data.length - offset);
+		int toRead = Math.min(numBytes, readableBytes(numBytes));
+		if (toRead == 0)
+			return 0;
+
+		long position = readPosition;
+		int index = (int) (position & mask);
+		int firstPart = Math.min(toRead, buffer.length - index);
+		System.arraycopy(buffer, index, data, offset, firstPart);
+		if (firstPart < toRead)
+			System.arraycopy(buffer, 0, data, offset + firstPart, toRead - firstPart);
+
+		readPosition = position + toRead;
+		return toRead;
 	}
 
 	/**
 	 * Skips the given number of bytes from the circular byte buffer.
-	 * 
+	 *
 	 * @param numBytes Number of bytes to skip.
 	 * @return The number of bytes actually skipped.
-	 * 
+	 *
 	 * @throws IllegalArgumentException if {@code numBytes < 1}.
-	 * 
+	 *
 	 * @see #read(byte[], int, int)
 	 * @see #write(byte[], int, int)
 	 */
-	public synchronized int skip(int numBytes) {
+	public int skip(int numBytes) {
 		if (numBytes < 1)
 			throw new IllegalArgumentException("Number of bytes to skip must be greater than 0.");
-		
-		// If we are empty, return 0.
-		if (empty)
-			return 0;
-		
-		if (availableToRead() < numBytes)
-			return skip(availableToRead());
-		if (numBytes < buffer.length - getReadIndex())
-			readIndex = getReadIndex() + numBytes;
-		else
-			readIndex = numBytes - (buffer.length - getReadIndex());
-		
-		// If we have skipped all bytes, set the buffer as empty.
-		if (readIndex == writeIndex)
-			empty = true;
-		
-		return numBytes;
+
+		int toSkip = Math.min(numBytes, readableBytes(numBytes));
+		readPosition = readPosition + toSkip;
+		return toSkip;
+	}
+
+	/**
+	 * Returns the backing array of the circular byte buffer, to be used
+	 * together with the readable and writable region methods in order to
+	 * access the data in place without copying it.
+	 *
+	 * @return The backing array.
+	 *
+	 * @see #getReadableOffset()
+	 * @see #getWritableOffset()
+	 */
+	public byte[] array() {
+		return buffer;
+	}
+
+	/**
+	 * Returns the index in {@link #array()} of the first readable byte.
+	 * Consumer thread only.
+	 *
+	 * @return The index of the first readable byte.
+	 *
+	 * @see #getReadableLength()
+	 */
+	public int getReadableOffset() {
+		return (int) (readPosition & mask);
+	}
+
+	/**
+	 * Returns the number of bytes that can be read contiguously in
+	 * {@link #array()} starting at {@link #getReadableOffset()}. Once consumed,
+	 * the region must be released calling {@link #skip(int)}. Consumer thread
+	 * only.
+	 *
+	 * @return The length of the contiguous readable region.
+	 */
+	public int getReadableLength() {
+		int offset = getReadableOffset();
+		return Math.min(readableBytes(buffer.length - offset), buffer.length - offset);
+	}
+
+	/**
+	 * Returns the index in {@link #array()} where the next written byte will
+	 * be placed. Producer thread only.
+	 *
+	 * @return The index of the next writable byte.
+	 *
+	 * @see #getWritableLength()
+	 */
+	public int getWritableOffset() {
+		return (int) (writePosition & mask);
+	}
+
+	/**
+	 * Returns the number of bytes that can be written contiguously in
+	 * {@link #array()} starting at {@link #getWritableOffset()}. Once filled,
+	 * the region must be published calling {@link #commitWrite(int)}.
+	 * Producer thread only.
+	 *
+	 * @return The length of the contiguous writable region.
+	 */
+	public int getWritableLength() {
+		int offset = getWritableOffset();
+		return Math.min(writableBytes(buffer.length - offset), buffer.length - offset);
+	}
+
+	/**
+	 * Publishes the given number of bytes written in place in the writable
+	 * region. Producer thread only.
+	 *
+	 * @param numBytes Number of bytes written in the writable region.
+	 *
+	 * @throws IllegalArgumentException if {@code numBytes < 0} or if
+	 *                                  {@code numBytes > getWritableLength()}.
+	 */
+	public void commitWrite(int numBytes) {
+		if (numBytes < 0 || numBytes > getWritableLength())
+			throw new IllegalArgumentException("Number of bytes to commit is out of the writable region.");
+
+		writePosition = writePosition + numBytes;
 	}
 
 	/**
 	 * Returns the available number of bytes to read from the byte buffer.
-	 * 
+	 *
 	 * @return The number of bytes in the buffer available for reading.
-	 * 
+	 *
 	 * @see #getCapacity()
 	 * @see #read(byte[], int, int)
 	 */
 	public int availableToRead() {
-		if (empty)
-			return 0;
-		if (getReadIndex() < getWriteIndex())
-			return (getWriteIndex() - getReadIndex());
-		else
-			return (buffer.length - getReadIndex() + getWriteIndex());
+		return (int) (writePosition - readPosition);
+	}
+
+	/**
+	 * Returns the available number of bytes that can be written to the byte
+	 * buffer without overrun.
+	 *
+	 * @return The number of free bytes in the buffer.
+	 *
+	 * @see #write(byte[], int, int)
+	 */
+	public int availableToWrite() {
+		return (int) (buffer.length - (writePosition - readPosition));
 	}
 
 	/**
-	 * Returns the current read index.
-	 * 
-	 * @return readIndex The current read index.
+	 * Returns the number of readable bytes, only reloading the producer
+	 * position when the cached one does not hold the wanted amount.
+	 * Consumer thread only.
 	 */
-	private int getReadIndex() {
-		return readIndex;
+	private int readableBytes(int wanted) {
+		long position = readPosition;
+		int available = (int) (cachedWritePosition - position);
+		if (available < wanted) {
+			cachedWritePosition = writePosition;
+			available = (int) (cachedWritePosition - position);
+		}
+		return available;
 	}
 
 	/**
-	 * Returns the current write index.
-	 * 
-	 * @return writeIndex The current write index.
+	 * Returns the number of writable bytes, only reloading the consumer
+	 * position when the cached one does not leave the wanted amount.
+	 * Producer thread only.
 	 */
-	private int getWriteIndex() {
-		return writeIndex;
+	private int writableBytes(int wanted) {
+		long position = writePosition;
+		int available = (int) (buffer.length - (position - cachedReadPosition));
+		if (available < wanted) {
+			cachedReadPosition = readPosition;
+			available = (int) (buffer.length - (position - cachedReadPosition));
+		}
+		return available;
 	}
-	
+
 	/**
 	 * Returns the circular byte buffer capacity.
-	 * 
+	 *
 	 * @return The circular byte buffer capacity.
 	 */
 	public int getCapacity() {
 		return buffer.length;
 	}
-	
+
+	/**
+	 * Returns the number of writes that could not be fully stored because
+	 * the buffer was full.
+	 *
+	 * @return The number of overruns since creation.
+	 */
+	public int getOverrunCount() {
+		return overrunCount;
+	}
+
+	/**
+	 * Returns the number of bytes dropped because the buffer was full.
+	 *
+	 * @return The number of dropped bytes since creation.
+	 */
+	public long getOverrunBytes() {
+		return overrunBytes;
+	}
+
+	private void reportOverrun(int numBytes) {
+		// Only the producer thread updates these counters.
+		overrunCount = overrunCount + 1;
+		overrunBytes = overrunBytes + numBytes;
+	}
+
 	/**
-	 * Clears the circular buffer.
+	 * Clears the circular buffer discarding every unread byte. Consumer
+	 * thread only.
 	 */
 	public void clearBuffer() {
-		empty = true;
-		readIndex = 0;
-		writeIndex = 0;
+		readPosition = writePosition;
 	}
-}
\ No newline at end of file
+}
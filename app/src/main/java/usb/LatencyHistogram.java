@@ -0,0 +1,105 @@
+/*
+ * Copyright 2019, Digi International Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+package usb;
+
+/**
+ * Fixed resolution latency histogram, recording durations from 0 to
+ * {@link #MAX_LATENCY_NS} in {@link #BUCKET_NS} wide buckets. Longer
+ * durations are counted in the last bucket.
+ *
+ * <p>Counts are cumulative and recording never allocates. The histogram is
+ * meant to be fed by a single thread; readers on other threads may observe
+ * slightly stale counts. Percentiles over a time window are computed against
+ * a copy of the counts taken at the start of the window.</p>
+ */
+public class LatencyHistogram {
+
+	// Constants.
+	public static final long BUCKET_NS = 250_000;
+	public static final long MAX_LATENCY_NS = 250_000_000;
+	public static final int BUCKET_COUNT = (int) (MAX_LATENCY_NS / BUCKET_NS) + 1;
+
+	// Variables.
+	private final long[] counts = new long[BUCKET_COUNT];
+	private volatile long totalCount;
+
+	/**
+	 * Records the given duration.
+	 *
+	 * @param durationNs Duration in nanoseconds, negative values are ignored.
+	 */
+	public void record(long durationNs) {
+		if (durationNs < 0)
+			return;
+		int bucket = (int) Math.min(durationNs / BUCKET_NS, BUCKET_COUNT - 1);
+		counts[bucket]++;
+		totalCount = totalCount + 1;
+	}
+
+	/**
+	 * Returns the number of recorded durations.
+	 *
+	 * @return The number of recorded durations since creation or reset.
+	 */
+	public long getCount() {
+		return totalCount;
+	}
+
+	/**
+	 * Copies the current counts to the given array, to be later used as the
+	 * start of a window by {@link #getPercentileMs(double, long[])}.
+	 *
+	 * @param into Array of at least {@link #BUCKET_COUNT} elements.
+	 */
+	public void copyCounts(long[] into) {
+		System.arraycopy(counts, 0, into, 0, BUCKET_COUNT);
+	}
+
+	/**
+	 * Returns the given percentile of the durations recorded since the
+	 * counts were copied to {@code since}.
+	 *
+	 * @param percentile Percentile between 0 and 100.
+	 * @param since Counts copied at the start of the window, or {@code null}
+	 *              to use every recorded duration.
+	 * @return The percentile in milliseconds, or -1 if nothing was recorded.
+	 */
+	public float getPercentileMs(double percentile, long[] since) {
+		long total = 0;
+		for (int i = 0; i < BUCKET_COUNT; i++)
+			total += counts[i] - (since == null ? 0 : since[i]);
+		if (total <= 0)
+			return -1;
+
+		long rank = (long) Math.ceil(total * percentile / 100);
+		long seen = 0;
+		for (int i = 0; i < BUCKET_COUNT; i++) {
+			seen += counts[i] - (since == null ? 0 : since[i]);
+			if (seen >= rank && seen > 0)
+				return (i + 1) * BUCKET_NS / 1_000_000f;
+		}
+		return MAX_LATENCY_NS / 1_000_000f;
+	}
+
+	/**
+	 * Clears every count.
+	 */
+	public void reset() {
+		for (int i = 0; i < BUCKET_COUNT; i++)
+			counts[i] = 0;
+		totalCount = 0;
+	}
+}
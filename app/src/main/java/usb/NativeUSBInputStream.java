@@ -0,0 +1,275 @@
+/*
+ * Copyright 2019, Digi International Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+package usb;
+
+import java.io.IOException;
+import java.io.InputStream;
+import java.nio.ByteBuffer;
+
+import android.hardware.usb.UsbDeviceConnection;
+import android.hardware.usb.UsbEndpoint;
+import android.os.Build;
+import android.util.Log;
+
+/**
+ * This class reads data from the USB Interface in Android through the
+ * {@code usbreader} native library, which keeps several bulk URBs queued on
+ * the receive end point with {@code usbdevfs} directly. It behaves like an
+ * {@code InputStream} class.
+ *
+ * <p>Like {@link AndroidUSBAsyncInputStream}, the device never waits for the
+ * host between two transfers, but without a {@code UsbRequest} per transfer:
+ * the kernel writes each transfer into its own slot of a single direct
+ * {@code ByteBuffer} ring, allocated up front, and a slot is submitted again
+ * as soon as its content has been fully consumed by the reader. Nothing is
+ * allocated or pinned per transfer.</p>
+ *
+ * <p>{@link #read(byte[], int, int)} copies the slot into the caller's array.
+ * The capture thread uses {@link #transferTo(BroadcastRingBuffer)} instead,
+ * which copies the slot straight into the capture ring.</p>
+ *
+ * <p>The stream reads the file descriptor of the connection, whose interface
+ * must be claimed. It must not be used along with {@code UsbRequest}s on the
+ * same connection, as {@code requestWait} would reap its transfers.</p>
+ *
+ * <p>Reads only move bytes: an empty transfer is returned as is, asking the
+ * goggles to stream again is left to the connection's control thread.</p>
+ */
+public class NativeUSBInputStream extends InputStream {
+
+	private static final String TAG = "USBNativeInputStream";
+	// Constants.
+	private static final int READ_TIMEOUT = 100;
+	// errno values returned by the native library.
+	private static final int ETIMEDOUT = 110;
+
+	public static final int DEFAULT_REQUEST_COUNT = 8;
+	public static final int DEFAULT_REQUEST_SIZE = 16384;
+	// Older kernels limit transfers to 16 KB, keep to the limit of the other
+	// streams on those Android versions.
+	private static final int LEGACY_MAX_REQUEST_SIZE = 16384;
+
+	private static final boolean AVAILABLE = loadLibrary();
+
+	// Variables.
+	private long handle;
+
+	private final int requestCount;
+
+	private final ByteBuffer[] buffers;
+
+	private int currentSlot = -1;
+	private ByteBuffer currentBuffer;
+
+	private boolean working = false;
+
+	private final byte[] singleByte = new byte[1];
+
+	/**
+	 * Returns whether the native library could be loaded, the stream can only
+	 * be used if so.
+	 *
+	 * @return {@code true} if the native library is loaded.
+	 */
+	public static boolean isAvailable() {
+		return AVAILABLE;
+	}
+
+	private static boolean loadLibrary() {
+		try {
+			System.loadLibrary("usbreader");
+			return true;
+		} catch (UnsatisfiedLinkError e) {
+			Log.w(TAG, "native usb reader unavailable: " + e.getMessage());
+			return false;
+		}
+	}
+
+	/**
+	 * Class constructor. Instantiates a new {@code NativeUSBInputStream}
+	 * object with the given parameters.
+	 *
+	 * @param readEndpoint The USB end point to use to read data from.
+	 * @param connection The USB connection to use to read data from.
+	 * @param requestCount Number of transfers kept queued on the end point.
+	 * @param requestSize Size in bytes of each ring slot, capped to 16 KB on
+	 *                    Android versions older than P.
+	 *
+	 * @throws IllegalArgumentException if {@code requestCount < 1} or
+	 *                                  if {@code requestSize < 1}.
+	 * @throws IllegalStateException if the native library is not available
+	 *                               or couldn't allocate its URBs.
+	 *
+	 * @see UsbDeviceConnection
+	 * @see UsbEndpoint
+	 */
+	public NativeUSBInputStream(UsbEndpoint readEndpoint, UsbDeviceConnection connection, int requestCount, int requestSize) {
+		if (requestCount < 1)
+			throw new IllegalArgumentException("Request count must be greater than 0.");
+		if (requestSize < 1)
+			throw new IllegalArgumentException("Request size must be greater than 0.");
+		if (!AVAILABLE)
+			throw new IllegalStateException("Native usb reader unavailable.");
+
+		if (Build.VERSION.SDK_INT < Build.VERSION_CODES.P)
+			requestSize = Math.min(requestSize, LEGACY_MAX_REQUEST_SIZE);
+
+		this.requestCount = requestCount;
+		this.buffers = new ByteBuffer[requestCount];
+
+		ByteBuffer ring = ByteBuffer.allocateDirect(requestCount * requestSize);
+		for (int i = 0; i < requestCount; i++) {
+			ring.limit((i + 1) * requestSize);
+			ring.position(i * requestSize);
+			buffers[i] = ring.slice();
+		}
+		ring.clear();
+
+		handle = nativeOpen(connection.getFileDescriptor(), readEndpoint.getAddress(), ring, requestCount, requestSize);
+		if (handle == 0)
+			throw new IllegalStateException("Unable to allocate the native usb reader.");
+	}
+
+	/**
+	 * Submits every slot of the ring to the receive end point.
+	 */
+	private void startRequests() throws IOException {
+		working = true;
+		for (int i = 0; i < requestCount; i++)
+			submit(i);
+	}
+
+	private void submit(int slot) throws IOException {
+		int result = nativeSubmit(handle, slot);
+		if (result < 0)
+			throw new IOException("USB URB submit failed, errno " + -result);
+	}
+
+	@Override
+	public int read() throws IOException {
+		int receivedBytes = read(singleByte, 0, 1);
+		if (receivedBytes <= 0)
+			return -1;
+		return singleByte[0] & 0xFF;
+	}
+
+	@Override
+	public int read(byte[] buffer, int offset, int length) throws IOException {
+		if (!working)
+			startRequests();
+
+		if (currentBuffer == null || !currentBuffer.hasRemaining()) {
+			if (!nextBuffer())
+				return 0;
+		}
+
+		int readBytes = Math.min(length, currentBuffer.remaining());
+		currentBuffer.get(buffer, offset, readBytes);
+		return readBytes;
+	}
+
+	/**
+	 * Writes the rest of the current transfer, or the next one, to the given
+	 * ring as one chunk, copying it from the slot directly.
+	 *
+	 * @param ring Ring to write to, from its producer thread.
+	 * @return The number of bytes written, 0 on timeout or empty transfer.
+	 *
+	 * @throws IOException if a transfer could not be submitted or reaped.
+	 */
+	public int transferTo(BroadcastRingBuffer ring) throws IOException {
+		if (!working)
+			startRequests();
+
+		if (currentBuffer == null || !currentBuffer.hasRemaining()) {
+			if (!nextBuffer())
+				return 0;
+		}
+
+		int readBytes = currentBuffer.remaining();
+		ring.write(currentBuffer, System.nanoTime());
+		return readBytes;
+	}
+
+	/**
+	 * Submits the slot whose content has been consumed again and waits for
+	 * the next completed transfer.
+	 *
+	 * @return {@code true} if a non empty slot is ready to be consumed.
+	 */
+	private boolean nextBuffer() throws IOException {
+		if (currentSlot >= 0) {
+			int slot = currentSlot;
+			currentSlot = -1;
+			currentBuffer = null;
+			submit(slot);
+		}
+
+		long startTime = System.nanoTime();
+		long result = nativeReap(handle, READ_TIMEOUT);
+		if (result == -ETIMEDOUT) {
+			PipelineStats.getInstance().onUsbTransfer(0, System.nanoTime() - startTime);
+			return false;
+		}
+		if (result < 0)
+			throw new IOException("USB URB reap failed, errno " + -result);
+
+		currentSlot = (int) (result >>> 32);
+		currentBuffer = buffers[currentSlot];
+		currentBuffer.clear();
+		currentBuffer.limit((int) result);
+		PipelineStats.getInstance().onUsbTransfer(currentBuffer.remaining(), System.nanoTime() - startTime);
+		return currentBuffer.hasRemaining();
+	}
+
+	/**
+	 * Discards every queued transfer and waits for them to be returned, so
+	 * the stream can be read again later (the ring is submitted again on
+	 * next read).
+	 */
+	@Override
+	public void close() throws IOException {
+		if (!working)
+			return;
+		working = false;
+		currentSlot = -1;
+		currentBuffer = null;
+		nativeCancel(handle);
+	}
+
+	/**
+	 * Closes the stream and releases the native resources. The stream cannot
+	 * be used anymore afterwards.
+	 */
+	public void release() throws IOException {
+		if (handle == 0)
+			return;
+		close();
+		nativeRelease(handle);
+		handle = 0;
+	}
+
+	private static native long nativeOpen(int fd, int endpointAddress, ByteBuffer ring, int requestCount, int requestSize);
+
+	private static native int nativeSubmit(long handle, int slot);
+
+	private static native long nativeReap(long handle, int timeoutMs);
+
+	private static native void nativeCancel(long handle);
+
+	private static native void nativeRelease(long handle);
+
+}
@@ -0,0 +1,522 @@
+/*
+ * Copyright 2019, Digi International Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+package usb;
+
+import java.util.concurrent.atomic.AtomicLong;
+
+/**
+ * Instrumentation shared by every stage of the video pipeline.
+ *
+ * <p>Each stage records its latency in its own {@link LatencyHistogram}:</p>
+ * <ul>
+ *     <li>{@link Stage#USB_TRANSFER}: duration of a USB transfer.</li>
+ *     <li>{@link Stage#RING_BUFFER}: time spent by bytes in a ring buffer,
+ *     from enqueue to dequeue.</li>
+ *     <li>{@link Stage#EXTRACTOR}: from the arrival of a frame's first bytes
+ *     to the output of its sample.</li>
+ *     <li>{@link Stage#DECODER}: from arrival to decoder output.</li>
+ *     <li>{@link Stage#RENDER}: from arrival to release on screen.</li>
+ *     <li>{@link Stage#STEREO_GPU}: GPU time of a stereo render pass, only
+ *     recorded in stereo mode.</li>
+ * </ul>
+ *
+ * <p>Frames are followed through the pipeline by their presentation time:
+ * stages that know when a frame arrived call
+ * {@link #markFrameArrival(long, long)}, later stages look this arrival time
+ * up again. Recording never allocates.</p>
+ *
+ * <p>The sizes of USB transfers are counted in a {@link SizeHistogram}, see
+ * {@link #getTransferSizes()}.</p>
+ */
+public class PipelineStats {
+
+	public enum Stage {
+		USB_TRANSFER,
+		RING_BUFFER,
+		EXTRACTOR,
+		DECODER,
+		RENDER,
+		STEREO_GPU
+	}
+
+	// Constants.
+	private static final int TIMELINE_SIZE = 256;
+
+	private static final PipelineStats INSTANCE = new PipelineStats();
+
+	// Variables.
+	private final LatencyHistogram[] histograms = new LatencyHistogram[Stage.values().length];
+	private final SizeHistogram transferSizes = new SizeHistogram();
+
+	private final long[] timelinePresentationTimesUs = new long[TIMELINE_SIZE];
+	private final long[] timelineArrivalTimesNs = new long[TIMELINE_SIZE];
+	private int timelineIndex;
+
+	// Counters are incremented from several threads: USB, extractor, decoder and render.
+	private final AtomicLong receivedBytes = new AtomicLong();
+	private final AtomicLong transferCount = new AtomicLong();
+	private final AtomicLong extractedFrames = new AtomicLong();
+	private final AtomicLong decodedFrames = new AtomicLong();
+	private final AtomicLong renderedFrames = new AtomicLong();
+	private final AtomicLong droppedFrames = new AtomicLong();
+	private final AtomicLong skippedFrames = new AtomicLong();
+
+	private final AtomicLong bufferOverruns = new AtomicLong();
+
+	private final AtomicLong iSlices = new AtomicLong();
+	private final AtomicLong pSlices = new AtomicLong();
+	private final AtomicLong bSlices = new AtomicLong();
+	private final AtomicLong frameNumGaps = new AtomicLong();
+	private final AtomicLong missingFrames = new AtomicLong();
+	private final AtomicLong lostSlices = new AtomicLong();
+	private final AtomicLong truncatedNalUnits = new AtomicLong();
+	private final AtomicLong corruptNalUnits = new AtomicLong();
+	private volatile long bitstreamBitrate;
+
+	private final AtomicLong concealments = new AtomicLong();
+	private final AtomicLong concealedFrames = new AtomicLong();
+
+	private volatile int bufferUsedBytes;
+	private volatile int bufferCapacityBytes;
+
+	private volatile int thermalStatus = -1;
+
+	private volatile long stallLastDataNs;
+	private volatile long pendingResumeNs;
+	private final AtomicLong reconnectCount = new AtomicLong();
+	private volatile long lastReconnectFirstFrameMs;
+	private volatile long lastReconnectBlindMs;
+
+	/**
+	 * Returns the statistics of the running pipeline.
+	 *
+	 * @return The shared {@code PipelineStats}.
+	 */
+	public static PipelineStats getInstance() {
+		return INSTANCE;
+	}
+
+	private PipelineStats() {
+		for (int i = 0; i < histograms.length; i++)
+			histograms[i] = new LatencyHistogram();
+	}
+
+	/**
+	 * Returns the latency histogram of the given stage.
+	 *
+	 * @param stage Pipeline stage.
+	 * @return The stage histogram.
+	 */
+	public LatencyHistogram getHistogram(Stage stage) {
+		return histograms[stage.ordinal()];
+	}
+
+	/**
+	 * Records a completed USB transfer.
+	 *
+	 * @param bytes Number of bytes received.
+	 * @param durationNs Duration of the transfer in nanoseconds.
+	 */
+	public void onUsbTransfer(int bytes, long durationNs) {
+		if (bytes > 0)
+			receivedBytes.addAndGet(bytes);
+		transferCount.incrementAndGet();
+		// A timed out bulk transfer reports -1, counted as empty.
+		transferSizes.record(Math.max(bytes, 0));
+		histograms[Stage.USB_TRANSFER.ordinal()].record(durationNs);
+	}
+
+	/**
+	 * Returns the sizes of the USB transfers, timeouts counting as empty.
+	 *
+	 * @return The transfer size histogram.
+	 */
+	public SizeHistogram getTransferSizes() {
+		return transferSizes;
+	}
+
+	/**
+	 * Records the time bytes spent in a ring buffer.
+	 *
+	 * @param latencyNs Time between enqueue and dequeue in nanoseconds.
+	 */
+	public void onRingBufferDequeue(long latencyNs) {
+		histograms[Stage.RING_BUFFER.ordinal()].record(latencyNs);
+	}
+
+	/**
+	 * Records the GPU time of a stereo render pass.
+	 *
+	 * @param durationNs GPU time of the pass in nanoseconds.
+	 */
+	public void onStereoPass(long durationNs) {
+		histograms[Stage.STEREO_GPU.ordinal()].record(durationNs);
+	}
+
+	/**
+	 * Reports the occupancy of the ring buffer currently in use.
+	 *
+	 * @param usedBytes Bytes waiting to be read.
+	 * @param capacityBytes Capacity of the buffer.
+	 */
+	public void setBufferOccupancy(int usedBytes, int capacityBytes) {
+		bufferUsedBytes = usedBytes;
+		bufferCapacityBytes = capacityBytes;
+	}
+
+	/**
+	 * Reports the thermal status of the device.
+	 *
+	 * @param status One of the {@code PowerManager.THERMAL_STATUS_*}
+	 *               constants.
+	 */
+	public void setThermalStatus(int status) {
+		thermalStatus = status;
+	}
+
+	/**
+	 * Returns the last reported thermal status of the device.
+	 *
+	 * @return One of the {@code PowerManager.THERMAL_STATUS_*} constants, or
+	 *         -1 if unknown.
+	 */
+	public int getThermalStatus() {
+		return thermalStatus;
+	}
+
+	/**
+	 * Remembers when the first bytes of the frame with the given presentation
+	 * time arrived.
+	 *
+	 * @param presentationTimeUs Presentation time of the frame.
+	 * @param arrivalTimeNs Arrival time, as given by {@code System.nanoTime()}.
+	 */
+	public synchronized void markFrameArrival(long presentationTimeUs, long arrivalTimeNs) {
+		timelineIndex = (timelineIndex + 1) % TIMELINE_SIZE;
+		timelinePresentationTimesUs[timelineIndex] = presentationTimeUs;
+		timelineArrivalTimesNs[timelineIndex] = arrivalTimeNs;
+	}
+
+	/**
+	 * Returns the arrival time of the latest marked frame whose presentation
+	 * time is not after the given one.
+	 *
+	 * @param presentationTimeUs Presentation time of the frame.
+	 * @return Its arrival time, or -1 if unknown.
+	 */
+	public synchronized long getFrameArrival(long presentationTimeUs) {
+		for (int i = 0; i < TIMELINE_SIZE; i++) {
+			int index = (timelineIndex - i + TIMELINE_SIZE) % TIMELINE_SIZE;
+			long arrivalTimeNs = timelineArrivalTimesNs[index];
+			if (arrivalTimeNs == 0)
+				return -1;
+			if (timelinePresentationTimesUs[index] <= presentationTimeUs)
+				return arrivalTimeNs;
+		}
+		return -1;
+	}
+
+	/**
+	 * Records the output of a sample by the extractor.
+	 *
+	 * @param presentationTimeUs Presentation time of the sample.
+	 */
+	public void onSampleExtracted(long presentationTimeUs) {
+		extractedFrames.incrementAndGet();
+		recordSinceArrival(Stage.EXTRACTOR, presentationTimeUs, System.nanoTime());
+	}
+
+	/**
+	 * Records the output of a frame by the decoder.
+	 *
+	 * @param presentationTimeUs Presentation time of the frame.
+	 */
+	public void onFrameDecoded(long presentationTimeUs) {
+		decodedFrames.incrementAndGet();
+		recordSinceArrival(Stage.DECODER, presentationTimeUs, System.nanoTime());
+	}
+
+	/**
+	 * Records the release of a frame to the screen.
+	 *
+	 * @param presentationTimeUs Presentation time of the frame.
+	 * @param releaseTimeNs Time at which the frame is displayed, as given by
+	 *                      {@code System.nanoTime()}.
+	 */
+	public void onFrameRendered(long presentationTimeUs, long releaseTimeNs) {
+		renderedFrames.incrementAndGet();
+		recordSinceArrival(Stage.RENDER, presentationTimeUs, releaseTimeNs);
+		long resumeNs = pendingResumeNs;
+		if (resumeNs != 0) {
+			pendingResumeNs = 0;
+			lastReconnectFirstFrameMs = (releaseTimeNs - resumeNs) / 1_000_000;
+			lastReconnectBlindMs = (releaseTimeNs - stallLastDataNs) / 1_000_000;
+			reconnectCount.incrementAndGet();
+		}
+	}
+
+	/**
+	 * Records a stall of the incoming stream.
+	 *
+	 * @param lastDataNs Arrival time of the last data before the stall, as
+	 *                   given by {@code System.nanoTime()}.
+	 */
+	public void onStreamStalled(long lastDataNs) {
+		stallLastDataNs = lastDataNs;
+		pendingResumeNs = 0;
+	}
+
+	/**
+	 * Records data flowing again after a stall. The next rendered frame
+	 * completes the reconnection, see {@link #getLastReconnectFirstFrameMs()}.
+	 *
+	 * @param resumeNs Arrival time of the first data, as given by
+	 *                 {@code System.nanoTime()}.
+	 */
+	public void onStreamResumed(long resumeNs) {
+		pendingResumeNs = resumeNs;
+	}
+
+	/**
+	 * Records frames dropped by the decoder or the renderer.
+	 *
+	 * @param count Number of dropped frames.
+	 */
+	public void onFramesDropped(int count) {
+		droppedFrames.addAndGet(count);
+	}
+
+	/**
+	 * Records frames discarded before decoding to catch up with the live
+	 * stream.
+	 *
+	 * @param count Number of skipped frames.
+	 */
+	public void onFramesSkipped(int count) {
+		skippedFrames.addAndGet(count);
+	}
+
+	/**
+	 * Records data dropped because a ring buffer was full.
+	 */
+	public void onBufferOverrun() {
+		bufferOverruns.incrementAndGet();
+	}
+
+	/**
+	 * Records a parsed slice, by {@code slice_type}: 0 and 5 are P slices,
+	 * 1 and 6 B slices, the others I, SP and SI slices.
+	 *
+	 * @param sliceType The {@code slice_type} of the slice header.
+	 */
+	public void onSlice(int sliceType) {
+		switch (sliceType % 5) {
+			case 0:
+				pSlices.incrementAndGet();
+				break;
+			case 1:
+				bSlices.incrementAndGet();
+				break;
+			default:
+				iSlices.incrementAndGet();
+				break;
+		}
+	}
+
+	/**
+	 * Records a gap in {@code frame_num}, i.e. reference pictures that never
+	 * arrived.
+	 *
+	 * @param missing Number of missing reference pictures.
+	 */
+	public void onFrameNumGap(int missing) {
+		frameNumGaps.incrementAndGet();
+		missingFrames.addAndGet(missing);
+	}
+
+	/**
+	 * Records a picture whose first slice never arrived.
+	 */
+	public void onLostSlice() {
+		lostSlices.incrementAndGet();
+	}
+
+	/**
+	 * Records a NAL unit too short for its header to be parsed.
+	 */
+	public void onTruncatedNalUnit() {
+		truncatedNalUnits.incrementAndGet();
+	}
+
+	/**
+	 * Records a NAL unit with its forbidden bit set.
+	 */
+	public void onCorruptNalUnit() {
+		corruptNalUnits.incrementAndGet();
+	}
+
+	/**
+	 * Reports the bitrate of the stream over the last second.
+	 *
+	 * @param bitsPerSecond The measured bitrate.
+	 */
+	public void setBitstreamBitrate(long bitsPerSecond) {
+		bitstreamBitrate = bitsPerSecond;
+	}
+
+	/**
+	 * Records a loss after which decoding stopped until the next recovery
+	 * point.
+	 */
+	public void onConcealment() {
+		concealments.incrementAndGet();
+	}
+
+	/**
+	 * Records an access unit not decoded while concealing a loss.
+	 */
+	public void onFrameConcealed() {
+		concealedFrames.incrementAndGet();
+	}
+
+	private void recordSinceArrival(Stage stage, long presentationTimeUs, long nowNs) {
+		long arrivalTimeNs = getFrameArrival(presentationTimeUs);
+		if (arrivalTimeNs > 0)
+			histograms[stage.ordinal()].record(nowNs - arrivalTimeNs);
+	}
+
+	public long getConcealments() {
+		return concealments.get();
+	}
+
+	public long getConcealedFrames() {
+		return concealedFrames.get();
+	}
+
+	public long getBufferOverruns() {
+		return bufferOverruns.get();
+	}
+
+	public long getISlices() {
+		return iSlices.get();
+	}
+
+	public long getPSlices() {
+		return pSlices.get();
+	}
+
+	public long getBSlices() {
+		return bSlices.get();
+	}
+
+	public long getFrameNumGaps() {
+		return frameNumGaps.get();
+	}
+
+	public long getMissingFrames() {
+		return missingFrames.get();
+	}
+
+	public long getLostSlices() {
+		return lostSlices.get();
+	}
+
+	public long getTruncatedNalUnits() {
+		return truncatedNalUnits.get();
+	}
+
+	public long getCorruptNalUnits() {
+		return corruptNalUnits.get();
+	}
+
+	public long getBitstreamBitrate() {
+		return bitstreamBitrate;
+	}
+
+	public long getReceivedBytes() {
+		return receivedBytes.get();
+	}
+
+	public long getTransferCount() {
+		return transferCount.get();
+	}
+
+	public long getExtractedFrames() {
+		return extractedFrames.get();
+	}
+
+	public long getDecodedFrames() {
+		return decodedFrames.get();
+	}
+
+	public long getRenderedFrames() {
+		return renderedFrames.get();
+	}
+
+	public long getDroppedFrames() {
+		return droppedFrames.get();
+	}
+
+	public long getSkippedFrames() {
+		return skippedFrames.get();
+	}
+
+	public long getReconnectCount() {
+		return reconnectCount.get();
+	}
+
+	/**
+	 * Returns the time from data flowing again to the first rendered frame,
+	 * for the last reconnection.
+	 *
+	 * @return The time to first frame in milliseconds.
+	 */
+	public long getLastReconnectFirstFrameMs() {
+		return lastReconnectFirstFrameMs;
+	}
+
+	/**
+	 * Returns the time from the last data received before a stall to the
+	 * first frame rendered after it, for the last reconnection.
+	 *
+	 * @return The time without video in milliseconds.
+	 */
+	public long getLastReconnectBlindMs() {
+		return lastReconnectBlindMs;
+	}
+
+	public int getBufferUsedBytes() {
+		return bufferUsedBytes;
+	}
+
+	public int getBufferCapacityBytes() {
+		return bufferCapacityBytes;
+	}
+
+	/**
+	 * Clears the frame timeline, to be called when the pipeline restarts and
+	 * presentation times start again from zero.
+	 */
+	public synchronized void resetTimeline() {
+		for (int i = 0; i < TIMELINE_SIZE; i++) {
+			timelinePresentationTimesUs[i] = 0;
+			timelineArrivalTimesNs[i] = 0;
+		}
+		timelineIndex = 0;
+		bufferUsedBytes = 0;
+		bufferCapacityBytes = 0;
+	}
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2019, Digi International Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+package usb;
+
+/**
+ * Power of two size histogram, recording byte counts up to
+ * {@link #MAX_SIZE_BYTES}. Bucket 0 counts empty sizes, bucket {@code i}
+ * counts sizes from {@code 2^(i-1)} to {@code 2^i - 1}. Larger sizes are
+ * counted in the last bucket.
+ *
+ * <p>Like {@link LatencyHistogram}, counts are cumulative, recording never
+ * allocates and is meant to be done by a single thread. Distributions over a
+ * time window are the difference with a copy of the counts taken at the start
+ * of the window.</p>
+ */
+public class SizeHistogram {
+
+	// Constants.
+	public static final int MAX_SIZE_BYTES = 1 << 20;
+	public static final int BUCKET_COUNT = 22;
+
+	// Variables.
+	private final long[] counts = new long[BUCKET_COUNT];
+
+	/**
+	 * Records the given size.
+	 *
+	 * @param bytes Size in bytes, negative values are ignored.
+	 */
+	public void record(int bytes) {
+		if (bytes < 0)
+			return;
+		counts[Math.min(32 - Integer.numberOfLeadingZeros(bytes), BUCKET_COUNT - 1)]++;
+	}
+
+	/**
+	 * Copies the current counts to the given array.
+	 *
+	 * @param into Array of at least {@link #BUCKET_COUNT} elements.
+	 */
+	public void copyCounts(long[] into) {
+		System.arraycopy(counts, 0, into, 0, BUCKET_COUNT);
+	}
+
+	/**
+	 * Returns the smallest size counted in the given bucket.
+	 *
+	 * @param bucket Bucket index, from 0 to {@link #BUCKET_COUNT} - 1.
+	 * @return The lower bound of the bucket in bytes.
+	 */
+	public static int getBucketMinBytes(int bucket) {
+		return bucket == 0 ? 0 : 1 << (bucket - 1);
+	}
+
+	/**
+	 * Clears every count.
+	 */
+	public void reset() {
+		for (int i = 0; i < BUCKET_COUNT; i++)
+			counts[i] = 0;
+	}
+}
@@ -0,0 +1,125 @@
+package com.fpvout.digiview;
+
+import org.junit.Test;
+
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.List;
+
+import static org.junit.Assert.assertArrayEquals;
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertFalse;
+import static org.junit.Assert.assertTrue;
+
+public class AccessUnitAssemblerTest {
+    // A key frame (AUD, SPS, PPS and IDR slice) followed by two non-IDR frames.
+    private static final byte[] STREAM = {
+            0, 0, 0, 1, 0x09, (byte) 0xF0,
+            0, 0, 1, 0x67, 0x42, 0, 0x1F,
+            0, 0, 1, 0x68, (byte) 0xCE, 0x3C, (byte) 0x80,
+            0, 0, 0, 1, 0x65, (byte) 0x88, 0, 0, 2, 0x10,
+            0, 0, 1, 0x41, (byte) 0x9A, 0, 0,
+            0, 0, 1, 0x41, (byte) 0x9A, 0x01,
+    };
+    // The first zero of a 4 byte start code is left to the previous access unit, there is none for the first one.
+    private static final int[] ACCESS_UNIT_STARTS = {1, 30, 37};
+    private static final int[] ACCESS_UNIT_ENDS = {30, 37, 43};
+
+    private final List<byte[]> accessUnits = new ArrayList<>();
+    private final List<Boolean> keyFrames = new ArrayList<>();
+    private final List<Long> arrivalTimes = new ArrayList<>();
+
+    @Test
+    public void emitsEachAccessUnitWhenTheNextOneStarts() {
+        AccessUnitAssembler assembler = newAssembler();
+        assembler.consume(STREAM, 0, STREAM.length, 0);
+        assertEquals(2, accessUnits.size());
+        assembler.flush();
+        assertAccessUnits(0);
+        assertEquals(Arrays.asList(true, false, false), keyFrames);
+        assembler.release();
+    }
+
+    @Test
+    public void reassemblesAccessUnitsSplitAnywhere() {
+        for (int split = 1; split < STREAM.length; split++) {
+            accessUnits.clear();
+            AccessUnitAssembler assembler = newAssembler();
+            assembler.consume(STREAM, 0, split, 0);
+            assembler.consume(STREAM, split, STREAM.length - split, 0);
+            assembler.flush();
+            assertAccessUnits(0);
+            assembler.release();
+        }
+    }
+
+    @Test
+    public void reassemblesAccessUnitsFromSingleBytes() {
+        AccessUnitAssembler assembler = newAssembler();
+        for (int i = 0; i < STREAM.length; i++) {
+            assembler.consume(STREAM, i, 1, 0);
+        }
+        assembler.flush();
+        assertAccessUnits(0);
+        assembler.release();
+    }
+
+    @Test
+    public void dropsThePartialAccessUnitBeforeTheFirstStart() {
+        AccessUnitAssembler assembler = newAssembler();
+        // Starts in the middle of the key frame's slice.
+        assembler.consume(STREAM, 26, STREAM.length - 26, 0);
+        assembler.flush();
+        assertAccessUnits(2);
+        assembler.release();
+    }
+
+    @Test
+    public void stampsAccessUnitsWithTheChunkCompletingThem() {
+        AccessUnitAssembler assembler = newAssembler();
+        assembler.consume(STREAM, 0, 32, 100);
+        assembler.consume(STREAM, 32, 8, 200);
+        assembler.consume(STREAM, 40, STREAM.length - 40, 300);
+        assembler.flush();
+        assertEquals(Arrays.asList(200L, 300L, 300L), arrivalTimes);
+        assembler.release();
+    }
+
+    @Test
+    public void resetDropsThePendingAccessUnit() {
+        AccessUnitAssembler assembler = newAssembler();
+        assembler.consume(STREAM, 0, 35, 0);
+        assertEquals(1, accessUnits.size());
+        assembler.reset();
+        assembler.flush();
+        assertEquals(1, accessUnits.size());
+
+        // Afterwards, like at the start of a stream, a whole access unit is needed.
+        assembler.consume(STREAM, 0, STREAM.length, 0);
+        assembler.flush();
+        assertEquals(4, accessUnits.size());
+        assertArrayEquals(Arrays.copyOfRange(STREAM, 1, 30), accessUnits.get(1));
+        assertTrue(keyFrames.get(1));
+        assertFalse(keyFrames.get(2));
+        assembler.release();
+    }
+
+    private AccessUnitAssembler newAssembler() {
+        // Smaller than the access units, so they grow while assembled.
+        return new AccessUnitAssembler(4, (data, length, keyFrame, arrivalTimeNs) -> {
+            accessUnits.add(Arrays.copyOf(data, length));
+            keyFrames.add(keyFrame);
+            arrivalTimes.add(arrivalTimeNs);
+        });
+    }
+
+    /**
+     * Checks that the access units of {@link #STREAM} from the given one on were emitted, byte for byte.
+     */
+    private void assertAccessUnits(int first) {
+        assertEquals(ACCESS_UNIT_ENDS.length - first, accessUnits.size());
+        for (int i = first; i < ACCESS_UNIT_ENDS.length; i++) {
+            assertArrayEquals("access unit " + i, Arrays.copyOfRange(STREAM, ACCESS_UNIT_STARTS[i], ACCESS_UNIT_ENDS[i]), accessUnits.get(i - first));
+        }
+    }
+}
@@ -0,0 +1,140 @@
+package com.fpvout.digiview;
+
+import org.junit.Test;
+
+import java.io.ByteArrayOutputStream;
+import java.util.Arrays;
+
+import usb.CircularByteBuffer;
+
+import static org.junit.Assert.assertArrayEquals;
+import static org.junit.Assert.assertEquals;
+
+public class CatchUpPolicyTest {
+    private static final int THRESHOLD = 64;
+    private static final int FRAME_SIZE = 40;
+    private static final int REFERENCE_SLICE = 0x41;
+    private static final int NON_REFERENCE_SLICE = 0x01;
+    private static final int IDR_SLICE = 0x65;
+
+    private final CircularByteBuffer buffer = new CircularByteBuffer(1024);
+    private final CatchUpPolicy policy = new CatchUpPolicy(THRESHOLD);
+
+    @Test
+    public void leavesSmallBacklogsAlone() {
+        // A key frame behind the one being read, but within the threshold.
+        write(Arrays.copyOf(frame(REFERENCE_SLICE), 20), frame(IDR_SLICE));
+        assertEquals(0, policy.catchUp(buffer));
+        assertEquals(100, policy.limitReadLength(100));
+        assertEquals(0, policy.getSkippedFrames());
+    }
+
+    @Test
+    public void finishesTheFrameBeingReadThenSkipsToTheNewestKeyFrame() {
+        byte[] keyFrame = concat(parameterSet(0x67), parameterSet(0x68), frame(IDR_SLICE));
+        write(Arrays.copyOf(frame(REFERENCE_SLICE), 20), frame(REFERENCE_SLICE), frame(REFERENCE_SLICE), keyFrame, frame(REFERENCE_SLICE));
+        buffer.skip(10);
+        policy.onRead(10);
+
+        // The rest of the frame being read.
+        assertEquals(0, policy.catchUp(buffer));
+        assertEquals(10, policy.limitReadLength(100));
+        read(10);
+
+        assertEquals(2 * FRAME_SIZE, policy.catchUp(buffer));
+        assertEquals(2, policy.getSkippedFrames());
+        assertEquals(100, policy.limitReadLength(100));
+        assertArrayEquals(keyFrame, read(keyFrame.length));
+    }
+
+    @Test
+    public void findsAKeyFrameWhoseHeaderEndsTheArray() {
+        // The key frame's slice header is the last byte of the array, first_mb_in_slice wraps around.
+        byte[] padding = new byte[1024 - FRAME_SIZE - 4];
+        buffer.write(padding, 0, padding.length);
+        buffer.skip(padding.length);
+        policy.onRead(padding.length);
+        write(frame(REFERENCE_SLICE), frame(IDR_SLICE), frame(REFERENCE_SLICE), frame(REFERENCE_SLICE));
+
+        assertEquals(0, policy.catchUp(buffer));
+        assertEquals(0, policy.limitReadLength(100));
+        assertEquals(FRAME_SIZE, policy.catchUp(buffer));
+        assertEquals(1, policy.getSkippedFrames());
+        assertArrayEquals(frame(IDR_SLICE), read(FRAME_SIZE));
+    }
+
+    @Test
+    public void skipsLeadingNonReferenceFramesWithoutAKeyFrame() {
+        write(frame(NON_REFERENCE_SLICE), frame(NON_REFERENCE_SLICE), frame(REFERENCE_SLICE), frame(NON_REFERENCE_SLICE));
+        assertEquals(0, policy.catchUp(buffer));
+        assertEquals(2 * FRAME_SIZE, policy.catchUp(buffer));
+        assertEquals(2, policy.getSkippedFrames());
+        assertArrayEquals(frame(REFERENCE_SLICE), read(FRAME_SIZE));
+    }
+
+    @Test
+    public void keepsReferenceFramesWithoutAKeyFrame() {
+        write(frame(REFERENCE_SLICE), frame(NON_REFERENCE_SLICE), frame(REFERENCE_SLICE), frame(REFERENCE_SLICE));
+        assertEquals(0, policy.catchUp(buffer));
+        assertEquals(0, policy.catchUp(buffer));
+        assertEquals(100, policy.limitReadLength(100));
+        assertEquals(0, policy.getSkippedFrames());
+    }
+
+    @Test
+    public void waitsForAKeyFrameAfterAnOverrun() {
+        CircularByteBuffer small = new CircularByteBuffer(128);
+        byte[] frames = concat(frame(REFERENCE_SLICE), frame(REFERENCE_SLICE), frame(REFERENCE_SLICE), frame(REFERENCE_SLICE));
+        small.write(frames, 0, frames.length);
+
+        // Everything but a possible start code tail is dropped, nothing is read meanwhile.
+        assertEquals(128 - 3, policy.catchUp(small));
+        assertEquals(0, policy.limitReadLength(100));
+
+        byte[] keyFrame = concat(parameterSet(0x67), frame(IDR_SLICE));
+        small.write(keyFrame, 0, keyFrame.length);
+        assertEquals(3, policy.catchUp(small));
+        assertEquals(100, policy.limitReadLength(100));
+        byte[] data = new byte[keyFrame.length];
+        assertEquals(keyFrame.length, small.read(data, 0, data.length));
+        assertArrayEquals(keyFrame, data);
+    }
+
+    private void write(byte[]... units) {
+        byte[] data = concat(units);
+        assertEquals(data.length, buffer.write(data, 0, data.length));
+    }
+
+    private byte[] read(int length) {
+        byte[] data = new byte[length];
+        int read = buffer.read(data, 0, policy.limitReadLength(length));
+        policy.onRead(read);
+        return Arrays.copyOf(data, read);
+    }
+
+    /**
+     * Returns a single slice frame, its first macroblock at 0.
+     */
+    private static byte[] frame(int nalHeader) {
+        byte[] data = new byte[FRAME_SIZE];
+        Arrays.fill(data, (byte) 0x55);
+        data[0] = 0;
+        data[1] = 0;
+        data[2] = 1;
+        data[3] = (byte) nalHeader;
+        data[4] = (byte) 0x88;
+        return data;
+    }
+
+    private static byte[] parameterSet(int nalHeader) {
+        return new byte[]{0, 0, 1, (byte) nalHeader, 0x42, 0x55, 0x55, 0x55};
+    }
+
+    private static byte[] concat(byte[]... parts) {
+        ByteArrayOutputStream out = new ByteArrayOutputStream();
+        for (byte[] part : parts) {
+            out.write(part, 0, part.length);
+        }
+        return out.toByteArray();
+    }
+}
@@ -0,0 +1,65 @@
+package com.fpvout.digiview;
+
+import org.junit.Test;
+
+import static org.junit.Assert.assertEquals;
+
+public class FrameDurationEstimatorTest {
+    private static final long FRAME_30FPS_NS = 33_333_333;
+
+    @Test
+    public void startsFromTheInitialDuration() {
+        assertEquals(FrameDurationEstimator.DEFAULT_FRAME_DURATION_US, new FrameDurationEstimator().getFrameDurationUs());
+        FrameDurationEstimator estimator = new FrameDurationEstimator(20000);
+        estimator.onAccessUnit(0);
+        estimator.onAccessUnit(FRAME_30FPS_NS);
+        assertEquals(20000, estimator.getFrameDurationUs());
+    }
+
+    @Test
+    public void convergesToTheArrivalRate() {
+        FrameDurationEstimator estimator = new FrameDurationEstimator();
+        for (int i = 0; i < 30 * 20; i++) {
+            estimator.onAccessUnit(i * FRAME_30FPS_NS);
+        }
+        assertEquals(33333, estimator.getFrameDurationUs(), 100);
+    }
+
+    @Test
+    public void ignoresFramesBatchedInOneTransfer() {
+        FrameDurationEstimator estimator = new FrameDurationEstimator();
+        // Pairs of frames arriving together, at 30fps on average.
+        for (int i = 0; i < 15 * 20; i++) {
+            estimator.onAccessUnit(i * 2 * FRAME_30FPS_NS);
+            estimator.onAccessUnit(i * 2 * FRAME_30FPS_NS);
+        }
+        assertEquals(33333, estimator.getFrameDurationUs(), 1000);
+    }
+
+    @Test
+    public void clampsToTheSupportedFrameRates() {
+        FrameDurationEstimator fast = new FrameDurationEstimator();
+        FrameDurationEstimator slow = new FrameDurationEstimator();
+        for (int i = 0; i < 1000 * 20; i++) {
+            fast.onAccessUnit(i * 1_000_000L);
+        }
+        for (int i = 0; i < 10 * 20; i++) {
+            slow.onAccessUnit(i * 100_000_000L);
+        }
+        assertEquals(4166, fast.getFrameDurationUs(), 10);
+        assertEquals(41666, slow.getFrameDurationUs(), 100);
+    }
+
+    @Test
+    public void resetGoesBackToTheInitialDuration() {
+        FrameDurationEstimator estimator = new FrameDurationEstimator();
+        for (int i = 0; i < 30 * 20; i++) {
+            estimator.onAccessUnit(i * FRAME_30FPS_NS);
+        }
+        estimator.reset();
+        assertEquals(FrameDurationEstimator.DEFAULT_FRAME_DURATION_US, estimator.getFrameDurationUs());
+        // The arrival time of the first access unit after a reset only starts a window.
+        estimator.onAccessUnit(Long.MAX_VALUE / 2);
+        assertEquals(FrameDurationEstimator.DEFAULT_FRAME_DURATION_US, estimator.getFrameDurationUs());
+    }
+}
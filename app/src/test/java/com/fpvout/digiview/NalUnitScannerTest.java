@@ -0,0 +1,153 @@
+package com.fpvout.digiview;
+
+import org.junit.Test;
+
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.List;
+
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertFalse;
+import static org.junit.Assert.assertTrue;
+
+public class NalUnitScannerTest {
+    // AUD, SPS, PPS, IDR slice, and two non-IDR slices, with 3 and 4 byte start codes.
+    private static final byte[] STREAM = {
+            0, 0, 0, 1, 0x09, (byte) 0xF0,
+            0, 0, 1, 0x67, 0x42, 0, 0x1F,
+            0, 0, 1, 0x68, (byte) 0xCE, 0x3C, (byte) 0x80,
+            0, 0, 0, 1, 0x65, (byte) 0x88, 0, 0, 2, 0x10,
+            0, 0, 1, 0x41, (byte) 0x9A, 0, 0,
+            0, 0, 1, 0x41, (byte) 0x9A, 0x01,
+    };
+    private static final List<Integer> HEADERS = Arrays.asList(4, 9, 16, 24, 33, 40);
+
+    @Test
+    public void findsStartCodes() {
+        assertEquals(1, NalUnitScanner.findStartCode(STREAM, 0, STREAM.length));
+        assertEquals(6, NalUnitScanner.findStartCode(STREAM, 2, STREAM.length));
+        assertEquals(-1, NalUnitScanner.findStartCode(STREAM, 25, 30));
+        assertEquals(-1, NalUnitScanner.findStartCode(new byte[]{0, 0}, 0, 2));
+    }
+
+    @Test
+    public void findsNalUnitsInOneChunk() {
+        assertEquals(HEADERS, scanInChunksOf(new NalUnitScanner(), STREAM, STREAM.length));
+    }
+
+    @Test
+    public void findsNalUnitsSplitAnywhere() {
+        for (int split = 1; split < STREAM.length; split++) {
+            assertEquals("split at " + split, HEADERS, scan(new NalUnitScanner(), STREAM, split, STREAM.length));
+        }
+    }
+
+    @Test
+    public void findsNalUnitsSplitAnywhereTwice() {
+        for (int first = 1; first < STREAM.length; first++) {
+            for (int second = first + 1; second < STREAM.length; second++) {
+                assertEquals("split at " + first + " and " + second, HEADERS, scan(new NalUnitScanner(), STREAM, first, second, STREAM.length));
+            }
+        }
+    }
+
+    @Test
+    public void findsNalUnitsInSingleByteChunks() {
+        assertEquals(HEADERS, scanInChunksOf(new NalUnitScanner(), STREAM, 1));
+    }
+
+    @Test
+    public void carriesZerosAcrossALoneZeroChunk() {
+        byte[] data = {0x41, 0, 0, 0, 1, 0x65};
+        assertEquals(Arrays.asList(5), scan(new NalUnitScanner(), data, 1, 2, 3, 6));
+        assertEquals(Arrays.asList(5), scan(new NalUnitScanner(), data, 2, 3, 6));
+        assertEquals(Arrays.asList(5), scan(new NalUnitScanner(), data, 2, 3, 4, 6));
+        assertEquals(Arrays.asList(5), scan(new NalUnitScanner(), data, 2, 3, 5, 6));
+    }
+
+    @Test
+    public void dropsTheCarryOnNonZeroBytes() {
+        byte[] data = {0, 0, 2, 0, 1, 0x65};
+        assertTrue(scan(new NalUnitScanner(), data, 1, 2, 3, 4, 5, 6).isEmpty());
+    }
+
+    @Test
+    public void resetForgetsTheCarry() {
+        NalUnitScanner scanner = new NalUnitScanner();
+        byte[] zeros = {0, 0};
+        assertEquals(-1, scanner.findNalUnit(zeros, 0, zeros.length));
+        scanner.reset();
+        byte[] rest = {1, 0x65};
+        assertEquals(-1, scanner.findNalUnit(rest, 0, rest.length));
+    }
+
+    @Test
+    public void tellsAccessUnitStarts() {
+        NalUnitScanner scanner = new NalUnitScanner();
+        List<Boolean> starts = new ArrayList<>();
+        for (int header : HEADERS) {
+            starts.add(scanner.isAccessUnitStart(STREAM, header, STREAM.length));
+        }
+        // The AUD, then the first slice of each following picture.
+        assertEquals(Arrays.asList(true, false, false, false, true, true), starts);
+    }
+
+    @Test
+    public void parameterSetsAfterASliceStartAnAccessUnit() {
+        NalUnitScanner scanner = new NalUnitScanner();
+        byte[] data = {0x41, (byte) 0x9A, 0x67, 0x68, 0x65, (byte) 0x88};
+        assertFalse(scanner.isAccessUnitStart(data, 0, data.length));
+        assertTrue(scanner.isAccessUnitStart(data, 2, data.length));
+        assertFalse(scanner.isAccessUnitStart(data, 3, data.length));
+        assertFalse(scanner.isAccessUnitStart(data, 4, data.length));
+    }
+
+    @Test
+    public void defersASliceHeaderEndingAChunk() {
+        NalUnitScanner scanner = new NalUnitScanner();
+        byte[] first = {0x41, (byte) 0x9A, 0, 0, 1, 0x41};
+        assertFalse(scanner.deferSlice(first, 0, first.length));
+        assertFalse(scanner.isAccessUnitStart(first, 0, first.length));
+        assertTrue(scanner.deferSlice(first, 5, first.length));
+        assertTrue(scanner.isSlicePending());
+
+        byte[] slice = scanner.takePendingSlice((byte) 0x9A);
+        assertFalse(scanner.isSlicePending());
+        assertEquals(0x41, slice[0]);
+        assertTrue(scanner.isAccessUnitStart(slice, 0, slice.length));
+    }
+
+    @Test
+    public void onlyDefersSlices() {
+        NalUnitScanner scanner = new NalUnitScanner();
+        byte[] data = {0, 0, 1, 0x67};
+        assertFalse(scanner.deferSlice(data, 3, data.length));
+        assertFalse(scanner.isSlicePending());
+    }
+
+    /**
+     * Scans {@code data} in chunks ending at the given offsets, returning the offsets of the headers found.
+     */
+    private static List<Integer> scan(NalUnitScanner scanner, byte[] data, int... chunkEnds) {
+        List<Integer> headers = new ArrayList<>();
+        int chunkStart = 0;
+        for (int chunkEnd : chunkEnds) {
+            byte[] chunk = Arrays.copyOfRange(data, chunkStart, chunkEnd);
+            int header = scanner.findNalUnit(chunk, 0, chunk.length);
+            while (header != -1) {
+                headers.add(chunkStart + header);
+                header = scanner.findNalUnit(chunk, header + 1, chunk.length);
+            }
+            chunkStart = chunkEnd;
+        }
+        return headers;
+    }
+
+    private static List<Integer> scanInChunksOf(NalUnitScanner scanner, byte[] data, int chunkSize) {
+        int[] chunkEnds = new int[(data.length + chunkSize - 1) / chunkSize];
+        for (int i = 0; i < chunkEnds.length; i++) {
+            chunkEnds[i] = Math.min(data.length, (i + 1) * chunkSize);
+        }
+        return scan(scanner, data, chunkEnds);
+    }
+}
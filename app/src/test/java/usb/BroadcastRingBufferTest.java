@@ -0,0 +1,300 @@
+/*
+ * Copyright 2019, Digi International Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+package usb;
+
+import org.junit.Test;
+
+import java.nio.ByteBuffer;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.List;
+import java.util.concurrent.atomic.AtomicBoolean;
+import java.util.concurrent.atomic.AtomicReference;
+
+import static org.junit.Assert.assertArrayEquals;
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertFalse;
+import static org.junit.Assert.assertNull;
+import static org.junit.Assert.assertTrue;
+
+public class BroadcastRingBufferTest {
+
+	// Constants.
+	private static final int CHUNK_SIZE = 16;
+	private static final int HEADER_SIZE = 8;
+	private static final int HAMMER_CHUNKS = 200_000;
+	private static final int HAMMER_CURSORS = 4;
+
+	@Test
+	public void readsChunksAsWritten() {
+		BroadcastRingBuffer ring = new BroadcastRingBuffer(1024);
+		BroadcastRingBuffer.Cursor cursor = ring.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_OLDEST, 1024);
+		ring.write(chunk(1), 0, CHUNK_SIZE, 100);
+		ring.write(chunk(2), 0, CHUNK_SIZE, 200);
+
+		byte[] data = new byte[64];
+		assertEquals(CHUNK_SIZE, cursor.read(data, 0, data.length));
+		assertEquals(100, cursor.getLastArrivalTimeNs());
+		assertEquals(1, sequenceOf(data));
+		assertEquals(CHUNK_SIZE, cursor.read(data, 0, data.length));
+		assertEquals(200, cursor.getLastArrivalTimeNs());
+		assertEquals(2, sequenceOf(data));
+		assertFalse(cursor.takeDiscontinuity());
+	}
+
+	@Test
+	public void splitsReadsShorterThanAChunk() {
+		BroadcastRingBuffer ring = new BroadcastRingBuffer(1024);
+		BroadcastRingBuffer.Cursor cursor = ring.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_OLDEST, 1024);
+		byte[] written = chunk(7);
+		ring.write(written, 0, CHUNK_SIZE, 0);
+
+		byte[] data = new byte[CHUNK_SIZE];
+		assertEquals(10, cursor.read(data, 0, 10));
+		assertEquals(CHUNK_SIZE - 10, cursor.read(data, 10, CHUNK_SIZE - 10));
+		assertArrayEquals(written, data);
+	}
+
+	@Test
+	public void wrapsAroundTheEnd() {
+		BroadcastRingBuffer ring = new BroadcastRingBuffer(64);
+		BroadcastRingBuffer.Cursor cursor = ring.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_OLDEST, 64);
+		// The third chunk wraps around, the fourth starts 8 bytes in.
+		for (int i = 0; i < 4; i++) {
+			byte[] written = chunk(i, 24);
+			ring.write(written, 0, written.length, 0);
+			byte[] data = new byte[written.length];
+			assertEquals(written.length, cursor.read(data, 0, data.length));
+			assertArrayEquals(written, data);
+		}
+	}
+
+	@Test
+	public void writesByteBuffersAsOneChunk() {
+		BroadcastRingBuffer ring = new BroadcastRingBuffer(64);
+		BroadcastRingBuffer.Cursor cursor = ring.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_OLDEST, 64);
+		// The second chunk wraps around.
+		for (int i = 0; i < 2; i++) {
+			byte[] written = chunk(i, 40);
+			ByteBuffer direct = ByteBuffer.allocateDirect(written.length);
+			direct.put(written).flip();
+			ring.write(direct, 300);
+			assertFalse(direct.hasRemaining());
+
+			byte[] data = new byte[64];
+			assertEquals(written.length, cursor.read(data, 0, data.length));
+			assertEquals(300, cursor.getLastArrivalTimeNs());
+			assertArrayEquals(written, Arrays.copyOf(data, written.length));
+		}
+	}
+
+	@Test
+	public void skipToNewestDropsEverythingUnreadWhenLapped() {
+		BroadcastRingBuffer ring = new BroadcastRingBuffer(64);
+		BroadcastRingBuffer.Cursor cursor = ring.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_NEWEST, 64);
+		for (int i = 0; i < 10; i++) {
+			ring.write(chunk(i), 0, CHUNK_SIZE, 0);
+		}
+
+		byte[] data = new byte[64];
+		assertEquals(0, cursor.read(data, 0, data.length));
+		assertTrue(cursor.takeDiscontinuity());
+		assertFalse(cursor.takeDiscontinuity());
+		assertEquals(10 * CHUNK_SIZE, cursor.getSkippedBytes());
+		assertEquals(1, cursor.getSkipCount());
+
+		ring.write(chunk(10), 0, CHUNK_SIZE, 0);
+		assertEquals(CHUNK_SIZE, cursor.read(data, 0, data.length));
+		assertEquals(10, sequenceOf(data));
+	}
+
+	@Test
+	public void skipToNewestDropsEverythingUnreadPastTheMaximumLag() {
+		BroadcastRingBuffer ring = new BroadcastRingBuffer(1024);
+		BroadcastRingBuffer.Cursor cursor = ring.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_NEWEST, 2 * CHUNK_SIZE);
+		for (int i = 0; i < 4; i++) {
+			ring.write(chunk(i), 0, CHUNK_SIZE, 0);
+		}
+
+		byte[] data = new byte[64];
+		assertEquals(0, cursor.read(data, 0, data.length));
+		assertTrue(cursor.takeDiscontinuity());
+		assertEquals(4 * CHUNK_SIZE, cursor.getSkippedBytes());
+	}
+
+	@Test
+	public void skipToOldestKeepsTheNewerHalfWhenLapped() {
+		BroadcastRingBuffer ring = new BroadcastRingBuffer(64);
+		BroadcastRingBuffer.Cursor cursor = ring.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_OLDEST, 64);
+		for (int i = 0; i < 10; i++) {
+			ring.write(chunk(i), 0, CHUNK_SIZE, i);
+		}
+
+		// 160 bytes written, half the buffer back is chunk 8.
+		byte[] data = new byte[64];
+		assertEquals(CHUNK_SIZE, cursor.read(data, 0, data.length));
+		assertEquals(8, sequenceOf(data));
+		assertEquals(8, cursor.getLastArrivalTimeNs());
+		assertTrue(cursor.takeDiscontinuity());
+		assertEquals(8 * CHUNK_SIZE, cursor.getSkippedBytes());
+		assertEquals(CHUNK_SIZE, cursor.read(data, 0, data.length));
+		assertEquals(9, sequenceOf(data));
+		assertFalse(cursor.takeDiscontinuity());
+	}
+
+	@Test
+	public void skipToOldestIgnoresTheMaximumLag() {
+		BroadcastRingBuffer ring = new BroadcastRingBuffer(1024);
+		BroadcastRingBuffer.Cursor cursor = ring.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_OLDEST, CHUNK_SIZE);
+		for (int i = 0; i < 4; i++) {
+			ring.write(chunk(i), 0, CHUNK_SIZE, 0);
+		}
+
+		byte[] data = new byte[64];
+		assertEquals(CHUNK_SIZE, cursor.read(data, 0, data.length));
+		assertEquals(0, sequenceOf(data));
+		assertFalse(cursor.takeDiscontinuity());
+	}
+
+	@Test
+	public void closeSkipsToLiveDataWithoutADiscontinuity() {
+		BroadcastRingBuffer ring = new BroadcastRingBuffer(1024);
+		BroadcastRingBuffer.Cursor cursor = ring.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_OLDEST, 1024);
+		ring.write(chunk(0), 0, CHUNK_SIZE, 0);
+		cursor.close();
+		ring.write(chunk(1), 0, CHUNK_SIZE, 0);
+
+		byte[] data = new byte[64];
+		assertEquals(0, cursor.read(data, 0, data.length));
+		ring.write(chunk(2), 0, CHUNK_SIZE, 0);
+		assertEquals(CHUNK_SIZE, cursor.read(data, 0, data.length));
+		assertEquals(2, sequenceOf(data));
+		assertFalse(cursor.takeDiscontinuity());
+		assertEquals(0, cursor.getSkipCount());
+	}
+
+	@Test
+	public void readReturnsZeroOnTimeout() {
+		BroadcastRingBuffer ring = new BroadcastRingBuffer(1024);
+		BroadcastRingBuffer.Cursor cursor = ring.newCursor(BroadcastRingBuffer.DropPolicy.SKIP_TO_OLDEST, 1024);
+		assertEquals(0, cursor.read(new byte[64], 0, 64));
+		assertEquals(-1, cursor.read());
+	}
+
+	/**
+	 * One producer against cursors of both policies, on a buffer small
+	 * enough for them to get lapped all the time: every chunk read must be
+	 * one the producer wrote, whole, and in order.
+	 */
+	@Test
+	public void cursorsNeverReadTornChunks() throws InterruptedException {
+		BroadcastRingBuffer ring = new BroadcastRingBuffer(4096);
+		AtomicBoolean written = new AtomicBoolean();
+		AtomicReference<Throwable> failure = new AtomicReference<>();
+		List<Thread> consumers = new ArrayList<>();
+		List<BroadcastRingBuffer.Cursor> cursors = new ArrayList<>();
+		for (int i = 0; i < HAMMER_CURSORS; i++) {
+			BroadcastRingBuffer.DropPolicy policy = i % 2 == 0
+					? BroadcastRingBuffer.DropPolicy.SKIP_TO_NEWEST
+					: BroadcastRingBuffer.DropPolicy.SKIP_TO_OLDEST;
+			BroadcastRingBuffer.Cursor cursor = ring.newCursor(policy, ring.getCapacity());
+			cursors.add(cursor);
+			Thread consumer = new Thread(() -> consume(cursor, written, failure));
+			consumers.add(consumer);
+			consumer.start();
+		}
+
+		for (long sequence = 0; sequence < HAMMER_CHUNKS; sequence++) {
+			byte[] data = chunk(sequence, lengthOf(sequence));
+			ring.write(data, 0, data.length, sequence);
+		}
+		written.set(true);
+		for (Thread consumer : consumers) {
+			consumer.join();
+		}
+
+		assertNull(failure.get());
+		for (BroadcastRingBuffer.Cursor cursor : cursors) {
+			assertEquals(0, cursor.available());
+		}
+	}
+
+	private static void consume(BroadcastRingBuffer.Cursor cursor, AtomicBoolean written, AtomicReference<Throwable> failure) {
+		byte[] data = new byte[1024];
+		long previous = -1;
+		boolean discontinuity = false;
+		try {
+			while (previous < HAMMER_CHUNKS - 1) {
+				boolean done = written.get();
+				int length = cursor.read(data, 0, data.length);
+				// A skip to the newest chunk is reported on the read that waited for the next one.
+				discontinuity |= cursor.takeDiscontinuity();
+				if (length == 0) {
+					// The last chunks were skipped.
+					if (done)
+						break;
+					continue;
+				}
+
+				long sequence = sequenceOf(data);
+				assertEquals(lengthOf(sequence), length);
+				for (int i = HEADER_SIZE; i < length; i++) {
+					assertEquals((byte) (sequence + i), data[i]);
+				}
+				assertEquals(sequence, cursor.getLastArrivalTimeNs());
+				if (discontinuity)
+					assertTrue(sequence > previous + 1);
+				else
+					assertEquals(previous + 1, sequence);
+				previous = sequence;
+				discontinuity = false;
+			}
+		} catch (Throwable t) {
+			failure.compareAndSet(null, t);
+		}
+	}
+
+	private static int lengthOf(long sequence) {
+		return HEADER_SIZE + (int) (sequence % 200) + 1;
+	}
+
+	private static byte[] chunk(long sequence) {
+		return chunk(sequence, CHUNK_SIZE);
+	}
+
+	/**
+	 * Returns a chunk starting with its sequence number, followed by bytes
+	 * derived from it.
+	 */
+	private static byte[] chunk(long sequence, int length) {
+		byte[] data = new byte[length];
+		for (int i = 0; i < HEADER_SIZE; i++) {
+			data[i] = (byte) (sequence >>> (8 * (HEADER_SIZE - 1 - i)));
+		}
+		for (int i = HEADER_SIZE; i < length; i++) {
+			data[i] = (byte) (sequence + i);
+		}
+		return data;
+	}
+
+	private static long sequenceOf(byte[] data) {
+		long sequence = 0;
+		for (int i = 0; i < HEADER_SIZE; i++) {
+			sequence = (sequence << 8) | (data[i] & 0xFF);
+		}
+		return sequence;
+	}
+}
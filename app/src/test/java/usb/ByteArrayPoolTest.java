@@ -0,0 +1,103 @@
+/*
+ * Copyright 2019, Digi International Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+package usb;
+
+import org.junit.Test;
+
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertNotSame;
+import static org.junit.Assert.assertSame;
+
+public class ByteArrayPoolTest {
+
+	@Test
+	public void roundsSizesUpToAPowerOfTwo() {
+		ByteArrayPool pool = new ByteArrayPool();
+		assertEquals(1, pool.acquire(1).length);
+		assertEquals(2, pool.acquire(2).length);
+		assertEquals(4, pool.acquire(3).length);
+		assertEquals(1024, pool.acquire(1024).length);
+		assertEquals(2048, pool.acquire(1025).length);
+	}
+
+	@Test(expected = IllegalArgumentException.class)
+	public void rejectsEmptyArrays() {
+		new ByteArrayPool().acquire(0);
+	}
+
+	@Test(expected = IllegalArgumentException.class)
+	public void rejectsArraysLargerThanTheLargestClass() {
+		new ByteArrayPool().acquire((1 << 30) + 1);
+	}
+
+	@Test
+	public void recyclesReleasedArraysOfTheSameClass() {
+		ByteArrayPool pool = new ByteArrayPool();
+		byte[] array = pool.acquire(1000);
+		pool.release(array);
+		assertSame(array, pool.acquire(600));
+		assertEquals(1, pool.getAllocationCount());
+		assertEquals(1024, pool.getAllocatedBytes());
+	}
+
+	@Test
+	public void keepsClassesApart() {
+		ByteArrayPool pool = new ByteArrayPool();
+		byte[] array = pool.acquire(1024);
+		pool.release(array);
+		assertEquals(2048, pool.acquire(1025).length);
+		assertEquals(512, pool.acquire(512).length);
+		assertSame(array, pool.acquire(513));
+		assertEquals(3, pool.getAllocationCount());
+		assertEquals(1024 + 2048 + 512, pool.getAllocatedBytes());
+	}
+
+	@Test
+	public void ignoresArraysNotFromAPool() {
+		ByteArrayPool pool = new ByteArrayPool();
+		byte[] array = new byte[1000];
+		pool.release(array);
+		pool.release(null);
+		assertNotSame(array, pool.acquire(1000));
+		assertEquals(1, pool.getAllocationCount());
+	}
+
+	@Test
+	public void poolsAtMostEightArraysPerClass() {
+		ByteArrayPool pool = new ByteArrayPool();
+		byte[][] arrays = new byte[10][];
+		for (int i = 0; i < arrays.length; i++) {
+			arrays[i] = pool.acquire(64);
+		}
+		for (byte[] array : arrays) {
+			pool.release(array);
+		}
+		for (int i = 0; i < arrays.length; i++) {
+			pool.acquire(64);
+		}
+		assertEquals(12, pool.getAllocationCount());
+	}
+
+	@Test
+	public void clearDropsPooledArrays() {
+		ByteArrayPool pool = new ByteArrayPool();
+		byte[] array = pool.acquire(64);
+		pool.release(array);
+		pool.clear();
+		assertNotSame(array, pool.acquire(64));
+		assertEquals(2, pool.getAllocationCount());
+	}
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2019, Digi International Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+package usb;
+
+import org.junit.Test;
+
+import java.util.Arrays;
+
+import static org.junit.Assert.assertArrayEquals;
+import static org.junit.Assert.assertEquals;
+
+public class CircularByteBufferTest {
+
+	@Test
+	public void roundsTheCapacityUpToAPowerOfTwo() {
+		assertEquals(1, new CircularByteBuffer(1).getCapacity());
+		assertEquals(64, new CircularByteBuffer(64).getCapacity());
+		assertEquals(128, new CircularByteBuffer(65).getCapacity());
+	}
+
+	@Test(expected = IllegalArgumentException.class)
+	public void rejectsAnEmptyBuffer() {
+		new CircularByteBuffer(0);
+	}
+
+	@Test(expected = IllegalArgumentException.class)
+	public void rejectsABackingArrayNotAPowerOfTwo() {
+		new CircularByteBuffer(new byte[48]);
+	}
+
+	@Test
+	public void readsNothingWhenEmpty() {
+		CircularByteBuffer buffer = new CircularByteBuffer(16);
+		assertEquals(0, buffer.availableToRead());
+		assertEquals(16, buffer.availableToWrite());
+		assertEquals(0, buffer.read(new byte[8], 0, 8));
+		assertEquals(0, buffer.skip(8));
+		assertEquals(0, buffer.getReadableLength());
+	}
+
+	@Test
+	public void readsWhatWasWritten() {
+		CircularByteBuffer buffer = new CircularByteBuffer(16);
+		byte[] written = sequence(0, 10);
+		assertEquals(10, buffer.write(written, 0, 10));
+		assertEquals(10, buffer.availableToRead());
+		assertEquals(6, buffer.availableToWrite());
+
+		byte[] data = new byte[10];
+		assertEquals(10, buffer.read(data, 0, 10));
+		assertArrayEquals(written, data);
+		assertEquals(0, buffer.availableToRead());
+	}
+
+	@Test
+	public void wrapsAroundTheEnd() {
+		CircularByteBuffer buffer = new CircularByteBuffer(16);
+		byte[] data = new byte[16];
+		// Each write starts where the previous one ended, 12 bytes further, so they wrap at every other one.
+		for (int i = 0; i < 10; i++) {
+			byte[] written = sequence(i * 12, 12);
+			assertEquals(12, buffer.write(written, 0, 12));
+			assertEquals(12, buffer.read(data, 0, 16));
+			assertArrayEquals(written, Arrays.copyOf(data, 12));
+		}
+	}
+
+	@Test
+	public void keepsUnreadDataWhenFull() {
+		CircularByteBuffer buffer = new CircularByteBuffer(16);
+		byte[] written = sequence(0, 24);
+		assertEquals(16, buffer.write(written, 0, 24));
+		assertEquals(0, buffer.availableToWrite());
+		assertEquals(1, buffer.getOverrunCount());
+		assertEquals(8, buffer.getOverrunBytes());
+
+		assertEquals(0, buffer.write(written, 16, 8));
+		assertEquals(2, buffer.getOverrunCount());
+		assertEquals(16, buffer.getOverrunBytes());
+
+		byte[] data = new byte[16];
+		assertEquals(16, buffer.read(data, 0, 16));
+		assertArrayEquals(Arrays.copyOf(written, 16), data);
+	}
+
+	@Test
+	public void fillsUpAfterWrappingAround() {
+		CircularByteBuffer buffer = new CircularByteBuffer(16);
+		buffer.write(new byte[10], 0, 10);
+		buffer.skip(10);
+
+		byte[] written = sequence(10, 16);
+		assertEquals(16, buffer.write(written, 0, 16));
+		assertEquals(0, buffer.availableToWrite());
+		byte[] data = new byte[16];
+		assertEquals(16, buffer.read(data, 0, 16));
+		assertArrayEquals(written, data);
+	}
+
+	@Test
+	public void limitsReadsAndWritesToTheArrays() {
+		CircularByteBuffer buffer = new CircularByteBuffer(16);
+		assertEquals(4, buffer.write(sequence(0, 8), 4, 8));
+		assertEquals(0, buffer.getOverrunCount());
+		assertEquals(2, buffer.read(new byte[4], 2, 8));
+		assertEquals(0, buffer.read(new byte[4], 4, 8));
+	}
+
+	@Test
+	public void exposesContiguousRegionsUpToTheEnd() {
+		CircularByteBuffer buffer = new CircularByteBuffer(16);
+		buffer.write(new byte[12], 0, 12);
+		buffer.skip(12);
+
+		assertEquals(12, buffer.getWritableOffset());
+		assertEquals(4, buffer.getWritableLength());
+		System.arraycopy(sequence(0, 4), 0, buffer.array(), 12, 4);
+		buffer.commitWrite(4);
+		assertEquals(0, buffer.getWritableOffset());
+		assertEquals(12, buffer.getWritableLength());
+		System.arraycopy(sequence(4, 2), 0, buffer.array(), 0, 2);
+		buffer.commitWrite(2);
+
+		assertEquals(12, buffer.getReadableOffset());
+		assertEquals(4, buffer.getReadableLength());
+		buffer.skip(4);
+		assertEquals(0, buffer.getReadableOffset());
+		assertEquals(2, buffer.getReadableLength());
+		assertArrayEquals(sequence(4, 2), Arrays.copyOf(buffer.array(), 2));
+	}
+
+	@Test(expected = IllegalArgumentException.class)
+	public void rejectsCommitsPastTheWritableRegion() {
+		CircularByteBuffer buffer = new CircularByteBuffer(16);
+		buffer.write(new byte[12], 0, 12);
+		buffer.commitWrite(5);
+	}
+
+	@Test
+	public void clearDiscardsUnreadData() {
+		CircularByteBuffer buffer = new CircularByteBuffer(16);
+		buffer.write(new byte[10], 0, 10);
+		buffer.clearBuffer();
+		assertEquals(0, buffer.availableToRead());
+		assertEquals(16, buffer.availableToWrite());
+	}
+
+	private static byte[] sequence(int first, int length) {
+		byte[] data = new byte[length];
+		for (int i = 0; i < length; i++) {
+			data[i] = (byte) (first + i);
+		}
+		return data;
+	}
+}